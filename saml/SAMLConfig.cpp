@@ -52,6 +52,7 @@
 #include "saml2/metadata/Metadata.h"
 #include "saml2/metadata/MetadataFilter.h"
 #include "saml2/metadata/MetadataProvider.h"
+#include "saml2/metadata/MetadataScheduler.h"
 #include "util/SAMLConstants.h"
 
 #include <xmltooling/logging.h>
@@ -136,7 +137,7 @@ void SAMLConfig::setArtifactMap(ArtifactMap* artifactMap)
     m_artifactMap = artifactMap;
 }
 
-SAMLInternalConfig::SAMLInternalConfig() : m_initCount(0), m_lock(Mutex::create())
+SAMLInternalConfig::SAMLInternalConfig() : m_initCount(0), m_lock(Mutex::create()), m_schedulerWorkers(2), m_schedulerReloads(1)
 {
 }
 
@@ -224,6 +225,8 @@ void SAMLInternalConfig::term(bool termXMLTooling)
     MetadataFilterManager.deregisterFactories();
     MetadataProviderManager.deregisterFactories();
 
+    m_scheduler.reset();
+
     delete m_artifactMap;
     m_artifactMap = nullptr;
 
@@ -266,6 +269,25 @@ XMLCh* SAMLInternalConfig::generateIdentifier()
     return XMLString::transcode(hexform);
 }
 
+saml2md::MetadataScheduler& SAMLInternalConfig::getMetadataScheduler()
+{
+    Lock lock(m_lock);
+    if (!m_scheduler)
+        m_scheduler.reset(new saml2md::MetadataScheduler(m_schedulerWorkers, m_schedulerReloads));
+    return *m_scheduler;
+}
+
+void SAMLInternalConfig::setMetadataScheduling(unsigned int workers, unsigned int maxReloads)
+{
+    Lock lock(m_lock);
+    if (m_scheduler) {
+        Category::getInstance(SAML_LOGCAT ".Config").warn("metadata scheduler already started, ignoring new settings");
+        return;
+    }
+    m_schedulerWorkers = workers;
+    m_schedulerReloads = maxReloads;
+}
+
 void SAMLInternalConfig::setContactPriority(const XMLCh* contactTypes)
 {
     const XMLCh* ctype;
@@ -90,6 +90,10 @@ namespace xmltooling {
 };
 
 namespace opensaml {
+
+    namespace saml2md {
+        class SAML_API MetadataScheduler;
+    };
     
     /// @cond OFF
     class SAML_DLLLOCAL SAMLInternalConfig : public SAMLConfig
@@ -111,10 +115,16 @@ namespace opensaml {
         const saml2md::ContactPerson* getContactPerson(const saml2md::EntityDescriptor&) const;
         const saml2md::ContactPerson* getContactPerson(const saml2md::RoleDescriptor&) const;
 
+        // shared background maintenance for metadata providers
+        saml2md::MetadataScheduler& getMetadataScheduler();
+        void setMetadataScheduling(unsigned int workers, unsigned int maxReloads);
+
     private:
         int m_initCount;
         boost::scoped_ptr<xmltooling::Mutex> m_lock;
         std::vector<xmltooling::xstring> m_contactPriority;
+        unsigned int m_schedulerWorkers, m_schedulerReloads;
+        boost::scoped_ptr<saml2md::MetadataScheduler> m_scheduler;
     };
     /// @endcond
 
@@ -61,6 +61,7 @@ namespace opensaml {
             const char* getId() const;
             const xmltooling::XMLObject* getMetadata() const;
             std::pair<const EntityDescriptor*,const RoleDescriptor*> getEntityDescriptor(const Criteria& criteria) const;
+            bool getIndexKeys(std::set<std::string>& entityIDs, std::set<std::string>& sources) const;
 
         protected:
             /** Controls XML schema validation. */
@@ -129,6 +130,12 @@ namespace opensaml {
             boost::scoped_ptr<xmltooling::CondWait> m_cleanup_wait;
             boost::scoped_ptr<xmltooling::Thread> m_cleanup_thread;
             static void* cleanup_fn(void*);
+            void cleanup();
+
+            // Alternative to a dedicated thread, using the shared MetadataScheduler.
+            class CleanupTask;
+            friend class CleanupTask;
+            boost::scoped_ptr<CleanupTask> m_cleanupTask;
         };
 
     };
@@ -31,8 +31,11 @@
 
 #include <ctime>
 #include <map>
+#include <set>
 #include <vector>
 #include <string>
+#include <boost/shared_ptr.hpp>
+#include <xmltooling/unicode.h>
 
 namespace xmltooling {
     class XMLTOOL_API Credential;
@@ -44,6 +47,7 @@ namespace xmltooling {
 namespace opensaml {
     namespace saml2md {
         
+        class SAML_API KeyDescriptor;
         class SAML_API MetadataFilter;
 
 #if defined (_MSC_VER)
@@ -67,6 +71,10 @@ namespace opensaml {
              * 
              * <ul>
              *  <li>&lt;KeyInfoResolver&gt; elements with a type attribute
+             *  <li>indexEndpoints boolean attribute, enabling lookup of entities by endpoint location
+             *  <li>indexKeys boolean attribute, enabling lookup of entities by public key fingerprint
+             *  <li>preloadCredentials attribute, either "true" or a list of role element names, enabling
+             *      background resolution of the credentials of all roles, or of roles of those types, after indexing
              * </ul>
              * 
              * XML namespaces are ignored in the processing of these elements.
@@ -91,6 +99,19 @@ namespace opensaml {
             std::vector<const xmltooling::Credential*>::size_type resolve(
                 std::vector<const xmltooling::Credential*>& results, const xmltooling::CredentialCriteria* criteria=nullptr
                 ) const;
+            const ExtensionIndex* getExtensionIndex(const xmltooling::XMLObject& descriptor) const;
+            bool getEntityPage(EntityCursor& cursor, std::vector<const EntityDescriptor*>& page) const;
+
+            /**
+             * Reports the entityIDs and artifact source IDs in the provider's index.
+             * <p>The provider must be locked, or the caller must be handling a change
+             * event emitted by the provider.
+             *
+             * @param entityIDs receives the indexed entityIDs
+             * @param sources   receives the indexed artifact source IDs
+             * @return true iff the index reflects the full content of the provider
+             */
+            virtual bool getIndexKeys(std::set<std::string>& entityIDs, std::set<std::string>& sources) const;
 
         protected:
             /** Time of last update for reporting. */
@@ -135,6 +156,14 @@ namespace opensaml {
              */
             virtual void clearDescriptorIndex(bool freeSites=false);
 
+            /**
+             * Writes status attributes reporting how many roles have had their credentials
+             * preloaded and how many are still queued, if preloading is enabled.
+             *
+             * @param os    stream to write to
+             */
+            void outputPreloadStatus(std::ostream& os) const;
+
         private:
             typedef std::multimap<std::string,const EntityDescriptor*> sitemap_t;
             typedef std::multimap<std::string,const EntitiesDescriptor*> groupmap_t;
@@ -142,11 +171,51 @@ namespace opensaml {
             mutable sitemap_t m_sources;
             mutable groupmap_t m_groups;
 
+            // Well-known extensions of each indexed entity, role and group that has any.
+            typedef std::map<const xmltooling::XMLObject*,ExtensionIndex> extmap_t;
+            mutable extmap_t m_extensions;
+            void indexExtensions(const EntityDescriptor& site) const;
+            void unindexExtensions(const EntityDescriptor& site) const;
+
+            // Optional reverse index from normalized endpoint locations to the roles containing them.
+            typedef std::multimap< std::string,std::pair<const EntityDescriptor*,const RoleDescriptor*> > locmap_t;
+            bool m_indexEndpoints;
+            mutable locmap_t m_locations;
+            void indexEndpoints(const EntityDescriptor& site) const;
+            std::pair<const EntityDescriptor*,const RoleDescriptor*> getEntityDescriptorByLocation(const Criteria& criteria) const;
+
+            // Optional reverse index from public key fingerprints to the KeyDescriptors containing them.
+            typedef std::multimap< std::string,std::pair<const EntityDescriptor*,const KeyDescriptor*> > keymap_t;
+            bool m_indexKeys;
+            mutable keymap_t m_keys;
+            void indexKeys(const EntityDescriptor& site) const;
+            std::pair<const EntityDescriptor*,const RoleDescriptor*> getEntityDescriptorByKey(const Criteria& criteria) const;
+
             boost::scoped_ptr<xmltooling::KeyInfoResolver> m_resolverWrapper;
             boost::scoped_ptr<xmltooling::Mutex> m_credentialLock;
             typedef std::map< const RoleDescriptor*, std::vector<xmltooling::Credential*> > credmap_t;
             mutable credmap_t m_credentialMap;
             const credmap_t::mapped_type& resolveCredentials(const RoleDescriptor& role) const;
+
+            // Credentials shared by every role whose KeyInfo carries the same certificates, keyed by digest.
+            typedef std::map< std::string,boost::shared_ptr<xmltooling::Credential> > credpool_t;
+            mutable credpool_t m_credentialPool;
+            boost::shared_ptr<xmltooling::Credential> resolvePooledCredential(const KeyDescriptor& key, credpool_t& pool) const;
+            void resolveCredentials(const RoleDescriptor& role, credpool_t& pool, credmap_t::mapped_type& resolved) const;
+            void clearCredentials(const std::set<const EntityDescriptor*>* sites=nullptr, bool requeue=true) const;
+
+            // Optional eager resolution of role credentials on the shared scheduler after indexing.
+            class PreloadTask;
+            friend class PreloadTask;
+            bool m_preloadAll;
+            std::set<xmltooling::xstring> m_preloadTypes;
+            boost::scoped_ptr<PreloadTask> m_preloadTask;
+            mutable bool m_preloadActive,m_preloadCancel;
+            mutable std::vector<const RoleDescriptor*> m_preloadRoles;
+            mutable std::set<const RoleDescriptor*> m_preloaded;
+            void queuePreload(const EntityDescriptor& site) const;
+            void cancelPreload(const std::set<const EntityDescriptor*>* sites=nullptr) const;
+            void preloadCredentials() const;
         };
 
 #if defined (_MSC_VER)
@@ -29,8 +29,13 @@
 
 #include <saml/saml2/metadata/MetadataProvider.h>
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
+namespace xmltooling {
+    class XMLTOOL_API Mutex;
+};
+
 namespace opensaml {
     
     namespace saml2 {
@@ -41,6 +46,7 @@ namespace opensaml {
 
         class SAML_API EntityAttributes;
         class SAML_API EntityMatcher;
+        class SAML_API EntityMatcherResults;
         
 #if defined (_MSC_VER)
         #pragma warning( push )
@@ -86,6 +92,43 @@ namespace opensaml {
         public:
             virtual ~DiscoverableMetadataProvider();
 
+            /**
+             * Precompressed form of a complete feed, from which gzip and deflate
+             * encodings can be written without recompressing.
+             */
+            class SAML_API FeedEncoding {
+            public:
+                /**
+                 * Constructor.
+                 *
+                 * @param feed  the complete JSON array to compress
+                 */
+                FeedEncoding(const std::string& feed);
+
+                ~FeedEncoding();
+
+                /**
+                 * Selects the most preferred content coding that the client accepts and
+                 * is available in precompressed form.
+                 *
+                 * @param acceptEncoding    value of the client's Accept-Encoding header, or nullptr
+                 * @return  "gzip" or "deflate", or nullptr if the feed should be sent uncompressed
+                 */
+                static const char* negotiate(const char* acceptEncoding);
+
+                /**
+                 * Outputs the feed in a given content coding.
+                 *
+                 * @param os        stream to output feed into
+                 * @param coding    "gzip" or "deflate"
+                 */
+                void output(std::ostream& os, const char* coding) const;
+
+            private:
+                std::string m_deflated;
+                unsigned long m_crc, m_adler, m_size;
+            };
+
             /**
              * Returns the ETag associated with the cached feed.
              * <p>The provider <strong>MUST</strong> be locked.
@@ -105,6 +148,49 @@ namespace opensaml {
              */
             virtual void outputFeed(std::ostream& os, bool& first, bool wrapArray=true) const;
 
+            /**
+             * Outputs the cached feed as a complete JSON array, in the most preferred
+             * content coding acceptable to the client.
+             * <p>Compressed encodings are produced once per feed and reused until the
+             * feed changes.
+             * <p>The provider <strong>MUST</strong> be locked.
+             *
+             * @param os                stream to output feed into
+             * @param acceptEncoding    value of the client's Accept-Encoding header, or nullptr
+             * @param etag              on output, a strong ETag for the representation written
+             * @return  the content coding applied, or nullptr if the feed was written uncompressed
+             */
+            virtual const char* outputEncodedFeed(std::ostream& os, const char* acceptEncoding, std::string& etag) const;
+
+            /**
+             * Finds the feed entries that best match a typeahead query.
+             * <p>Every word in the query must prefix a word in one of the entity's display
+             * names, keywords, or its entityID. Matches in display names rank above keywords,
+             * which rank above entityIDs, and matches in the preferred language are favored.
+             * <p>The provider <strong>MUST</strong> be locked.
+             *
+             * @param query         the text typed so far, in UTF-8
+             * @param lang          preferred language, or nullptr
+             * @param maxResults    maximum number of matches to return
+             * @param results       array to append matches to, as pairs of score and JSON fragment
+             */
+            virtual void search(
+                const char* query, const char* lang, unsigned int maxResults, std::vector< std::pair<unsigned int,std::string> >& results
+                ) const;
+
+            /**
+             * Outputs the best matches for a typeahead query as a JSON array in the same
+             * format as the feed.
+             * <p>The provider <strong>MUST</strong> be locked.
+             *
+             * @param os            stream to output matches into
+             * @param query         the text typed so far, in UTF-8
+             * @param lang          preferred language, or nullptr
+             * @param maxResults    maximum number of matches to output
+             * @return  number of matches output
+             */
+            unsigned int outputSearch(std::ostream& os, const char* query, const char* lang=nullptr, unsigned int maxResults=10) const;
+
         protected:
             /** Storage for feed. */
             std::string m_feed;
@@ -113,13 +199,42 @@ namespace opensaml {
             mutable std::string m_feedTag;
 
         private:
-            void discoEntity(std::string& s, const EntityDescriptor* entity, bool& first) const;
-            void discoGroup(std::string& s, const EntitiesDescriptor* group, bool& first) const;
+            struct feed_term_t {
+                feed_term_t(const std::string& token, const char* lang, unsigned int weight)
+                    : m_token(token), m_lang(lang ? lang : ""), m_weight(weight), m_fragment(0) {}
+                bool operator<(const feed_term_t& rhs) const {
+                    return m_token < rhs.m_token;
+                }
+                std::string m_token, m_lang;
+                unsigned int m_weight, m_fragment;
+            };
+
+            struct feed_fragment_t {
+                std::string m_json;
+                std::vector<feed_term_t> m_terms;
+            };
+
+            boost::shared_ptr<const FeedEncoding> getFeedEncoding() const;
+
+            void discoEntity(std::string& s, const EntityDescriptor* entity, bool& first, std::vector<feed_term_t>* terms=nullptr) const;
+            void discoGroup(const EntitiesDescriptor* group);
+            void discoFragment(const EntityDescriptor* entity);
+            void joinFeed();
             void discoEntityAttributes(std::string& s, const EntityAttributes& ea, bool& first) const;
             void discoAttributes(std::string& s, const std::vector<saml2::Attribute*>& attrs, bool& first) const;
 
             bool m_legacyOrgNames, m_entityAttributes;
             std::vector< std::pair< bool, boost::shared_ptr<EntityMatcher> > > m_discoFilters;
+            boost::scoped_ptr<EntityMatcherResults> m_discoFilterResults;
+
+            // Serialized JSON per entity in document order, including any duplicate entityIDs.
+            // These are rebuilt with every feed and only kept so search can return single entries.
+            std::vector<feed_fragment_t> m_feedFragments;
+
+            // Search terms from every fragment, sorted for prefix lookup.
+            std::vector<feed_term_t> m_searchIndex;
+            boost::scoped_ptr<xmltooling::Mutex> m_feedEncodingLock;
+            mutable boost::shared_ptr<const FeedEncoding> m_feedEncoding;
         };
 
 #if defined (_MSC_VER)
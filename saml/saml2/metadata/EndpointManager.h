@@ -29,12 +29,178 @@
 
 #include <saml/base.h>
 
+#include <algorithm>
 #include <vector>
 #include <xercesc/util/XMLString.hpp>
 
 namespace opensaml {
     namespace saml2md {
         
+        /**
+         * Template for a precomputed binding lookup table over unindexed endpoint information.
+         * <p>The table refers to the endpoints it was built from, which must not change
+         * while it is in use. It is meant to be built once for a role and handed to each
+         * EndpointManager that selects from that role, so that every selection is a single
+         * lookup instead of a scan.
+         *
+         * @param _Tx   the endpoint type being indexed
+         */
+        template <class _Tx>
+        class EndpointTable
+        {
+        protected:
+            /** An endpoint keyed by binding or index. */
+            template <class _Key> struct entry_t {
+                /** Constructor. */
+                entry_t(_Key k, const _Tx* e) : key(k), endpoint(e) {}
+                /** Lookup key. */
+                _Key key;
+                /** Endpoint for the key. */
+                const _Tx* endpoint;
+            };
+
+            /** Orders binding entries by binding. */
+            struct binding_less {
+                /** Compares two entries. */
+                bool operator()(const entry_t<const XMLCh*>& a, const entry_t<const XMLCh*>& b) const {
+                    return xercesc::XMLString::compareString(a.key, b.key) < 0;
+                }
+                /** Compares an entry with a binding. */
+                bool operator()(const entry_t<const XMLCh*>& a, const XMLCh* b) const {
+                    return xercesc::XMLString::compareString(a.key, b) < 0;
+                }
+            };
+
+            /** Reference to endpoint array. */
+            const typename std::vector<_Tx*>& m_endpoints;
+
+            /** Endpoints sorted by binding, in document order within a binding. */
+            std::vector< entry_t<const XMLCh*> > m_bindings;
+
+        public:
+            /**
+             * Constructor.
+             *
+             * @param endpoints array of endpoints to index
+             */
+            EndpointTable(const typename std::vector<_Tx*>& endpoints) : m_endpoints(endpoints) {
+                m_bindings.reserve(endpoints.size());
+                for (typename std::vector<_Tx*>::const_iterator i = endpoints.begin(); i != endpoints.end(); ++i) {
+                    if ((*i)->getBinding())
+                        m_bindings.push_back(entry_t<const XMLCh*>((*i)->getBinding(), *i));
+                }
+                std::stable_sort(m_bindings.begin(), m_bindings.end(), binding_less());
+            }
+
+            /**
+             * Returns the endpoints the table was built from.
+             *
+             * @return array of endpoints
+             */
+            const typename std::vector<_Tx*>& getEndpoints() const {
+                return m_endpoints;
+            }
+
+            /**
+             * Returns the first endpoint that supports a particular binding.
+             *
+             * @param binding   binding to locate
+             * @return a supporting endpoint, or nullptr
+             */
+            const _Tx* getByBinding(const XMLCh* binding) const {
+                if (!binding)
+                    return nullptr;
+                typename std::vector< entry_t<const XMLCh*> >::const_iterator i =
+                    std::lower_bound(m_bindings.begin(), m_bindings.end(), binding, binding_less());
+                return (i != m_bindings.end() && xercesc::XMLString::equals(binding, i->key)) ? i->endpoint : nullptr;
+            }
+
+            /**
+             * Returns every endpoint that supports a particular binding, in document order.
+             *
+             * @param binding   binding to locate
+             * @param endpoints array to append the supporting endpoints to
+             * @return the number of endpoints appended
+             */
+            typename std::vector<const _Tx*>::size_type getAllByBinding(const XMLCh* binding, std::vector<const _Tx*>& endpoints) const {
+                typename std::vector<const _Tx*>::size_type count = 0;
+                if (!binding)
+                    return count;
+                typename std::vector< entry_t<const XMLCh*> >::const_iterator i =
+                    std::lower_bound(m_bindings.begin(), m_bindings.end(), binding, binding_less());
+                for (; i != m_bindings.end() && xercesc::XMLString::equals(binding, i->key); ++i, ++count)
+                    endpoints.push_back(i->endpoint);
+                return count;
+            }
+        };
+
+        /**
+         * Template for precomputed binding and index lookup tables over indexed endpoint information.
+         * <p>The table refers to the endpoints it was built from, which must not change
+         * while it is in use.
+         *
+         * @param _Tx   the endpoint type being indexed
+         */
+        template <class _Tx>
+        class IndexedEndpointTable : public EndpointTable<_Tx>
+        {
+            typedef typename EndpointTable<_Tx>::template entry_t<int> index_entry_t;
+
+            /** Orders index entries by index. */
+            struct index_less {
+                bool operator()(const index_entry_t& a, const index_entry_t& b) const {
+                    return a.key < b.key;
+                }
+                bool operator()(const index_entry_t& a, int b) const {
+                    return a.key < b;
+                }
+            };
+
+            std::vector<index_entry_t> m_indexes;
+            const _Tx* m_default;
+
+        public:
+            /**
+             * Constructor.
+             *
+             * @param endpoints array of endpoints to index
+             */
+            IndexedEndpointTable(const typename std::vector<_Tx*>& endpoints) : EndpointTable<_Tx>(endpoints), m_default(nullptr) {
+                m_indexes.reserve(endpoints.size());
+                for (typename std::vector<_Tx*>::const_iterator i = endpoints.begin(); i != endpoints.end(); ++i) {
+                    std::pair<bool,int> index = (*i)->getIndex();
+                    if (index.first)
+                        m_indexes.push_back(index_entry_t(index.second, *i));
+                    if (!m_default && (*i)->isDefault())
+                        m_default = *i;
+                }
+                std::stable_sort(m_indexes.begin(), m_indexes.end(), index_less());
+                if (!m_default && !endpoints.empty())
+                    m_default = endpoints.front();
+            }
+
+            /**
+             * Returns the default endpoint in the set.
+             *
+             * @return the default endpoint
+             */
+            const _Tx* getDefault() const {
+                return m_default;
+            }
+
+            /**
+             * Returns indexed endpoint.
+             *
+             * @param index index to locate
+             * @return matching endpoint, or nullptr
+             */
+            const _Tx* getByIndex(unsigned short index) const {
+                typename std::vector<index_entry_t>::const_iterator i =
+                    std::lower_bound(m_indexes.begin(), m_indexes.end(), static_cast<int>(index), index_less());
+                return (i != m_indexes.end() && i->key == index) ? i->endpoint : nullptr;
+            }
+        };
+
         /**
          * Template for processing unindexed endpoint information.
          * 
@@ -46,6 +212,9 @@ namespace opensaml {
         protected:
             /** Reference to endpoint array. */
             const typename std::vector<_Tx*>& m_endpoints;
+
+            /** Precomputed lookup table, if any. */
+            const EndpointTable<_Tx>* m_table;
             
         public:
             /**
@@ -53,7 +222,15 @@ namespace opensaml {
              *
              * @param endpoints array of endpoints to manage
              */
-            EndpointManager(const typename std::vector<_Tx*>& endpoints) : m_endpoints(endpoints) {
+            EndpointManager(const typename std::vector<_Tx*>& endpoints) : m_endpoints(endpoints), m_table(nullptr) {
+            }
+
+            /**
+             * Constructor.
+             *
+             * @param table precomputed lookup table over the endpoints to manage
+             */
+            EndpointManager(const EndpointTable<_Tx>& table) : m_endpoints(table.getEndpoints()), m_table(&table) {
             }
             
             /**
@@ -63,6 +240,8 @@ namespace opensaml {
              * @return a supporting endpoint, favoring the default, or nullptr
              */
             const _Tx* getByBinding(const XMLCh* binding) const {
+                if (m_table)
+                    return m_table->getByBinding(binding);
                 for (typename std::vector<_Tx*>::const_iterator i = m_endpoints.begin(); i!=m_endpoints.end(); ++i) {
                     if (xercesc::XMLString::equals(binding,(*i)->getBinding()))
                         return *i;
@@ -79,7 +258,8 @@ namespace opensaml {
         template <class _Tx>
         class IndexedEndpointManager : public EndpointManager<_Tx>
         {
-            const _Tx* m_default;
+            mutable const _Tx* m_default;
+            const IndexedEndpointTable<_Tx>* m_indexTable;
             
         public:
             /**
@@ -87,7 +267,17 @@ namespace opensaml {
              *
              * @param endpoints array of endpoints to manage
              */
-            IndexedEndpointManager(const typename std::vector<_Tx*>& endpoints) : EndpointManager<_Tx>(endpoints), m_default(nullptr) {
+            IndexedEndpointManager(const typename std::vector<_Tx*>& endpoints)
+                : EndpointManager<_Tx>(endpoints), m_default(nullptr), m_indexTable(nullptr) {
+            }
+
+            /**
+             * Constructor.
+             *
+             * @param table precomputed lookup tables over the endpoints to manage
+             */
+            IndexedEndpointManager(const IndexedEndpointTable<_Tx>& table)
+                : EndpointManager<_Tx>(table), m_default(table.getDefault()), m_indexTable(&table) {
             }
             
             /**
@@ -112,6 +302,8 @@ namespace opensaml {
              * @return matching endpoint, or nullptr
              */
             const _Tx* getByIndex(unsigned short index) const {
+                if (m_indexTable)
+                    return m_indexTable->getByIndex(index);
                 for (typename std::vector<_Tx*>::const_iterator i = EndpointManager<_Tx>::m_endpoints.begin(); i!=EndpointManager<_Tx>::m_endpoints.end(); ++i) {
                     std::pair<bool,int> comp = (*i)->getIndex();
                     if (comp.first && index == comp.second)
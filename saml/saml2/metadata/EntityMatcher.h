@@ -29,11 +29,24 @@
 #ifndef __saml2_entitymatcher_h__
 #define __saml2_entitymatcher_h__
 
+#include <map>
+#include <vector>
+
+namespace xmltooling {
+    class XMLTOOL_API XMLObject;
+};
+
 namespace opensaml {
     namespace saml2md {
 
+        class SAML_API EntitiesDescriptor;
         class SAML_API EntityDescriptor;
 
+#if defined (_MSC_VER)
+        #pragma warning( push )
+        #pragma warning( disable : 4251 )
+#endif
+
         /**
          * An entity matcher is a predicate that evaluates an entity against a set of matching rules.
          */
@@ -52,8 +65,86 @@ namespace opensaml {
              * @return  true iff the entity is matched
              */
             virtual bool matches(const EntityDescriptor& entity) const=0;
+
+            /**
+             * Applies the instance's matching rule(s) against a group, such that a match
+             * applies to every entity the group contains.
+             * <p>The default implementation returns false.
+             *
+             * @param group the group to evaluate
+             * @return  true iff the group is matched
+             */
+            virtual bool matchesGroup(const EntitiesDescriptor& group) const;
+
+            /**
+             * Applies the instance's matching rule(s) against an entity, ignoring any
+             * groups that contain it.
+             * <p>The default implementation calls matches().
+             *
+             * @param entity the entity to evaluate
+             * @return  true iff the entity is matched on its own
+             */
+            virtual bool matchesIgnoringGroups(const EntityDescriptor& entity) const;
+
+        protected:
+            /**
+             * Combines matchesIgnoringGroups() with matchesGroup() applied to each group
+             * that contains the entity.
+             *
+             * @param entity the entity to evaluate
+             * @return  true iff the entity or one of its groups is matched
+             */
+            bool matchesWithGroups(const EntityDescriptor& entity) const;
         };
 
+        /**
+         * The outcomes of a set of matchers compiled against every entity in a metadata
+         * tree, held as a bitset per entity so that repeated evaluations are bit tests.
+         * <p>Each group in the tree is evaluated once on behalf of all its members.
+         * Results are keyed by object and are only meant to live while a single pass over
+         * an unchanging tree is under way, such as building a discovery feed; they
+         * <strong>MUST</strong> be cleared before the tree can change. Metadata filters
+         * run once per load and still evaluate their matchers directly.
+         */
+        class SAML_API EntityMatcherResults
+        {
+            MAKE_NONCOPYABLE(EntityMatcherResults);
+        public:
+            EntityMatcherResults();
+            ~EntityMatcherResults();
+
+            /**
+             * Evaluates each matcher against every entity in a tree, replacing any earlier results.
+             *
+             * @param matchers  the matchers to evaluate, in bit order
+             * @param metadata  root of the metadata tree
+             */
+            void compile(const std::vector<const EntityMatcher*>& matchers, const xmltooling::XMLObject* metadata);
+
+            /**
+             * Discards all results.
+             */
+            void clear();
+
+            /**
+             * Returns the compiled results for an entity, one bit per matcher.
+             *
+             * @param entity    the entity to look up
+             * @return  the entity's results, or null if it was not compiled
+             */
+            const std::vector<bool>* get(const EntityDescriptor& entity) const;
+
+        private:
+            void compileGroup(const std::vector<const EntityMatcher*>& matchers, const EntitiesDescriptor& group, const std::vector<bool>& inherited);
+            void compileEntity(const std::vector<const EntityMatcher*>& matchers, const EntityDescriptor& entity, const std::vector<bool>& inherited);
+
+            std::map< const EntityDescriptor*,std::vector<bool> > m_results;
+        };
+
+#if defined (_MSC_VER)
+        #pragma warning( pop )
+#endif
+
         /**
          * Registers EntityMatcher classes into the runtime.
          */
@@ -1002,6 +1002,55 @@ namespace opensaml {
             }
         };
 
+        /**
+         * Casts a metadata object to a type bound to a single element name, such as an
+         * extension or descriptor. The element name is compared first, so that objects of
+         * other types are turned away without a runtime type check.
+         *
+         * @param xmlObject the object to cast, or nullptr
+         * @return the object as the requested type, or nullptr
+         */
+        template <class T> T* metadata_cast(xmltooling::XMLObject* xmlObject)
+        {
+            if (xmlObject && xercesc::XMLString::equals(xmlObject->getElementQName().getLocalPart(), T::LOCAL_NAME))
+                return dynamic_cast<T*>(xmlObject);
+            return nullptr;
+        }
+
+        /**
+         * Casts a metadata object to a type bound to a single element name, such as an
+         * extension or descriptor. The element name is compared first, so that objects of
+         * other types are turned away without a runtime type check.
+         *
+         * @param xmlObject the object to cast, or nullptr
+         * @return the object as the requested type, or nullptr
+         */
+        template <class T> const T* metadata_cast(const xmltooling::XMLObject* xmlObject)
+        {
+            if (xmlObject && xercesc::XMLString::equals(xmlObject->getElementQName().getLocalPart(), T::LOCAL_NAME))
+                return dynamic_cast<const T*>(xmlObject);
+            return nullptr;
+        }
+
+        /**
+         * Returns the first extension of a given type.
+         *
+         * @param exts  the extensions to search, or nullptr
+         * @return the first extension of the requested type, or nullptr
+         */
+        template <class T> T* findExtension(const Extensions* exts)
+        {
+            if (exts) {
+                const std::vector<xmltooling::XMLObject*>& children = exts->getUnknownXMLObjects();
+                for (std::vector<xmltooling::XMLObject*>::const_iterator i = children.begin(); i != children.end(); ++i) {
+                    T* t = metadata_cast<T>(*i);
+                    if (t)
+                        return t;
+                }
+            }
+            return nullptr;
+        }
+
         /**
          * Registers builders and validators for SAML 2.0 Metadata classes into the runtime.
          */
@@ -29,6 +29,9 @@
 #ifndef __saml2_metadatafilt_h__
 #define __saml2_metadatafilt_h__
 
+#include <list>
+#include <vector>
+
 namespace opensaml {
     namespace saml2md {
 
@@ -109,6 +112,149 @@ namespace opensaml {
             virtual void doFilter(const MetadataFilterContext* ctx, xmltooling::XMLObject& xmlObject) const=0;
         };
 
+        /**
+         * A metadata filter that works on each entity independently of the others.
+         *
+         * <p>Subclasses supply per-entity and per-group callbacks, and the default
+         * doFilter() walks the metadata applying them. Consecutive filters of this kind
+         * installed in a provider are applied together in a single pass, ending after any
+         * filter that prunes groups, and with the provider's filterThreads setting the
+         * entities may be visited concurrently, so the callbacks <strong>MUST</strong>
+         * only modify the object they are given.</p>
+         */
+        class SAML_API EntityMetadataFilter : public MetadataFilter
+        {
+            MAKE_NONCOPYABLE(EntityMetadataFilter);
+        protected:
+            EntityMetadataFilter();
+        public:
+            virtual ~EntityMetadataFilter();
+
+            void doFilter(const MetadataFilterContext* ctx, xmltooling::XMLObject& xmlObject) const;
+
+            /**
+             * Filters a single entity. A request to remove the root of the metadata is ignored.
+             *
+             * @param ctx       context interface, or nullptr
+             * @param entity    the entity to filter
+             * @return true iff the entity should be removed
+             */
+            virtual bool filterEntity(const MetadataFilterContext* ctx, EntityDescriptor& entity) const=0;
+
+            /**
+             * Examines a group before its contents are filtered. A request to remove the
+             * root of the metadata is ignored.
+             * <p>The default implementation does nothing.
+             *
+             * @param ctx   context interface, or nullptr
+             * @param group the group to examine
+             * @return true iff the group should be removed without filtering its contents
+             */
+            virtual bool enterGroup(const MetadataFilterContext* ctx, EntitiesDescriptor& group) const;
+
+            /**
+             * Examines a group after its contents are filtered. A request to remove the
+             * root of the metadata is ignored.
+             * <p>The default implementation does nothing.
+             *
+             * @param ctx   context interface, or nullptr
+             * @param group the group to examine
+             * @return true iff the group should be removed
+             */
+            virtual bool leaveGroup(const MetadataFilterContext* ctx, EntitiesDescriptor& group) const;
+
+            /**
+             * Returns true iff leaveGroup() may remove groups, in which case the filter has to
+             * see the results of the filters before it and none of those after it, and so is
+             * the last one applied in a pass. Subclasses overriding leaveGroup() must override
+             * this as well.
+             * <p>The default implementation returns false.
+             *
+             * @return true iff the filter prunes groups on the way out of them
+             */
+            virtual bool prunesGroups() const;
+
+            /**
+             * Applies a sequence of filters in as few passes over the metadata as their
+             * order allows, giving each entity to every filter in a pass in turn. A pass
+             * ends after each filter that prunes groups.
+             *
+             * @param ctx       context interface, or nullptr
+             * @param xmlObject the metadata to be filtered
+             * @param filters   the filters to apply, in order
+             * @param threads   number of threads to visit entities with
+             */
+            static void doFilters(
+                const MetadataFilterContext* ctx,
+                xmltooling::XMLObject& xmlObject,
+                const std::vector<const EntityMetadataFilter*>& filters,
+                unsigned int threads=1
+                );
+        };
+
+        /**
+         * Removes every child for which a predicate holds from one of a parent's lists of children.
+         * <p>The predicate is applied to each child exactly once, in order, before anything
+         * is changed. The typed list is then compacted in place, the rejects are unlinked from
+         * the parent's ordered children in a single walk, and only then deleted, so the whole
+         * operation is linear no matter how many children are removed.
+         * <p>This relies on each typed list holding its children in the same relative order
+         * as the parent's ordered children, which is how XMLObjectChildrenList maintains them.
+         *
+         * @param parent    the object owning the children
+         * @param children  the parent's typed list of children to prune
+         * @param reject    returns true for each child to remove
+         * @return the number of children removed
+         */
+        template <class Child, class Predicate> typename std::vector<Child*>::size_type removeChildren(
+            xmltooling::XMLObject& parent, const std::vector<Child*>& children, Predicate reject
+            )
+        {
+            std::vector<bool> rejected(children.size());
+            typename std::vector<Child*>::size_type removed = 0;
+            for (typename std::vector<Child*>::size_type i = 0; i < rejected.size(); ++i) {
+                if (reject(children[i])) {
+                    rejected[i] = true;
+                    ++removed;
+                }
+            }
+            if (removed == 0)
+                return 0;
+
+            // The lists are only exposed as const by the parent, but belong to it and aren't const.
+            std::vector<Child*>& typed = const_cast<std::vector<Child*>&>(children);
+            std::list<xmltooling::XMLObject*>& ordered = const_cast<std::list<xmltooling::XMLObject*>&>(parent.getOrderedChildren());
+
+            std::vector<Child*> rejects;
+            rejects.reserve(removed);
+            typename std::vector<Child*>::size_type kept = 0;
+            for (typename std::vector<Child*>::size_type i = 0; i < typed.size(); ++i) {
+                if (rejected[i])
+                    rejects.push_back(typed[i]);
+                else
+                    typed[kept++] = typed[i];
+            }
+            typed.resize(kept);
+
+            typename std::vector<Child*>::const_iterator next = rejects.begin();
+            for (std::list<xmltooling::XMLObject*>::iterator i = ordered.begin(); i != ordered.end() && next != rejects.end();) {
+                if (*i == *next) {
+                    i = ordered.erase(i);
+                    ++next;
+                }
+                else {
+                    ++i;
+                }
+            }
+
+            parent.releaseThisandParentDOM();
+            for (typename std::vector<Child*>::const_iterator c = rejects.begin(); c != rejects.end(); ++c) {
+                (*c)->setParent(nullptr);
+                delete *c;
+            }
+            return removed;
+        }
+
         /**
          * Registers MetadataFilter classes into the runtime.
          */
@@ -29,6 +29,7 @@
 
 #include <saml/base.h>
 
+#include <string>
 #include <vector>
 #include <iostream>
 #include <boost/ptr_container/ptr_vector.hpp>
@@ -46,9 +47,18 @@ namespace opensaml {
 
     namespace saml2md {
 
+        class SAML_API DigestMethod;
+        class SAML_API DiscoHints;
+        class SAML_API EntityAttributes;
         class SAML_API EntityDescriptor;
         class SAML_API EntitiesDescriptor;
+        class SAML_API EntityMatcher;
+        class SAML_API Extensions;
+        class SAML_API RegistrationInfo;
         class SAML_API RoleDescriptor;
+        class SAML_API SigningMethod;
+        class SAML_API SourceID;
+        class SAML_API UIInfo;
         class SAML_API MetadataCredentialResolver;
         class SAML_API MetadataFilter;
         class SAML_API MetadataFilterContext;
@@ -88,6 +98,8 @@ namespace opensaml {
              *  <li>&lt;MetadataFilter&gt; elements with a type attribute and type-specific content
              *  <li>&lt;Exclude&gt; elements representing a BlacklistMetadataFilter
              *  <li>&lt;Include&gt; elements representing a WhitelistMetadataFilter
+             *  <li>filterThreads attribute, the number of threads used to apply consecutive
+             *      per-entity filters (defaults to 1)
              * </ul>
              *
              * XML namespaces are ignored in the processing of these elements.
@@ -244,6 +256,18 @@ namespace opensaml {
                 const XMLCh* protocol2;
                 /** Controls whether stale metadata is ignored. */
                 bool validOnly;
+                /**
+                 * Endpoint Location or ResponseLocation URL, consulted when no entityID or artifact
+                 * is supplied, and only by providers that index endpoints.
+                 */
+                const char* location;
+                /**
+                 * Base64-encoded SHA-256 digest of a DER-encoded public key, consulted when no entityID,
+                 * artifact or location is supplied, and only by providers that index keys.
+                 */
+                const char* keyFingerprint;
+                /** Credential usage mask that a fingerprinted key must allow, or zero for any usage. */
+                unsigned int keyUsage;
             };
 
             /**
@@ -257,6 +281,116 @@ namespace opensaml {
              */
             virtual std::pair<const EntityDescriptor*,const RoleDescriptor*> getEntityDescriptor(const Criteria& criteria) const=0;
 
+            /**
+             * Tracks the position of, and the filters applied to, an enumeration of a provider's
+             * entities in entityID order.
+             */
+            struct SAML_API EntityCursor {
+                /**
+                 * Constructor.
+                 *
+                 * @param size  maximum number of entities to return per page, or zero for no limit
+                 * @param q     element/type of role that entities must have, if any
+                 * @param prot  protocol support constant the role must have, if any
+                 * @param m     matcher that entities must satisfy, if any
+                 * @param valid true iff stale metadata should be skipped
+                 * @param scan  maximum number of entityIDs to examine per page, or zero for no limit
+                 */
+                EntityCursor(
+                    unsigned int size=100,
+                    const xmltooling::QName* q=nullptr,
+                    const XMLCh* prot=nullptr,
+                    const EntityMatcher* m=nullptr,
+                    bool valid=true,
+                    unsigned int scan=1000
+                    );
+
+                virtual ~EntityCursor();
+
+                /**
+                 * Restarts the enumeration from the first entity.
+                 */
+                virtual void rewind();
+
+                /**
+                 * Applies the cursor's filters to an entity.
+                 *
+                 * @param entity    the entity to evaluate
+                 * @return true iff the entity should be returned
+                 */
+                virtual bool matches(const EntityDescriptor& entity) const;
+
+                /** Maximum number of entities per page, or zero for no limit. */
+                unsigned int pageSize;
+                /** Maximum number of entityIDs examined per page, matching or not, or zero for no limit. */
+                unsigned int scanLimit;
+                /** Element or schema type QName of a role the entity must have. */
+                const xmltooling::QName* role;
+                /** Protocol support constant of the role. */
+                const XMLCh* protocol;
+                /** Matcher the entity must satisfy. */
+                const EntityMatcher* matcher;
+                /** Controls whether stale metadata is skipped. */
+                bool validOnly;
+                /** entityID of the last entity returned, or empty before the first page. */
+                std::string position;
+            };
+
+            /**
+             * Returns the next page of entities after the cursor's position, in entityID order,
+             * and advances the cursor. Every copy of an entityID is returned in the same page.
+             * <p>A page ends early once the cursor's scan limit is reached, so a selective filter
+             * may yield short or even empty pages while entities remain.
+             * <p>The provider <strong>MUST</strong> be locked, and the entities returned are only
+             * valid until it is unlocked. The cursor itself survives unlocking and reloads, so
+             * callers can lock the provider separately for each page.
+             * <p>The default implementation throws a MetadataException.
+             *
+             * @param cursor    position and filters of the enumeration
+             * @param page      receives the matching entities
+             * @return true iff entities may remain after the page
+             */
+            virtual bool getEntityPage(EntityCursor& cursor, std::vector<const EntityDescriptor*>& page) const;
+
+            /**
+             * Direct pointers to the well-known extensions of an entity, role or group.
+             */
+            struct SAML_API ExtensionIndex {
+                /**
+                 * Constructor.
+                 *
+                 * @param exts  extensions to locate the well-known ones in, if any
+                 */
+                ExtensionIndex(const Extensions* exts=nullptr);
+
+                virtual ~ExtensionIndex();
+
+                /** mdui:UIInfo extension. */
+                const UIInfo* uiInfo;
+                /** mdui:DiscoHints extension. */
+                const DiscoHints* discoHints;
+                /** mdattr:EntityAttributes extension. */
+                const EntityAttributes* entityAttributes;
+                /** mdrpi:RegistrationInfo extension. */
+                const RegistrationInfo* registrationInfo;
+                /** First SAML 1.x SourceID extension with an ID. */
+                const SourceID* sourceID;
+                /** alg:DigestMethod extensions. */
+                std::vector<const DigestMethod*> digestMethods;
+                /** alg:SigningMethod extensions. */
+                std::vector<const SigningMethod*> signingMethods;
+            };
+
+            /**
+             * Returns the well-known extensions of an entity, role or group, if the
+             * provider located them when the metadata was indexed.
+             * <p>The provider <strong>MUST</strong> be locked. The default implementation returns nullptr.
+             *
+             * @param descriptor    an EntityDescriptor, RoleDescriptor or EntitiesDescriptor supplied by the provider
+             * @return the descriptor's extensions, or nullptr if they were not indexed
+             */
+            virtual const ExtensionIndex* getExtensionIndex(const xmltooling::XMLObject& descriptor) const;
+
         protected:
             /**
              * Applies any installed filters to a metadata instance.
@@ -269,6 +403,7 @@ namespace opensaml {
         private:
             const MetadataFilterContext* m_filterContext;
             boost::ptr_vector<MetadataFilter> m_filters;
+            unsigned int m_filterThreads;
         };
 
 #if defined (_MSC_VER)
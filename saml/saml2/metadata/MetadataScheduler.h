@@ -0,0 +1,167 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+/**
+ * @file saml/saml2/metadata/MetadataScheduler.h
+ *
+ * Process-wide scheduler for background metadata maintenance.
+ */
+
+#ifndef __saml2_metadatasched_h__
+#define __saml2_metadatasched_h__
+
+#include <saml/base.h>
+
+#include <ctime>
+#include <map>
+#include <set>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+
+namespace xmltooling {
+    class XMLTOOL_API CondWait;
+    class XMLTOOL_API Mutex;
+    class XMLTOOL_API Thread;
+};
+
+namespace opensaml {
+    namespace saml2md {
+
+#if defined (_MSC_VER)
+        #pragma warning( push )
+        #pragma warning( disable : 4251 )
+#endif
+
+        /**
+         * Process-wide scheduler for background metadata maintenance.
+         *
+         * <p>Rather than each provider starting its own reload or cleanup thread,
+         * providers can register tasks with a deadline. A small pool of worker threads
+         * services a timer heap of those deadlines, and tasks marked as throttled
+         * (typically reloads) are capped in how many may run at once.</p>
+         */
+        class SAML_API MetadataScheduler
+        {
+            MAKE_NONCOPYABLE(MetadataScheduler);
+        public:
+            /**
+             * A unit of scheduled work.
+             */
+            class SAML_API Task {
+                MAKE_NONCOPYABLE(Task);
+            protected:
+                Task();
+            public:
+                virtual ~Task();
+
+                /**
+                 * Returns an identifier for the task for logging purposes.
+                 *
+                 * @return an identifier, or null
+                 */
+                virtual const char* getId() const;
+
+                /**
+                 * Performs the task's work.
+                 *
+                 * @return number of seconds until the task should run again, or zero to retire it
+                 */
+                virtual time_t run()=0;
+            };
+
+            /**
+             * Constructor.
+             *
+             * @param workers       number of worker threads to service tasks
+             * @param maxThrottled  maximum number of throttled tasks allowed to run at once
+             */
+            MetadataScheduler(unsigned int workers=2, unsigned int maxThrottled=1);
+
+            ~MetadataScheduler();
+
+            /**
+             * Returns the shared scheduler instance, creating it if necessary.
+             *
+             * @return the process-wide scheduler
+             */
+            static MetadataScheduler& getScheduler();
+
+            /**
+             * Sets the size of the shared scheduler.
+             * <p>This only takes effect if called before any metadata provider first uses the scheduler.
+             *
+             * @param workers       number of worker threads servicing reload and cleanup tasks
+             * @param maxThrottled  maximum number of throttled tasks, such as reloads, allowed to run at once
+             */
+            static void configure(unsigned int workers, unsigned int maxThrottled);
+
+            /**
+             * Registers a task to run after a delay. The caller retains ownership of the task
+             * and <strong>MUST</strong> cancel it before freeing it. A task is never run by
+             * more than one worker at a time.
+             *
+             * @param task      the task to schedule
+             * @param delay     number of seconds to wait before running it
+             * @param throttled true iff the task counts against the concurrency cap
+             */
+            void schedule(Task* task, time_t delay, bool throttled=false);
+
+            /**
+             * Removes a task, waiting for it to finish if it is currently running.
+             * <p>This <strong>MUST NOT</strong> be called from within the task itself.
+             *
+             * @param task  the task to remove
+             */
+            void cancel(Task* task);
+
+            /**
+             * Stops the worker threads. Any remaining tasks are dropped without being run.
+             */
+            void shutdown();
+
+        private:
+            struct entry_t {
+                entry_t(Task* t, bool th) : task(t), throttled(th) {}
+                Task* task;
+                bool throttled;
+            };
+            typedef std::multimap<time_t,entry_t> timerheap_t;
+
+            static void* worker_fn(void*);
+            void work();
+            bool unschedule(Task* task);
+
+            bool m_shutdown;
+            unsigned int m_maxThrottled, m_runningThrottled;
+            timerheap_t m_tasks;
+            std::set<Task*> m_running, m_cancelled;
+            boost::scoped_ptr<xmltooling::Mutex> m_lock;
+            boost::scoped_ptr<xmltooling::CondWait> m_wakeup, m_finished;
+            std::vector<xmltooling::Thread*> m_workers;
+        };
+
+#if defined (_MSC_VER)
+        #pragma warning( pop )
+#endif
+
+    };
+};
+
+#endif /* __saml2_metadatasched_h__ */
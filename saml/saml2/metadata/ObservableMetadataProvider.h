@@ -30,7 +30,9 @@
 #include <saml/saml2/metadata/MetadataProvider.h>
 
 namespace xmltooling {
+    class XMLTOOL_API CondWait;
     class XMLTOOL_API Mutex;
+    class XMLTOOL_API Thread;
 };
 
 namespace opensaml {
@@ -50,6 +52,19 @@ namespace opensaml {
             /**
              * Constructor.
              * 
+             * If a DOM is supplied, the following XML content is supported:
+             * 
+             * <ul>
+             *  <li>asyncEvents boolean attribute, enabling delivery of events on a dedicated thread
+             *      once the subclass starts it
+             * </ul>
+             * 
+             * <p>With asynchronous delivery, events raised while a delivery is pending are coalesced
+             * into one, and entity-specific events are delivered as provider-wide events. Observers are
+             * called in order, one event at a time, with the provider read-locked rather than under the
+             * lock held by the code raising the event. Observers that declare themselves synchronous
+             * are still called immediately, with every event, under the lock held by the code raising it.
+             * 
              * @param e DOM to supply configuration for provider
              * @param deprecationSupport true iff deprecated features and settings should be supported
              */
@@ -65,6 +80,21 @@ namespace opensaml {
              */
             virtual void emitChangeEvent(const EntityDescriptor& entity) const;
 
+            /**
+             * Starts asynchronous event delivery, if it was configured.
+             * <p>Delivery locks the provider through its virtual interface, so only a fully
+             * constructed provider can start it, typically from init(). Until it is started,
+             * events are delivered synchronously.
+             */
+            void startChangeEvents();
+
+            /**
+             * Stops asynchronous event delivery, dropping any pending event.
+             * <p>A provider that starts delivery stops it again in its own destructor, while
+             * its locking still works.
+             */
+            void stopChangeEvents();
+
         public:
             virtual ~ObservableMetadataProvider();
             
@@ -94,6 +124,16 @@ namespace opensaml {
                  * @param entity the entity that underwent modification
                  */
                 virtual void onEvent(const ObservableMetadataProvider& provider, const EntityDescriptor& entity) const;
+
+                /**
+                 * Returns true iff the observer must be notified as each change is made, even by a
+                 * provider that delivers events asynchronously, such as one keeping derived state
+                 * consistent with the provider's content.
+                 * <p>The default returns false.
+                 *
+                 * @return true iff events must be delivered synchronously
+                 */
+                virtual bool synchronous() const;
             };
             
             /**
@@ -114,6 +154,17 @@ namespace opensaml {
         private:
             boost::scoped_ptr<xmltooling::Mutex> m_observerLock;
             mutable std::vector<const Observer*> m_observers;
+
+            // Optional asynchronous delivery of coalesced events.
+            bool m_asyncEvents;
+            mutable bool m_eventPending;
+            bool m_dispatchShutdown;
+            boost::scoped_ptr<xmltooling::Mutex> m_dispatchLock;
+            boost::scoped_ptr<xmltooling::CondWait> m_dispatchWait;
+            boost::scoped_ptr<xmltooling::Thread> m_dispatchThread;
+            static void* dispatch_fn(void*);
+            void dispatch();
+            void queueChangeEvent() const;
         };
 
 #if defined (_MSC_VER)
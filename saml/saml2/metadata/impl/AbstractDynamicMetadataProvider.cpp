@@ -28,6 +28,7 @@
 #include <binding/SAMLArtifact.h>
 #include <saml2/metadata/Metadata.h>
 #include <saml2/metadata/AbstractDynamicMetadataProvider.h>
+#include <saml2/metadata/MetadataScheduler.h>
 
 #include <xercesc/framework/Wrapper4InputSource.hpp>
 
@@ -69,8 +70,25 @@ static const XMLCh negativeCache[] =        UNICODE_LITERAL_13(n,e,g,a,t,i,v,e,C
 static const XMLCh maxCacheDuration[] =     UNICODE_LITERAL_16(m,a,x,C,a,c,h,e,D,u,r,a,t,i,o,n);
 static const XMLCh minCacheDuration[] =     UNICODE_LITERAL_16(m,i,n,C,a,c,h,e,D,u,r,a,t,i,o,n);
 static const XMLCh refreshDelayFactor[] =   UNICODE_LITERAL_18(r,e,f,r,e,s,h,D,e,l,a,y,F,a,c,t,o,r);
+static const XMLCh sharedMaintenance[] =    UNICODE_LITERAL_17(s,h,a,r,e,d,M,a,i,n,t,e,n,a,n,c,e);
 static const XMLCh validate[] =             UNICODE_LITERAL_8(v,a,l,i,d,a,t,e);
 
+namespace opensaml {
+    namespace saml2md {
+        class SAML_DLLLOCAL AbstractDynamicMetadataProvider::CleanupTask : public MetadataScheduler::Task
+        {
+        public:
+            CleanupTask(AbstractDynamicMetadataProvider& provider) : m_provider(provider) {}
+            const char* getId() const { return m_provider.m_id.c_str(); }
+            time_t run() {
+                m_provider.cleanup();
+                return m_provider.m_cleanupInterval;
+            }
+        private:
+            AbstractDynamicMetadataProvider& m_provider;
+        };
+    };
+};
 
 AbstractDynamicMetadataProvider::AbstractDynamicMetadataProvider(bool defaultNegativeCache, const DOMElement* e, bool deprecationSupport) 
   : MetadataProvider(e, deprecationSupport), AbstractMetadataProvider(e, deprecationSupport),
@@ -114,13 +132,27 @@ AbstractDynamicMetadataProvider::AbstractDynamicMetadataProvider(bool defaultNeg
     if (m_cleanupInterval > 0) {
         if (m_cleanupTimeout < 0)
             m_cleanupTimeout = 0;
-        m_cleanup_wait.reset(CondWait::create());
-        m_cleanup_thread.reset(Thread::create(&cleanup_fn, this));
+        if (XMLHelper::getAttrBool(e, false, sharedMaintenance)) {
+            m_cleanupTask.reset(new CleanupTask(*this));
+            MetadataScheduler::getScheduler().schedule(m_cleanupTask.get(), m_cleanupInterval);
+            Category::getInstance(SAML_LOGCAT ".MetadataProvider.Dynamic").info(
+                "registered cache cleanup for shared background maintenance, running every %d seconds", m_cleanupInterval
+                );
+        }
+        else {
+            m_cleanup_wait.reset(CondWait::create());
+            m_cleanup_thread.reset(Thread::create(&cleanup_fn, this));
+        }
     }
 }
 
 AbstractDynamicMetadataProvider::~AbstractDynamicMetadataProvider()
 {
+    stopChangeEvents();
+
+    if (m_cleanupTask)
+        MetadataScheduler::getScheduler().cancel(m_cleanupTask.get());
+
     // Each entity in the map is unique (no multimap semantics), so this is safe.
     clearDescriptorIndex(true);
 
@@ -163,25 +195,7 @@ void* AbstractDynamicMetadataProvider::cleanup_fn(void* pv)
         if (provider->m_shutdown)
             break;
 
-        log.info("cleaning dynamic metadata cache...");
-
-        // Get a write lock.
-        provider->m_lock->wrlock();
-        SharedLock locker(provider->m_lock, false);
-
-        time_t now = time(nullptr);
-        // Dual iterator loop so we can remove entries while walking the map.
-        for (cachemap_t::iterator i = provider->m_cacheMap.begin(), i2 = i; i != provider->m_cacheMap.end(); i = i2) {
-            ++i2;
-            if (now > i->second.first + provider->m_cleanupTimeout) {
-                if (log.isDebugEnabled()) {
-                    auto_ptr_char id(i->first.c_str());
-                    log.debug("removing cache entry for (%s)", id.get());
-                }
-                provider->unindex(i->first.c_str(), true);
-                provider->m_cacheMap.erase(i);
-            }
-        }
+        provider->cleanup();
     }
 
     log.info("cleanup thread finished");
@@ -195,6 +209,36 @@ void* AbstractDynamicMetadataProvider::cleanup_fn(void* pv)
     return nullptr;
 }
 
+void AbstractDynamicMetadataProvider::cleanup()
+{
+    Category& log = Category::getInstance(SAML_LOGCAT ".MetadataProvider.Dynamic");
+    log.info("cleaning dynamic metadata cache...");
+
+    // Get a write lock.
+    m_lock->wrlock();
+    SharedLock locker(m_lock, false);
+
+    time_t now = time(nullptr);
+    // Dual iterator loop so we can remove entries while walking the map.
+    for (cachemap_t::iterator i = m_cacheMap.begin(), i2 = i; i != m_cacheMap.end(); i = i2) {
+        ++i2;
+        if (now > i->second.first + m_cleanupTimeout) {
+            if (log.isDebugEnabled()) {
+                auto_ptr_char id(i->first.c_str());
+                log.debug("removing cache entry for (%s)", id.get());
+            }
+            unindex(i->first.c_str(), true);
+            m_cacheMap.erase(i);
+        }
+    }
+}
+
+bool AbstractDynamicMetadataProvider::getIndexKeys(set<string>& entityIDs, set<string>& sources) const
+{
+    // The index only covers whatever happens to be cached.
+    return false;
+}
+
 const XMLObject* AbstractDynamicMetadataProvider::getMetadata() const
 {
     throw MetadataException("getMetadata operation not implemented on this provider.");
@@ -30,7 +30,9 @@
 #include "saml2/metadata/AbstractMetadataProvider.h"
 #include "saml2/metadata/MetadataCredentialContext.h"
 #include "saml2/metadata/MetadataCredentialCriteria.h"
+#include "saml2/metadata/MetadataScheduler.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/iterator/indirect_iterator.hpp>
 #include <boost/lambda/bind.hpp>
 #include <boost/lambda/if.hpp>
@@ -38,13 +40,17 @@
 #include <xercesc/util/XMLUniDefs.hpp>
 #include <xmltooling/logging.h>
 #include <xmltooling/XMLToolingConfig.h>
+#include <xmltooling/security/BasicX509Credential.h>
 #include <xmltooling/security/Credential.h>
 #include <xmltooling/security/KeyInfoResolver.h>
 #include <xmltooling/security/SecurityHelper.h>
+#include <xmltooling/security/XSECCryptoX509CRL.h>
+#include <xmltooling/signature/KeyInfo.h>
 #include <xmltooling/util/Threads.h>
 #include <xmltooling/util/XMLHelper.h>
 
 using namespace opensaml::saml2md;
+using namespace xmlsignature;
 using namespace xmltooling::logging;
 using namespace xmltooling;
 using namespace boost::lambda;
@@ -54,11 +60,151 @@ using opensaml::SAMLArtifact;
 
 static const XMLCh _KeyInfoResolver[] = UNICODE_LITERAL_15(K,e,y,I,n,f,o,R,e,s,o,l,v,e,r);
 static const XMLCh _type[] =            UNICODE_LITERAL_4(t,y,p,e);
+static const XMLCh _indexEndpoints[] =  UNICODE_LITERAL_14(i,n,d,e,x,E,n,d,p,o,i,n,t,s);
+static const XMLCh _indexKeys[] =       UNICODE_LITERAL_9(i,n,d,e,x,K,e,y,s);
+static const XMLCh _preloadCredentials[] = UNICODE_LITERAL_18(p,r,e,l,o,a,d,C,r,e,d,e,n,t,i,a,l,s);
+
+namespace opensaml {
+    namespace saml2md {
+        class SAML_DLLLOCAL AbstractMetadataProvider::PreloadTask : public MetadataScheduler::Task
+        {
+        public:
+            PreloadTask(const AbstractMetadataProvider& provider) : m_provider(provider) {}
+            const char* getId() const { return m_provider.getId(); }
+            time_t run() {
+                m_provider.preloadCredentials();
+                return 0;
+            }
+        private:
+            const AbstractMetadataProvider& m_provider;
+        };
+    };
+};
+
+namespace {
+    // Canonicalizes an endpoint URL for the location index: the scheme and authority
+    // are case-folded, a default or empty port is dropped, and any fragment is removed.
+    string normalizeLocation(const char* location)
+    {
+        string s(location);
+        string::size_type fragment = s.find('#');
+        if (fragment != string::npos)
+            s.erase(fragment);
+
+        string::size_type scheme = s.find("://");
+        if (scheme == string::npos)
+            return s;
+        string::size_type path = s.find_first_of("/?", scheme + 3);
+        if (path == string::npos)
+            path = s.length();
+        for (string::size_type i = 0; i < path; ++i)
+            s[i] = tolower(s[i]);
+
+        string::size_type colon = s.rfind(':', path - 1);
+        if (colon != string::npos && colon > scheme + 2) {
+            // Skip colons inside an IPv6 literal.
+            string::size_type bracket = s.find(']', scheme + 3);
+            if (bracket == string::npos || bracket < colon) {
+                string port(s, colon + 1, path - colon - 1);
+                if (port.empty() || (port == "443" && s.compare(0, scheme, "https") == 0) || (port == "80" && s.compare(0, scheme, "http") == 0))
+                    s.erase(colon, path - colon);
+            }
+        }
+        return s;
+    }
+
+    // Mirrors the role selection done by EntityDescriptor::getRoleDescriptor for a specific role.
+    bool matchesRole(const RoleDescriptor& role, const MetadataProvider::Criteria& criteria)
+    {
+        if (!criteria.role)
+            return true;
+        if (!(role.getElementQName() == *criteria.role) && !(role.getSchemaType() && *role.getSchemaType() == *criteria.role))
+            return false;
+        return isValidForProtocol(criteria.protocol)(&role) || (criteria.protocol2 && isValidForProtocol(criteria.protocol2)(&role));
+    }
+
+    // A per-role view of a credential resolved once and shared by every role with identical KeyInfo.
+    // The certificates belong to the shared credential; only the key handle and context are per-role.
+    class SAML_DLLLOCAL SharedCredential : public BasicX509Credential
+    {
+    public:
+        SharedCredential(const boost::shared_ptr<Credential>& source, MetadataCredentialContext* context)
+                : BasicX509Credential(false), m_source(source), m_context(context) {
+            if (source->getPublicKey())
+                m_key = source->getPublicKey()->clone();
+            m_keyNames = source->getKeyNames();
+            const X509Credential* x509 = dynamic_cast<const X509Credential*>(source.get());
+            if (x509) {
+                m_xseccerts = x509->getEntityCertificateChain();
+                const vector<XSECCryptoX509CRL*>& crls = x509->getCRLs();
+                for (vector<XSECCryptoX509CRL*>::const_iterator crl = crls.begin(); crl != crls.end(); ++crl)
+                    m_crls.push_back((*crl)->clone());
+                if (x509->getSubjectName())
+                    m_subjectName = x509->getSubjectName();
+                if (x509->getIssuerName())
+                    m_issuerName = x509->getIssuerName();
+                if (x509->getSerialNumber())
+                    m_serial = x509->getSerialNumber();
+            }
+        }
+
+        virtual ~SharedCredential() {}
+
+        unsigned int getUsage() const {
+            return m_source->getUsage();
+        }
+
+        XSECCryptoKey* getPrivateKey() const {
+            return nullptr;
+        }
+
+        KeyInfo* getKeyInfo(bool compact=false) const {
+            return m_source->getKeyInfo(compact);
+        }
+
+        const CredentialContext* getCredentialContext() const {
+            return m_context.get();
+        }
+
+    private:
+        boost::shared_ptr<Credential> m_source;
+        scoped_ptr<MetadataCredentialContext> m_context;
+    };
+
+    // Mirrors the usage check done by MetadataCredentialCriteria.
+    bool matchesUsage(const KeyDescriptor& key, unsigned int usage)
+    {
+        if ((usage & (Credential::SIGNING_CREDENTIAL | Credential::TLS_CREDENTIAL)) &&
+                XMLString::equals(key.getUse(), KeyDescriptor::KEYTYPE_ENCRYPTION))
+            return false;
+        else if ((usage & Credential::ENCRYPTION_CREDENTIAL) && XMLString::equals(key.getUse(), KeyDescriptor::KEYTYPE_SIGNING))
+            return false;
+        return true;
+    }
+};
 
 AbstractMetadataProvider::AbstractMetadataProvider(const DOMElement* e, bool deprecationSupport)
   : MetadataProvider(e, deprecationSupport), ObservableMetadataProvider(e),
-    m_lastUpdate(0), m_resolver(nullptr), m_credentialLock(Mutex::create())
+    m_lastUpdate(0), m_resolver(nullptr), m_indexEndpoints(XMLHelper::getAttrBool(e, false, _indexEndpoints)),
+    m_indexKeys(XMLHelper::getAttrBool(e, false, _indexKeys)),
+    m_credentialLock(Mutex::create()), m_preloadAll(false), m_preloadActive(false), m_preloadCancel(false)
 {
+    string preload(XMLHelper::getAttrString(e, nullptr, _preloadCredentials));
+    trim(preload);
+    if (preload == "true" || preload == "1") {
+        m_preloadAll = true;
+    }
+    else if (!preload.empty() && preload != "false" && preload != "0") {
+        vector<string> types;
+        split(types, preload, is_space(), algorithm::token_compress_on);
+        for (vector<string>::const_iterator t = types.begin(); t != types.end(); ++t) {
+            auto_ptr_XMLCh type(t->c_str());
+            m_preloadTypes.insert(type.get());
+        }
+    }
+    if (m_preloadAll || !m_preloadTypes.empty())
+        m_preloadTask.reset(new PreloadTask(*this));
+
     e = XMLHelper::getFirstChildElement(e, _KeyInfoResolver);
     if (e) {
         string t = XMLHelper::getAttrString(e, nullptr, _type);
@@ -74,8 +220,11 @@ AbstractMetadataProvider::AbstractMetadataProvider(const DOMElement* e, bool dep
 
 AbstractMetadataProvider::~AbstractMetadataProvider()
 {
-    for (credmap_t::iterator c = m_credentialMap.begin(); c!=m_credentialMap.end(); ++c)
-        for_each(c->second.begin(), c->second.end(), xmltooling::cleanup<Credential>());
+    if (m_preloadTask) {
+        cancelPreload();
+        m_preloadTask.reset();
+    }
+    clearCredentials();
 }
 
 void AbstractMetadataProvider::outputStatus(ostream& os) const
@@ -93,22 +242,29 @@ void AbstractMetadataProvider::outputStatus(ostream& os) const
         os << " lastUpdate='" << timestamp.get() << "'";
     }
 
+    outputPreloadStatus(os);
+
     os << "/>";
 }
 
+void AbstractMetadataProvider::outputPreloadStatus(ostream& os) const
+{
+    if (m_preloadTask) {
+        Lock lock(m_credentialLock);
+        os << " preloadedRoles='" << m_preloaded.size() << "' preloadPending='" << m_preloadRoles.size() << "'";
+    }
+}
+
 void AbstractMetadataProvider::emitChangeEvent() const
 {
-    for (credmap_t::iterator c = m_credentialMap.begin(); c!=m_credentialMap.end(); ++c)
-        for_each(c->second.begin(), c->second.end(), xmltooling::cleanup<Credential>());
-    m_credentialMap.clear();
+    clearCredentials();
     ObservableMetadataProvider::emitChangeEvent();
 }
 
 void AbstractMetadataProvider::emitChangeEvent(const EntityDescriptor& entity) const
 {
-    for (credmap_t::iterator c = m_credentialMap.begin(); c!=m_credentialMap.end(); ++c)
-        for_each(c->second.begin(), c->second.end(), xmltooling::cleanup<Credential>());
-    m_credentialMap.clear();
+    // A changed entity is always re-indexed, and unindexing its old copies already dropped their
+    // credentials, so clearing here would only throw away what has been preloaded for the new one.
     ObservableMetadataProvider::emitChangeEvent(entity);
 }
 
@@ -128,26 +284,25 @@ void AbstractMetadataProvider::indexEntity(EntityDescriptor* site, time_t& valid
         }
         m_sites.insert(sitemap_t::value_type(id.get(), site));
     }
-    
+    indexExtensions(*site);
+    if (m_indexEndpoints)
+        indexEndpoints(*site);
+    if (m_indexKeys)
+        indexKeys(*site);
+    if (m_preloadTask)
+        queuePreload(*site);
+
     // Process each IdP role.
     const vector<IDPSSODescriptor*>& roles = const_cast<const EntityDescriptor*>(site)->getIDPSSODescriptors();
     for (vector<IDPSSODescriptor*>::const_iterator i = roles.begin(); i != roles.end(); i++) {
         // SAML 1.x?
         if ((*i)->hasSupport(samlconstants::SAML10_PROTOCOL_ENUM) || (*i)->hasSupport(samlconstants::SAML11_PROTOCOL_ENUM)) {
             // Check for SourceID extension element.
-            const Extensions* exts = (*i)->getExtensions();
-            if (exts && exts->hasChildren()) {
-                const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
-                for (vector<XMLObject*>::const_iterator ext = children.begin(); ext != children.end(); ++ext) {
-                    SourceID* sid = dynamic_cast<SourceID*>(*ext);
-                    if (sid) {
-                        auto_ptr_char sourceid(sid->getID());
-                        if (sourceid.get()) {
-                            m_sources.insert(sitemap_t::value_type(sourceid.get(),site));
-                            break;
-                        }
-                    }
-                }
+            const ExtensionIndex* exts = getExtensionIndex(**i);
+            if (exts && exts->sourceID) {
+                auto_ptr_char sourceid(exts->sourceID->getID());
+                if (sourceid.get())
+                    m_sources.insert(sitemap_t::value_type(sourceid.get(),site));
             }
             
             // Hash the ID.
@@ -182,6 +337,8 @@ void AbstractMetadataProvider::indexGroup(EntitiesDescriptor* group, time_t& val
     if (name.get()) {
         m_groups.insert(groupmap_t::value_type(name.get(),group));
     }
+    if (group->getExtensions())
+        m_extensions[group] = ExtensionIndex(group->getExtensions());
     
     // Track the smallest validUntil amongst the children.
     time_t minValidUntil = validUntil;
@@ -226,6 +383,11 @@ void AbstractMetadataProvider::unindex(const XMLCh* entityID, bool freeSites) co
         lambda::bind(ins, boost::ref(existingSites), lambda::bind(&sitemap_t::value_type::second, _1))
     );
     m_sites.erase(existingRange.first, existingRange.second);
+    if (m_preloadTask)
+        cancelPreload(&existingSites);
+    clearCredentials(&existingSites, false);
+    for (set<const EntityDescriptor*>::const_iterator e = existingSites.begin(); e != existingSites.end(); ++e)
+        unindexExtensions(**e);
     for (sitemap_t::iterator s = m_sources.begin(); s != m_sources.end();) {
         if (existingSites.count(s->second) > 0) {
             sitemap_t::iterator temp = s;
@@ -236,18 +398,146 @@ void AbstractMetadataProvider::unindex(const XMLCh* entityID, bool freeSites) co
             ++s;
         }
     }
+    for (locmap_t::iterator l = m_locations.begin(); l != m_locations.end();) {
+        if (existingSites.count(l->second.first) > 0)
+            m_locations.erase(l++);
+        else
+            ++l;
+    }
+    for (keymap_t::iterator k = m_keys.begin(); k != m_keys.end();) {
+        if (existingSites.count(k->second.first) > 0)
+            m_keys.erase(k++);
+        else
+            ++k;
+    }
 
     if (freeSites)
         for_each(existingSites.begin(), existingSites.end(), cleanup<EntityDescriptor>());
 }
 
+bool AbstractMetadataProvider::getIndexKeys(set<string>& entityIDs, set<string>& sources) const
+{
+    for (sitemap_t::const_iterator i = m_sites.begin(); i != m_sites.end(); i = m_sites.upper_bound(i->first))
+        entityIDs.insert(i->first);
+    for (sitemap_t::const_iterator i = m_sources.begin(); i != m_sources.end(); i = m_sources.upper_bound(i->first))
+        sources.insert(i->first);
+    return true;
+}
+
 void AbstractMetadataProvider::clearDescriptorIndex(bool freeSites)
 {
+    if (m_preloadTask)
+        cancelPreload();
+    clearCredentials(nullptr, false);
     if (freeSites)
         for_each(m_sites.begin(), m_sites.end(), cleanup_const_pair<string,EntityDescriptor>());
     m_sites.clear();
     m_groups.clear();
     m_sources.clear();
+    m_extensions.clear();
+    m_locations.clear();
+    m_keys.clear();
+}
+
+void AbstractMetadataProvider::indexExtensions(const EntityDescriptor& site) const
+{
+    if (site.getExtensions())
+        m_extensions[&site] = ExtensionIndex(site.getExtensions());
+    const list<XMLObject*>& children = site.getOrderedChildren();
+    for (list<XMLObject*>::const_iterator child = children.begin(); child != children.end(); ++child) {
+        const RoleDescriptor* role = dynamic_cast<const RoleDescriptor*>(*child);
+        if (role && role->getExtensions())
+            m_extensions[role] = ExtensionIndex(role->getExtensions());
+    }
+}
+
+void AbstractMetadataProvider::unindexExtensions(const EntityDescriptor& site) const
+{
+    m_extensions.erase(&site);
+    const list<XMLObject*>& children = site.getOrderedChildren();
+    for (list<XMLObject*>::const_iterator child = children.begin(); child != children.end(); ++child)
+        m_extensions.erase(*child);
+}
+
+void AbstractMetadataProvider::indexEndpoints(const EntityDescriptor& site) const
+{
+    const list<XMLObject*>& children = site.getOrderedChildren();
+    for (list<XMLObject*>::const_iterator child = children.begin(); child != children.end(); ++child) {
+        const RoleDescriptor* role = dynamic_cast<const RoleDescriptor*>(*child);
+        if (!role)
+            continue;
+        const list<XMLObject*>& endpoints = role->getOrderedChildren();
+        for (list<XMLObject*>::const_iterator ep = endpoints.begin(); ep != endpoints.end(); ++ep) {
+            const EndpointType* endpoint = dynamic_cast<const EndpointType*>(*ep);
+            if (!endpoint)
+                continue;
+            auto_ptr_char location(endpoint->getLocation());
+            if (location.get() && *location.get())
+                m_locations.insert(locmap_t::value_type(normalizeLocation(location.get()), make_pair(&site, role)));
+            auto_ptr_char responseLocation(endpoint->getResponseLocation());
+            if (responseLocation.get() && *responseLocation.get())
+                m_locations.insert(locmap_t::value_type(normalizeLocation(responseLocation.get()), make_pair(&site, role)));
+        }
+    }
+}
+
+void AbstractMetadataProvider::indexKeys(const EntityDescriptor& site) const
+{
+    const KeyInfoResolver* resolver = m_resolver ? m_resolver : XMLToolingConfig::getConfig().getKeyInfoResolver();
+    const list<XMLObject*>& children = site.getOrderedChildren();
+    for (list<XMLObject*>::const_iterator child = children.begin(); child != children.end(); ++child) {
+        const RoleDescriptor* role = dynamic_cast<const RoleDescriptor*>(*child);
+        if (!role)
+            continue;
+        const vector<KeyDescriptor*>& keys = role->getKeyDescriptors();
+        for (vector<KeyDescriptor*>::const_iterator k = keys.begin(); k != keys.end(); ++k) {
+            if (!(*k)->getKeyInfo())
+                continue;
+            try {
+                scoped_ptr<Credential> cred(resolver->resolve((*k)->getKeyInfo()));
+                if (cred) {
+                    string fingerprint(SecurityHelper::getDEREncoding(*cred, "SHA256"));
+                    if (!fingerprint.empty())
+                        m_keys.insert(keymap_t::value_type(fingerprint, make_pair(&site, *k)));
+                }
+            }
+            catch (const std::exception& ex) {
+                auto_ptr_char id(site.getEntityID());
+                Category::getInstance(SAML_LOGCAT ".MetadataProvider").warn(
+                    "unable to index key for entity (%s): %s", id.get() ? id.get() : "unnamed", ex.what()
+                    );
+            }
+        }
+    }
+}
+
+const MetadataProvider::ExtensionIndex* AbstractMetadataProvider::getExtensionIndex(const XMLObject& descriptor) const
+{
+    extmap_t::const_iterator i = m_extensions.find(&descriptor);
+    return i != m_extensions.end() ? &(i->second) : nullptr;
+}
+
+bool AbstractMetadataProvider::getEntityPage(EntityCursor& cursor, vector<const EntityDescriptor*>& page) const
+{
+    sitemap_t::const_iterator i = cursor.position.empty() ? m_sites.begin() : m_sites.upper_bound(cursor.position);
+    vector<const EntityDescriptor*>::size_type count = 0;
+    unsigned int scanned = 0;
+    while (i != m_sites.end()) {
+        if ((cursor.pageSize && count >= cursor.pageSize) || (cursor.scanLimit && scanned >= cursor.scanLimit))
+            return true;
+        ++scanned;
+        // Take every copy of the entityID at once so a page never splits them.
+        const string& key = i->first;
+        sitemap_t::const_iterator last = m_sites.upper_bound(key);
+        for (; i != last; ++i) {
+            if (cursor.matches(*i->second)) {
+                page.push_back(i->second);
+                ++count;
+            }
+        }
+        cursor.position = key;
+    }
+    return false;
 }
 
 const EntitiesDescriptor* AbstractMetadataProvider::getEntitiesDescriptor(const char* name, bool strict) const
@@ -284,6 +574,10 @@ pair<const EntityDescriptor*,const RoleDescriptor*> AbstractMetadataProvider::ge
     }
     else if (criteria.artifact)
         range = const_cast<const sitemap_t&>(m_sources).equal_range(criteria.artifact->getSource());
+    else if (criteria.location)
+        return getEntityDescriptorByLocation(criteria);
+    else if (criteria.keyFingerprint)
+        return getEntityDescriptorByKey(criteria);
     else
         return pair<const EntityDescriptor*,const RoleDescriptor*>(nullptr,nullptr);
     
@@ -319,6 +613,77 @@ pair<const EntityDescriptor*,const RoleDescriptor*> AbstractMetadataProvider::ge
     return result;
 }
 
+pair<const EntityDescriptor*,const RoleDescriptor*> AbstractMetadataProvider::getEntityDescriptorByLocation(const Criteria& criteria) const
+{
+    // The role returned is always the one containing the endpoint, whether or not a role was requested.
+    pair<const EntityDescriptor*,const RoleDescriptor*> result(nullptr,nullptr);
+    pair<const EntityDescriptor*,const RoleDescriptor*> expired(nullptr,nullptr);
+
+    string location(normalizeLocation(criteria.location));
+    pair<locmap_t::const_iterator,locmap_t::const_iterator> range = const_cast<const locmap_t&>(m_locations).equal_range(location);
+
+    time_t now=time(nullptr);
+    for (locmap_t::const_iterator i=range.first; i!=range.second; ++i) {
+        if (!matchesRole(*i->second.second, criteria))
+            continue;
+        if (now < i->second.first->getValidUntilEpoch()) {
+            result = i->second;
+            break;
+        }
+        if (!expired.first)
+            expired = i->second;
+    }
+
+    if (!result.first && expired.first) {
+        Category& log = Category::getInstance(SAML_LOGCAT ".MetadataProvider");
+        if (criteria.validOnly) {
+            log.warn("ignored expired metadata instance for endpoint (%s)", location.c_str());
+        }
+        else {
+            log.info("no valid metadata found, returning expired instance for endpoint (%s)", location.c_str());
+            result = expired;
+        }
+    }
+
+    return result;
+}
+
+pair<const EntityDescriptor*,const RoleDescriptor*> AbstractMetadataProvider::getEntityDescriptorByKey(const Criteria& criteria) const
+{
+    // The role returned is always the one containing the key, whether or not a role was requested.
+    pair<const EntityDescriptor*,const RoleDescriptor*> result(nullptr,nullptr);
+    pair<const EntityDescriptor*,const RoleDescriptor*> expired(nullptr,nullptr);
+
+    pair<keymap_t::const_iterator,keymap_t::const_iterator> range =
+        const_cast<const keymap_t&>(m_keys).equal_range(criteria.keyFingerprint);
+
+    time_t now=time(nullptr);
+    for (keymap_t::const_iterator i=range.first; i!=range.second; ++i) {
+        const RoleDescriptor* role = dynamic_cast<const RoleDescriptor*>(i->second.second->getParent());
+        if (!role || !matchesRole(*role, criteria) || !matchesUsage(*i->second.second, criteria.keyUsage))
+            continue;
+        if (now < i->second.first->getValidUntilEpoch()) {
+            result = make_pair(i->second.first, role);
+            break;
+        }
+        if (!expired.first)
+            expired = make_pair(i->second.first, role);
+    }
+
+    if (!result.first && expired.first) {
+        Category& log = Category::getInstance(SAML_LOGCAT ".MetadataProvider");
+        if (criteria.validOnly) {
+            log.warn("ignored expired metadata instance for key (%s)", criteria.keyFingerprint);
+        }
+        else {
+            log.info("no valid metadata found, returning expired instance for key (%s)", criteria.keyFingerprint);
+            result = expired;
+        }
+    }
+
+    return result;
+}
+
 const Credential* AbstractMetadataProvider::resolve(const CredentialCriteria* criteria) const
 {
     const MetadataCredentialCriteria* metacrit = dynamic_cast<const MetadataCredentialCriteria*>(criteria);
@@ -357,13 +722,24 @@ const AbstractMetadataProvider::credmap_t::mapped_type& AbstractMetadataProvider
     if (i != m_credentialMap.end())
         return i->second;
 
+    AbstractMetadataProvider::credmap_t::mapped_type& resolved = m_credentialMap[&role];
+    resolveCredentials(role, m_credentialPool, resolved);
+    return resolved;
+}
+
+void AbstractMetadataProvider::resolveCredentials(const RoleDescriptor& role, credpool_t& pool, credmap_t::mapped_type& resolved) const
+{
     const KeyInfoResolver* resolver = m_resolver ? m_resolver : XMLToolingConfig::getConfig().getKeyInfoResolver();
     const vector<KeyDescriptor*>& keys = role.getKeyDescriptors();
-    AbstractMetadataProvider::credmap_t::mapped_type& resolved = m_credentialMap[&role];
     for (indirect_iterator<vector<KeyDescriptor*>::const_iterator> k = make_indirect_iterator(keys.begin());
             k != make_indirect_iterator(keys.end()); ++k) {
         if (k->getKeyInfo()) {
             auto_ptr<MetadataCredentialContext> mcc(new MetadataCredentialContext(*k));
+            boost::shared_ptr<Credential> pooled(resolvePooledCredential(*k, pool));
+            if (pooled) {
+                resolved.push_back(new SharedCredential(pooled, mcc.release()));
+                continue;
+            }
             auto_ptr<Credential> c(resolver->resolve(mcc.get()));
             if (c.get()) {
                 mcc.release();  // this API sucks, the object is now owned by the Credential
@@ -372,5 +748,205 @@ const AbstractMetadataProvider::credmap_t::mapped_type& AbstractMetadataProvider
             }
         }
     }
-    return resolved;
+}
+
+boost::shared_ptr<Credential> AbstractMetadataProvider::resolvePooledCredential(const KeyDescriptor& key, credpool_t& pool) const
+{
+    // Identical KeyInfo content is recognized by a digest of its key names, certificates and CRLs,
+    // which outlives the DOM and is far cheaper to produce than parsing the certificates. Anything
+    // else in the KeyInfo could change what resolves, so it isn't pooled.
+    string buf;
+    const list<XMLObject*>& children = key.getKeyInfo()->getOrderedChildren();
+    for (list<XMLObject*>::const_iterator child = children.begin(); child != children.end(); ++child) {
+        const KeyName* name = dynamic_cast<const KeyName*>(*child);
+        if (name) {
+            auto_ptr_char value(name->getName());
+            buf.append("N:").append(value.get() ? value.get() : "").append(1, '\n');
+            continue;
+        }
+        const X509Data* data = dynamic_cast<const X509Data*>(*child);
+        if (!data)
+            return boost::shared_ptr<Credential>();
+        const list<XMLObject*>& items = data->getOrderedChildren();
+        for (list<XMLObject*>::const_iterator item = items.begin(); item != items.end(); ++item) {
+            const X509Certificate* cert = dynamic_cast<const X509Certificate*>(*item);
+            const X509CRL* crl = cert ? nullptr : dynamic_cast<const X509CRL*>(*item);
+            if (!cert && !crl)
+                return boost::shared_ptr<Credential>();
+            auto_ptr_char value(cert ? cert->getValue() : crl->getValue());
+            buf.append(cert ? "C:" : "R:").append(value.get() ? value.get() : "").append(1, '\n');
+        }
+        buf.append("X:\n");
+    }
+    if (buf.empty())
+        return boost::shared_ptr<Credential>();
+    string digest(SecurityHelper::doHash("SHA256", buf.data(), buf.length()));
+
+    credpool_t::const_iterator i = pool.find(digest);
+    if (i != pool.end())
+        return i->second;
+
+    const KeyInfoResolver* resolver = m_resolver ? m_resolver : XMLToolingConfig::getConfig().getKeyInfoResolver();
+    boost::shared_ptr<Credential> cred(resolver->resolve(key.getKeyInfo()));
+    if (cred)
+        pool[digest] = cred;
+    return cred;
+}
+
+void AbstractMetadataProvider::clearCredentials(const set<const EntityDescriptor*>* sites, bool requeue) const
+{
+    Lock lock(m_credentialLock);
+    vector<const RoleDescriptor*> requeued;
+    if (sites) {
+        if (sites->empty())
+            return;
+        for (credmap_t::iterator c = m_credentialMap.begin(); c != m_credentialMap.end();) {
+            if (sites->count(dynamic_cast<const EntityDescriptor*>(c->first->getParent())) > 0) {
+                if (m_preloaded.erase(c->first) > 0)
+                    requeued.push_back(c->first);
+                for_each(c->second.begin(), c->second.end(), xmltooling::cleanup<Credential>());
+                m_credentialMap.erase(c++);
+            }
+            else {
+                ++c;
+            }
+        }
+
+        // The pool is keyed by content, so only entries no role uses any longer need to go.
+        for (credpool_t::iterator p = m_credentialPool.begin(); p != m_credentialPool.end();) {
+            if (p->second.unique())
+                m_credentialPool.erase(p++);
+            else
+                ++p;
+        }
+    }
+    else {
+        for (credmap_t::iterator c = m_credentialMap.begin(); c!=m_credentialMap.end(); ++c)
+            for_each(c->second.begin(), c->second.end(), xmltooling::cleanup<Credential>());
+        m_credentialMap.clear();
+        m_credentialPool.clear();
+        requeued.assign(m_preloaded.begin(), m_preloaded.end());
+        m_preloaded.clear();
+    }
+
+    // Anything preloaded is still indexed, so resolve it again in the background.
+    if (requeue && m_preloadTask && !requeued.empty()) {
+        m_preloadRoles.insert(m_preloadRoles.end(), requeued.begin(), requeued.end());
+        if (!m_preloadActive) {
+            m_preloadActive = true;
+            MetadataScheduler::getScheduler().schedule(m_preloadTask.get(), 0);
+        }
+    }
+}
+
+void AbstractMetadataProvider::queuePreload(const EntityDescriptor& site) const
+{
+    Lock lock(m_credentialLock);
+    const list<XMLObject*>& children = site.getOrderedChildren();
+    for (list<XMLObject*>::const_iterator child = children.begin(); child != children.end(); ++child) {
+        const RoleDescriptor* role = dynamic_cast<const RoleDescriptor*>(*child);
+        if (role && !role->getKeyDescriptors().empty() &&
+                (m_preloadAll || m_preloadTypes.count(role->getElementQName().getLocalPart()) > 0))
+            m_preloadRoles.push_back(role);
+    }
+    if (!m_preloadActive && !m_preloadRoles.empty()) {
+        m_preloadActive = true;
+        MetadataScheduler::getScheduler().schedule(m_preloadTask.get(), 0);
+    }
+}
+
+void AbstractMetadataProvider::cancelPreload(const set<const EntityDescriptor*>* sites) const
+{
+    // A run in progress stops at the next role, and the scheduler waits for it, so no
+    // queued role is being read once this returns.
+    {
+        Lock lock(m_credentialLock);
+        m_preloadCancel = true;
+    }
+    MetadataScheduler::getScheduler().cancel(m_preloadTask.get());
+
+    Lock lock(m_credentialLock);
+    m_preloadCancel = false;
+    m_preloadActive = false;
+    if (sites) {
+        vector<const RoleDescriptor*> kept;
+        for (vector<const RoleDescriptor*>::const_iterator r = m_preloadRoles.begin(); r != m_preloadRoles.end(); ++r) {
+            if (sites->count(dynamic_cast<const EntityDescriptor*>((*r)->getParent())) == 0)
+                kept.push_back(*r);
+        }
+        m_preloadRoles.swap(kept);
+        for (set<const RoleDescriptor*>::iterator r = m_preloaded.begin(); r != m_preloaded.end();) {
+            if (sites->count(dynamic_cast<const EntityDescriptor*>((*r)->getParent())) > 0)
+                m_preloaded.erase(r++);
+            else
+                ++r;
+        }
+    }
+    else {
+        m_preloadRoles.clear();
+        m_preloaded.clear();
+    }
+
+    if (!m_preloadRoles.empty()) {
+        m_preloadActive = true;
+        MetadataScheduler::getScheduler().schedule(m_preloadTask.get(), 0);
+    }
+}
+
+void AbstractMetadataProvider::preloadCredentials() const
+{
+    Category& log = Category::getInstance(SAML_LOGCAT ".MetadataProvider");
+    while (true) {
+        vector<const RoleDescriptor*> roles;
+        {
+            Lock lock(m_credentialLock);
+            if (m_preloadRoles.empty()) {
+                m_preloadActive = false;
+                return;
+            }
+            roles.swap(m_preloadRoles);
+        }
+
+        // Certificates are parsed outside the lock, using a private pool that is merged on publication.
+        // The queued roles stay alive meanwhile, since unindexing cancels this task before freeing them.
+        log.debug("preloading credentials for %u role(s)", static_cast<unsigned int>(roles.size()));
+        credpool_t pool;
+        credmap_t resolved;
+        {
+            // Start from what earlier runs published, so roles queued apart still share credentials.
+            Lock lock(m_credentialLock);
+            pool = m_credentialPool;
+        }
+        bool cancelled = false;
+        for (vector<const RoleDescriptor*>::iterator r = roles.begin(); r != roles.end(); ++r) {
+            {
+                // Hand back whatever is left so the canceller decides what survives.
+                Lock lock(m_credentialLock);
+                if (m_preloadCancel) {
+                    m_preloadRoles.insert(m_preloadRoles.begin(), r, roles.end());
+                    cancelled = true;
+                    break;
+                }
+            }
+            try {
+                resolveCredentials(**r, pool, resolved[*r]);
+            }
+            catch (const std::exception& ex) {
+                log.warn("unable to preload role credentials: %s", ex.what());
+            }
+        }
+
+        // Publish everything at once, keeping anything a request thread resolved first.
+        Lock lock(m_credentialLock);
+        for (credmap_t::iterator c = resolved.begin(); c != resolved.end(); ++c) {
+            if (m_credentialMap.insert(*c).second)
+                m_preloaded.insert(c->first);
+            else
+                for_each(c->second.begin(), c->second.end(), xmltooling::cleanup<Credential>());
+        }
+        for (credpool_t::const_iterator p = pool.begin(); p != pool.end(); ++p)
+            m_credentialPool.insert(*p);
+        if (cancelled)
+            return;
+    }
 }
@@ -28,17 +28,31 @@
 #include "exceptions.h"
 #include "saml/binding/SAMLArtifact.h"
 #include "saml2/metadata/Metadata.h"
+#include "saml2/metadata/AbstractDynamicMetadataProvider.h"
+#include "saml2/metadata/AbstractMetadataProvider.h"
 #include "saml2/metadata/DiscoverableMetadataProvider.h"
 #include "saml2/metadata/ObservableMetadataProvider.h"
 #include "saml2/metadata/MetadataCredentialCriteria.h"
+#include "saml2/metadata/MetadataScheduler.h"
 
+#include <algorithm>
+#include <deque>
 #include <memory>
+#include <sstream>
 #include <functional>
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 #include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <xercesc/util/XMLUniDefs.hpp>
 #include <xmltooling/logging.h>
+#include <xmltooling/XMLToolingConfig.h>
+#include <xmltooling/security/SecurityHelper.h>
+#include <xmltooling/util/DirectoryWalker.h>
+#include <xmltooling/util/NDC.h>
+#include <xmltooling/util/ParserPool.h>
 #include <xmltooling/util/Threads.h>
 #include <xmltooling/util/XMLHelper.h>
 
@@ -56,6 +70,58 @@ namespace opensaml {
 
         // per-thread structure allocated to track locks and role->provider mappings
         struct SAML_DLLLOCAL tracker_t;
+
+        // fan-out of a single lookup across dynamic children, shared with the workers running it
+        struct SAML_DLLLOCAL lookup_job_t;
+        struct SAML_DLLLOCAL lookup_holder_t;
+
+        // immutable snapshot of the aggregated discovery feed
+        struct SAML_DLLLOCAL feed_cache_t {
+            feed_cache_t(unsigned long generation) : m_generation(generation) {}
+            unsigned long m_generation;
+            string m_feed, m_tag;
+            boost::scoped_ptr<DiscoverableMetadataProvider::FeedEncoding> m_encoding;
+        };
+
+        // Fixed-capacity inline storage that spills over to the heap. Clearing it retains
+        // any heap capacity, so a thread's tracker stops allocating once it has warmed up.
+        template <class T, unsigned int N> class SAML_DLLLOCAL inline_vector_t {
+        public:
+            inline_vector_t() : m_size(0) {}
+
+            size_t size() const {
+                return m_size + m_overflow.size();
+            }
+
+            const T& operator[](size_t i) const {
+                return (i < N) ? m_inline[i] : m_overflow[i - N];
+            }
+
+            bool contains(const T& t) const {
+                for (unsigned int i = 0; i < m_size; ++i) {
+                    if (m_inline[i] == t)
+                        return true;
+                }
+                return find(m_overflow.begin(), m_overflow.end(), t) != m_overflow.end();
+            }
+
+            void push_back(const T& t) {
+                if (m_size < N)
+                    m_inline[m_size++] = t;
+                else
+                    m_overflow.push_back(t);
+            }
+
+            void clear() {
+                m_size = 0;
+                m_overflow.clear();
+            }
+
+        private:
+            unsigned int m_size;
+            T m_inline[N];
+            vector<T> m_overflow;
+        };
         
         class SAML_DLLLOCAL ChainingMetadataProvider
             : public DiscoverableMetadataProvider, public ObservableMetadataProvider, public ObservableMetadataProvider::Observer {
@@ -74,48 +140,100 @@ namespace opensaml {
             const XMLObject* getMetadata() const;
             const EntitiesDescriptor* getEntitiesDescriptor(const char*, bool requireValidMetadata=true) const;
             pair<const EntityDescriptor*,const RoleDescriptor*> getEntityDescriptor(const Criteria&) const;
+            bool getEntityPage(EntityCursor& cursor, vector<const EntityDescriptor*>& page) const;
     
             const Credential* resolve(const CredentialCriteria* criteria=nullptr) const;
             vector<const Credential*>::size_type resolve(vector<const Credential*>&, const CredentialCriteria* criteria=nullptr) const;
 
             string getCacheTag() const {
-                Lock lock(m_trackerLock);
-                return m_feedTag;
+                return getFeed()->m_tag;
             }
 
             void outputFeed(ostream& os, bool& first, bool wrapArray=true) const {
+                boost::shared_ptr<const feed_cache_t> feed = getFeed();
                 if (wrapArray)
                     os << '[';
-                // Lock each provider in turn and suck in its feed.
+                if (!feed->m_feed.empty()) {
+                    if (first)
+                        first = false;
+                    else
+                        os << ",\n";
+                    os << feed->m_feed;
+                }
+                if (wrapArray)
+                    os << "\n]";
+            }
+
+            const char* outputEncodedFeed(ostream& os, const char* acceptEncoding, string& etag) const {
+                boost::shared_ptr<const feed_cache_t> feed = getFeed();
+                etag = feed->m_tag;
+                const char* coding = feed->m_encoding ? FeedEncoding::negotiate(acceptEncoding) : nullptr;
+                if (coding) {
+                    feed->m_encoding->output(os, coding);
+                    etag = etag + '-' + coding;
+                }
+                else {
+                    os << '[' << feed->m_feed << "\n]";
+                }
+                return coding;
+            }
+
+            void search(const char* query, const char* lang, unsigned int maxResults, vector< pair<unsigned int,string> >& results) const {
+                vector< pair<unsigned int,string> > merged;
                 for (ptr_vector<MetadataProvider>::iterator m = m_providers.begin(); m != m_providers.end(); ++m) {
                     DiscoverableMetadataProvider* d = dynamic_cast<DiscoverableMetadataProvider*>(&(*m));
                     if (d) {
                         Locker locker(d);
-                        d->outputFeed(os, first, false);
+                        d->search(query, lang, maxResults, merged);
                     }
                 }
-                if (wrapArray)
-                    os << "\n]";
+
+                // Best overall first, ties kept in child order, and no more than asked for.
+                stable_sort(merged.begin(), merged.end(), higher_score);
+                if (merged.size() > maxResults)
+                    merged.resize(maxResults);
+                results.insert(results.end(), merged.begin(), merged.end());
             }
 
             void onEvent(const ObservableMetadataProvider& provider) const {
+                if (m_routeLock) {
+                    // The provider is holding its own lock while it notifies us.
+                    const MetadataProvider* m = dynamic_cast<const MetadataProvider*>(&provider);
+                    if (m)
+                        updateRoutes(m, false);
+                }
                 Lock lock(m_trackerLock);
                 if (dynamic_cast<const DiscoverableMetadataProvider*>(&provider)) {
-                    // Reset the cache tag for the feed.
-                    SAMLConfig::getConfig().generateRandomBytes(m_feedTag, 4);
-                    m_feedTag = SAMLArtifact::toHex(m_feedTag);
+                    // Invalidate the aggregated feed.
+                    ++m_feedGeneration;
                 }
-                emitChangeEvent();
+                if (m_initializing)
+                    m_changedDuringInit = true;
+                else
+                    emitChangeEvent();
             }
 
             void onEvent(const ObservableMetadataProvider& provider, const EntityDescriptor& entity) const {
+                if (m_routeLock) {
+                    // The provider is holding its own lock while it notifies us.
+                    const MetadataProvider* m = dynamic_cast<const MetadataProvider*>(&provider);
+                    if (m)
+                        updateRoutes(m, false);
+                }
                 Lock lock(m_trackerLock);
                 if (dynamic_cast<const DiscoverableMetadataProvider*>(&provider)) {
-                    // Reset the cache tag for the feed.
-                    SAMLConfig::getConfig().generateRandomBytes(m_feedTag, 4);
-                    m_feedTag = SAMLArtifact::toHex(m_feedTag);
+                    // Invalidate the aggregated feed.
+                    ++m_feedGeneration;
                 }
-                emitChangeEvent(entity);
+                if (m_initializing)
+                    m_changedDuringInit = true;
+                else
+                    emitChangeEvent(entity);
+            }
+
+            // Routes and the feed generation must track a child's content even if it delivers events asynchronously.
+            bool synchronous() const {
+                return true;
             }
 
         protected:
@@ -124,7 +242,66 @@ namespace opensaml {
             }
 
         private:
+            static bool higher_score(const pair<unsigned int,string>& a, const pair<unsigned int,string>& b) {
+                return a.first > b.first;
+            }
+            static void* init_fn(void*);
+            boost::shared_ptr<const feed_cache_t> getFeed() const;
+            time_t checkFolder();
+            void updateRoutes(const MetadataProvider* m, bool lockit) const;
+            void unroute(const MetadataProvider* m) const;
+            typedef inline_vector_t<const MetadataProvider*,8> candidates_t;
+            bool route(const Criteria& criteria, candidates_t& candidates) const;
+
+            class SAML_DLLLOCAL FolderTask : public MetadataScheduler::Task {
+            public:
+                FolderTask(ChainingMetadataProvider& provider) : m_provider(provider) {}
+                const char* getId() const { return m_provider.m_folder.c_str(); }
+                time_t run() { return m_provider.checkFolder(); }
+            private:
+                ChainingMetadataProvider& m_provider;
+            };
+
             bool m_firstMatch;
+            int m_initThreads;
+            mutable bool m_initializing, m_changedDuringInit;
+            mutable unsigned long m_feedGeneration;
+            scoped_ptr<Mutex> m_feedLock;
+            mutable boost::shared_ptr<const feed_cache_t> m_feedCache;
+            const MetadataFilterContext* m_childContext;
+
+            // Used when the chain is monitoring a folder of files on behalf of the Folder provider.
+            string m_folder;
+            bool m_folderNested;
+            int m_watchInterval;
+            DOMDocument* m_folderDoc;
+            scoped_ptr<RWLock> m_providersLock;
+            map<string,MetadataProvider*> m_folderFiles;
+            map<string,time_t> m_folderFailures;
+            scoped_ptr<FolderTask> m_folderTask;
+
+            // Routing index from entityIDs and artifact sources to the providers containing them.
+            typedef map< string,set<const MetadataProvider*> > routemap_t;
+            typedef map< const MetadataProvider*,pair< set<string>,set<string> > > routekeys_t;
+            scoped_ptr<RWLock> m_routeLock;
+            mutable routemap_t m_entityRoutes, m_sourceRoutes;
+            mutable routekeys_t m_routeKeys;
+
+            // Optional pool used to resolve against dynamic children concurrently.
+            typedef deque< pair<boost::shared_ptr<lookup_job_t>,vector<MetadataProvider*>::size_type> > lookupqueue_t;
+            static void* lookup_fn(void*);
+            bool isProvider(const MetadataProvider* m) const;
+            void dispatchLookup(const boost::shared_ptr<lookup_job_t>& job) const;
+            void awaitLookup(lookup_job_t* job, const MetadataProvider* m) const;
+            void finishLookup(lookup_job_t& job) const;
+            int m_lookupThreads;
+            bool m_lookupShutdown;
+            scoped_ptr<Mutex> m_lookupLock;
+            scoped_ptr<CondWait> m_lookupWait, m_lookupDone;
+            vector<Thread*> m_lookupPool;
+            mutable lookupqueue_t m_lookupQueue;
+            friend struct lookup_holder_t;
+
             scoped_ptr<Mutex> m_trackerLock;
             scoped_ptr<ThreadKey> m_tlsKey;
             mutable ptr_vector<MetadataProvider> m_providers;
@@ -141,29 +318,98 @@ namespace opensaml {
             }
 
             void lock_if(MetadataProvider* m) {
-                if (m_locked.count(m) == 0)
+                if (!m_locked.contains(m))
                     m->lock();
             }
 
             void unlock_if(MetadataProvider* m) {
-                if (m_locked.count(m) == 0)
+                if (!m_locked.contains(m))
                     m->unlock();
             }
 
             void remember(MetadataProvider* m, const EntityDescriptor* entity=nullptr) {
-                m_locked.insert(m);
-                if (entity)
-                    m_objectMap.insert(pair<const XMLObject*,const MetadataProvider*>(entity,m));
+                if (!m_locked.contains(m))
+                    m_locked.push_back(m);
+                if (entity && !getProvider(entity))
+                    m_objectMap.push_back(make_pair(static_cast<const XMLObject*>(entity), static_cast<const MetadataProvider*>(m)));
+            }
+
+            const MetadataProvider* getProvider(const XMLObject* entity) const {
+                for (size_t i = 0; i < m_objectMap.size(); ++i) {
+                    if (m_objectMap[i].first == entity)
+                        return m_objectMap[i].second;
+                }
+                return nullptr;
+            }
+
+            const MetadataProvider* getProvider(const RoleDescriptor& role) const {
+                return getProvider(role.getParent());
             }
 
-            const MetadataProvider* getProvider(const RoleDescriptor& role) {
-                map<const XMLObject*,const MetadataProvider*>::const_iterator i = m_objectMap.find(role.getParent());
-                return (i != m_objectMap.end()) ? i->second : nullptr;
+            void unlockAll() {
+                for (size_t i = 0; i < m_locked.size(); ++i)
+                    m_locked[i]->unlock();
+                m_locked.clear();
+                m_objectMap.clear();
             }
 
             const ChainingMetadataProvider* m_metadata;
-            set<MetadataProvider*> m_locked;
-            map<const XMLObject*,const MetadataProvider*> m_objectMap;
+            inline_vector_t<MetadataProvider*,4> m_locked;
+            inline_vector_t<pair<const XMLObject*,const MetadataProvider*>,4> m_objectMap;
+        };
+
+        // shared state for a pool of threads initializing child providers
+        struct SAML_DLLLOCAL init_job_t {
+            init_job_t(ptr_vector<MetadataProvider>& providers)
+                : m_providers(providers), m_next(0), m_errors(providers.size()), m_lock(Mutex::create()) {
+            }
+
+            ptr_vector<MetadataProvider>& m_providers;
+            ptr_vector<MetadataProvider>::size_type m_next;
+            vector<string> m_errors;
+            scoped_ptr<Mutex> m_lock;
+        };
+
+        struct SAML_DLLLOCAL lookup_job_t {
+            // A claimed child has been taken off the queue, but its worker hasn't started on it.
+            enum state_t { QUEUED, CLAIMED, RUNNING, DONE, CANCELLED };
+
+            // Workers can outlive the caller, so they get their own copy of what identifies the entity.
+            lookup_job_t(const MetadataProvider::Criteria& criteria) {
+                if (criteria.entityID_ascii) {
+                    m_entityID = criteria.entityID_ascii;
+                    m_criteria.entityID_ascii = m_entityID.c_str();
+                }
+                else if (criteria.entityID_unicode) {
+                    auto_ptr_char temp(criteria.entityID_unicode);
+                    m_entityID = temp.get() ? temp.get() : "";
+                    m_criteria.entityID_ascii = m_entityID.c_str();
+                }
+                else if (criteria.artifact) {
+                    m_artifact.reset(criteria.artifact->clone());
+                    m_criteria.artifact = m_artifact.get();
+                }
+                m_criteria.validOnly = criteria.validOnly;
+            }
+
+            string m_entityID;
+            scoped_ptr<SAMLArtifact> m_artifact;
+            MetadataProvider::Criteria m_criteria;
+            vector<MetadataProvider*> m_children;
+            vector<state_t> m_states;
+        };
+
+        // Withdraws a lookup's unstarted work when the caller returns, leaving running work to finish.
+        struct SAML_DLLLOCAL lookup_holder_t {
+            lookup_holder_t(const ChainingMetadataProvider& chain) : m_chain(chain) {}
+
+            ~lookup_holder_t() {
+                if (m_job)
+                    m_chain.finishLookup(*m_job);
+            }
+
+            const ChainingMetadataProvider& m_chain;
+            boost::shared_ptr<lookup_job_t> m_job;
         };
 
         MetadataProvider* SAML_DLLLOCAL ChainingMetadataProviderFactory(const DOMElement* const & e, bool deprecationSupport)
@@ -173,8 +419,21 @@ namespace opensaml {
 
         static const XMLCh _MetadataProvider[] =    UNICODE_LITERAL_16(M,e,t,a,d,a,t,a,P,r,o,v,i,d,e,r);
         static const XMLCh precedence[] =           UNICODE_LITERAL_10(p,r,e,c,e,d,e,n,c,e);
+        static const XMLCh initThreads[] =          UNICODE_LITERAL_11(i,n,i,t,T,h,r,e,a,d,s);
         static const XMLCh last[] =                 UNICODE_LITERAL_4(l,a,s,t);
+        static const XMLCh lookupThreads[] =        UNICODE_LITERAL_13(l,o,o,k,u,p,T,h,r,e,a,d,s);
+        static const XMLCh folder[] =               UNICODE_LITERAL_6(f,o,l,d,e,r);
+        static const XMLCh FolderTemplate[] =       UNICODE_LITERAL_14(F,o,l,d,e,r,T,e,m,p,l,a,t,e);
+        static const XMLCh nested[] =               UNICODE_LITERAL_6(n,e,s,t,e,d);
+        static const XMLCh path[] =                 UNICODE_LITERAL_4(p,a,t,h);
+        static const XMLCh routing[] =              UNICODE_LITERAL_7(r,o,u,t,i,n,g);
+        static const XMLCh watchInterval[] =        UNICODE_LITERAL_13(w,a,t,c,h,I,n,t,e,r,v,a,l);
         static const XMLCh _type[] =                UNICODE_LITERAL_4(t,y,p,e);
+
+        static void FolderCallback(const char* pathname, struct stat& stat_buf, void* data) {
+            // data is the map of files found and their timestamps
+            reinterpret_cast<map<string,time_t>*>(data)->insert(make_pair(string(pathname), stat_buf.st_mtime));
+        }
     };
 };
 
@@ -191,15 +450,37 @@ void ChainingMetadataProvider::tracker_cleanup(void* ptr)
 
 ChainingMetadataProvider::ChainingMetadataProvider(const DOMElement* e, bool deprecationSupport)
     : MetadataProvider(nullptr), ObservableMetadataProvider(e),
-        m_firstMatch(true), m_trackerLock(Mutex::create()), m_tlsKey(ThreadKey::create(tracker_cleanup)),
+        m_firstMatch(true), m_initThreads(XMLHelper::getAttrInt(e, 1, initThreads)),
+        m_initializing(false), m_changedDuringInit(false), m_feedGeneration(0), m_feedLock(Mutex::create()), m_childContext(nullptr),
+        m_folderNested(false), m_watchInterval(60), m_folderDoc(nullptr),
+        m_lookupThreads(XMLHelper::getAttrInt(e, 0, lookupThreads)), m_lookupShutdown(false), m_trackerLock(Mutex::create()), m_tlsKey(ThreadKey::create(tracker_cleanup)),
         m_log(Category::getInstance(SAML_LOGCAT ".MetadataProvider.Chaining"))
 {
     if (XMLString::equals(e ? e->getAttributeNS(nullptr, precedence) : nullptr, last))
         m_firstMatch = false;
 
+    if (XMLHelper::getAttrBool(e, true, routing))
+        m_routeLock.reset(RWLock::create());
+
+    if (e && e->hasAttributeNS(nullptr, folder)) {
+        m_folder = XMLHelper::getAttrString(e, nullptr, folder);
+        m_folderNested = XMLHelper::getAttrBool(e, false, nested);
+        m_watchInterval = XMLHelper::getAttrInt(e, 60, watchInterval);
+        if (m_watchInterval <= 0)
+            m_watchInterval = 60;
+        m_providersLock.reset(RWLock::create());
+    }
+
     e = XMLHelper::getFirstChildElement(e);
     while (e) {
-        if (!XMLString::equals(_MetadataProvider, e->getLocalName())) {
+        if (!m_folder.empty() && XMLString::equals(FolderTemplate, e->getLocalName())) {
+            // Keep a private copy of the template for providers added later.
+            if (!m_folderDoc) {
+                m_folderDoc = XMLToolingConfig::getConfig().getParser().newDocument();
+                m_folderDoc->appendChild(m_folderDoc->importNode(e, true));
+            }
+        }
+        else if (!XMLString::equals(_MetadataProvider, e->getLocalName())) {
             auto_ptr_char name(e->getLocalName());
             m_log.error("MetadataProvider child element of type %s ignored", name.get());
         }
@@ -213,6 +494,8 @@ ChainingMetadataProvider::ChainingMetadataProvider(const DOMElement* e, bool dep
                     if (obs)
                         obs->addObserver(this);
                     m_providers.push_back(provider.get());
+                    if (!m_folder.empty())
+                        m_folderFiles[XMLHelper::getAttrString(e, nullptr, path)] = provider.get();
                     provider.release();
                 } catch (std::exception& ex) {
                     m_log.error("error building MetadataProvider: %s", ex.what());
@@ -228,29 +511,505 @@ ChainingMetadataProvider::ChainingMetadataProvider(const DOMElement* e, bool dep
 
 ChainingMetadataProvider::~ChainingMetadataProvider()
 {
+    stopChangeEvents();
+
+    if (!m_lookupPool.empty()) {
+        m_lookupLock->lock();
+        m_lookupShutdown = true;
+        m_lookupWait->broadcast();
+        m_lookupLock->unlock();
+        for (vector<Thread*>::iterator t = m_lookupPool.begin(); t != m_lookupPool.end(); ++t) {
+            (*t)->join(nullptr);
+            delete *t;
+        }
+    }
+
+    if (m_folderTask)
+        MetadataScheduler::getScheduler().cancel(m_folderTask.get());
+    if (m_folderDoc)
+        m_folderDoc->release();
+
     m_tlsKey.reset();   // need to free this ahead of trackers in a command line case
     for_each(m_trackers.begin(), m_trackers.end(), xmltooling::cleanup<tracker_t>());
 }
 
 void ChainingMetadataProvider::setContext(const MetadataFilterContext* ctx)
 {
+    m_childContext = ctx;
     for_each(m_providers.begin(), m_providers.end(), boost::bind(&MetadataProvider::setContext, _1, ctx));
 }
 
+void* ChainingMetadataProvider::init_fn(void* pv)
+{
+    init_job_t* job = reinterpret_cast<init_job_t*>(pv);
+
+#ifndef WIN32
+    // First, let's block all signals
+    Thread::mask_all_signals();
+#endif
+
+#ifdef _DEBUG
+    xmltooling::NDC ndc("init");
+#endif
+
+    while (true) {
+        ptr_vector<MetadataProvider>::size_type i;
+        {
+            Lock lock(job->m_lock);
+            if (job->m_next >= job->m_providers.size())
+                break;
+            i = job->m_next++;
+        }
+
+        // Each slot is only touched by the thread that claimed it.
+        try {
+            job->m_providers[i].init();
+        }
+        catch (std::exception& ex) {
+            job->m_errors[i] = ex.what();
+            if (job->m_errors[i].empty())
+                job->m_errors[i] = "unknown error";
+        }
+    }
+
+    return nullptr;
+}
+
 void ChainingMetadataProvider::init()
 {
-    for (ptr_vector<MetadataProvider>::iterator i = m_providers.begin(); i != m_providers.end(); ++i) {
+    startChangeEvents();
+
+    {
+        // Hold any change events from the children until they're all loaded.
+        Lock lock(m_trackerLock);
+        m_initializing = true;
+        m_changedDuringInit = false;
+    }
+
+    unsigned int threads = (m_initThreads > 1) ? min<unsigned int>(m_initThreads, m_providers.size()) : 1;
+    if (threads > 1) {
+        m_log.info("initializing %u MetadataProvider(s) using %u threads", (unsigned int)m_providers.size(), threads);
+
+        init_job_t job(m_providers);
+        vector<Thread*> pool;
         try {
-            i->init();
+            for (unsigned int t = 0; t < threads; ++t)
+                pool.push_back(Thread::create(&init_fn, &job));
         }
         catch (std::exception& ex) {
-            m_log.crit("failure initializing MetadataProvider: %s", ex.what());
+            // Run with whatever we managed to start, or inline if nothing started.
+            m_log.warn("unable to start all initialization threads: %s", ex.what());
+            if (pool.empty())
+                init_fn(&job);
+        }
+        for (vector<Thread*>::iterator th = pool.begin(); th != pool.end(); ++th) {
+            (*th)->join(nullptr);
+            delete *th;
         }
+
+        // Report failures in configuration order, regardless of completion order.
+        for (vector<string>::const_iterator err = job.m_errors.begin(); err != job.m_errors.end(); ++err) {
+            if (!err->empty())
+                m_log.crit("failure initializing MetadataProvider: %s", err->c_str());
+        }
+    }
+    else {
+        for (ptr_vector<MetadataProvider>::iterator i = m_providers.begin(); i != m_providers.end(); ++i) {
+            try {
+                i->init();
+            }
+            catch (std::exception& ex) {
+                m_log.crit("failure initializing MetadataProvider: %s", ex.what());
+            }
+        }
+    }
+
+    if (m_routeLock) {
+        for (ptr_vector<MetadataProvider>::iterator i = m_providers.begin(); i != m_providers.end(); ++i)
+            updateRoutes(&(*i), true);
+    }
+
+    Lock lock(m_trackerLock);
+    m_initializing = false;
+
+    // Invalidate any feed aggregated before the plugins were loaded.
+    ++m_feedGeneration;
+
+    if (m_changedDuringInit) {
+        m_changedDuringInit = false;
+        emitChangeEvent();
+    }
+
+    if (m_lookupThreads > 0 && m_lookupPool.empty()) {
+        m_log.info("starting %d thread(s) for concurrent lookups against dynamic providers", m_lookupThreads);
+        m_lookupLock.reset(Mutex::create());
+        m_lookupWait.reset(CondWait::create());
+        m_lookupDone.reset(CondWait::create());
+        for (int t = 0; t < m_lookupThreads; ++t)
+            m_lookupPool.push_back(Thread::create(&lookup_fn, this));
     }
 
-    // Set an initial cache tag for the state of the plugins.
-    SAMLConfig::getConfig().generateRandomBytes(m_feedTag, 4);
-    m_feedTag = SAMLArtifact::toHex(m_feedTag);
+    if (m_folderDoc && !m_folderTask) {
+        m_log.info("monitoring folder (%s) for added or removed files every %d seconds", m_folder.c_str(), m_watchInterval);
+        m_folderTask.reset(new FolderTask(*this));
+        MetadataScheduler::getScheduler().schedule(m_folderTask.get(), m_watchInterval, true);
+    }
+}
+
+time_t ChainingMetadataProvider::checkFolder()
+{
+#ifdef WIN32
+    struct _stat stat_buf;
+    if (_stat(m_folder.c_str(), &stat_buf) != 0) {
+#else
+    struct stat stat_buf;
+    if (stat(m_folder.c_str(), &stat_buf) != 0) {
+#endif
+        // Don't treat a missing folder as the removal of everything in it.
+        m_log.warn("unable to access monitored folder (%s), leaving providers in place", m_folder.c_str());
+        return m_watchInterval;
+    }
+
+    map<string,time_t> found;
+    DirectoryWalker walker(m_log, m_folder.c_str(), m_folderNested);
+    walker.walk(FolderCallback, &found);
+
+    // Only this task touches the file maps once the chain is initialized.
+    vector< pair<string,MetadataProvider*> > added;
+    vector<string> removed;
+    for (map<string,MetadataProvider*>::const_iterator i = m_folderFiles.begin(); i != m_folderFiles.end(); ++i) {
+        if (found.count(i->first) == 0)
+            removed.push_back(i->first);
+    }
+
+    for (map<string,time_t>::const_iterator f = found.begin(); f != found.end(); ++f) {
+        if (m_folderFiles.count(f->first) > 0)
+            continue;
+
+        // Don't keep retrying a broken file until it changes.
+        map<string,time_t>::const_iterator failed = m_folderFailures.find(f->first);
+        if (failed != m_folderFailures.end() && failed->second == f->second)
+            continue;
+
+        // Build and load the new provider without blocking access to the existing ones.
+        m_log.info("building MetadataProvider for new file (%s)", f->first.c_str());
+        DOMElement* child = static_cast<DOMElement*>(m_folderDoc->getDocumentElement()->cloneNode(true));
+        try {
+            auto_ptr_XMLCh widenit(f->first.c_str());
+            child->setAttributeNS(nullptr, path, widenit.get());
+            string t = XMLHelper::getAttrString(child, nullptr, _type);
+            auto_ptr<MetadataProvider> provider(SAMLConfig::getConfig().MetadataProviderManager.newPlugin(t.c_str(), child, true));
+            provider->setContext(m_childContext);
+            try {
+                provider->init();
+            }
+            catch (std::exception& ex) {
+                m_log.crit("failure initializing MetadataProvider: %s", ex.what());
+            }
+            // Observe before routing, so that a change in between isn't missed.
+            ObservableMetadataProvider* obs = dynamic_cast<ObservableMetadataProvider*>(provider.get());
+            if (obs)
+                obs->addObserver(this);
+            if (m_routeLock)
+                updateRoutes(provider.get(), true);
+            added.push_back(make_pair(f->first, provider.get()));
+            provider.release();
+            m_folderFailures.erase(f->first);
+        }
+        catch (std::exception& ex) {
+            m_log.error("error building MetadataProvider: %s", ex.what());
+            m_folderFailures[f->first] = f->second;
+        }
+        child->release();
+    }
+
+    if (added.empty() && removed.empty())
+        return m_watchInterval;
+
+    vector<MetadataProvider*> discarded;
+    m_providersLock->wrlock();
+    for (vector<string>::const_iterator r = removed.begin(); r != removed.end(); ++r) {
+        MetadataProvider* m = m_folderFiles[*r];
+        for (ptr_vector<MetadataProvider>::iterator i = m_providers.begin(); i != m_providers.end(); ++i) {
+            if (&(*i) == m) {
+                discarded.push_back(m_providers.release(i).release());
+                break;
+            }
+        }
+        m_folderFiles.erase(*r);
+        m_log.info("removed MetadataProvider for deleted file (%s)", r->c_str());
+    }
+    for (vector< pair<string,MetadataProvider*> >::const_iterator a = added.begin(); a != added.end(); ++a) {
+        m_providers.push_back(a->second);
+        m_folderFiles[a->first] = a->second;
+    }
+    m_providersLock->unlock();
+
+    // Stop observing the old providers before unrouting them, so they can't be routed again.
+    // They're freed only after the lock is released, since they may be signaling us.
+    for (vector<MetadataProvider*>::iterator d = discarded.begin(); d != discarded.end(); ++d) {
+        ObservableMetadataProvider* obs = dynamic_cast<ObservableMetadataProvider*>(*d);
+        if (obs)
+            obs->removeObserver(this);
+    }
+
+    if (m_routeLock) {
+        m_routeLock->wrlock();
+        SharedLock locker(m_routeLock, false);
+        for_each(discarded.begin(), discarded.end(), boost::bind(&ChainingMetadataProvider::unroute, this, _1));
+    }
+
+    for_each(discarded.begin(), discarded.end(), xmltooling::cleanup<MetadataProvider>());
+
+    Lock lock(m_trackerLock);
+    ++m_feedGeneration;
+    emitChangeEvent();
+
+    return m_watchInterval;
+}
+
+void* ChainingMetadataProvider::lookup_fn(void* pv)
+{
+    const ChainingMetadataProvider* chain = reinterpret_cast<ChainingMetadataProvider*>(pv);
+
+#ifndef WIN32
+    // First, let's block all signals
+    Thread::mask_all_signals();
+#endif
+
+#ifdef _DEBUG
+    xmltooling::NDC ndc("lookup");
+#endif
+
+    chain->m_lookupLock->lock();
+    while (!chain->m_lookupShutdown) {
+        if (chain->m_lookupQueue.empty()) {
+            chain->m_lookupWait->wait(chain->m_lookupLock.get());
+            continue;
+        }
+
+        boost::shared_ptr<lookup_job_t> job = chain->m_lookupQueue.front().first;
+        vector<MetadataProvider*>::size_type i = chain->m_lookupQueue.front().second;
+        chain->m_lookupQueue.pop_front();
+        if (job->m_states[i] != lookup_job_t::QUEUED)
+            continue;
+        job->m_states[i] = lookup_job_t::CLAIMED;
+        chain->m_lookupLock->unlock();
+
+        // The caller may be gone, so keep the set of children stable while using one. Until the
+        // lock is held, the caller can still take the work back rather than wait on a writer.
+        if (chain->m_providersLock)
+            chain->m_providersLock->rdlock();
+        SharedLock providersLock(chain->m_providersLock, false);
+        chain->m_lookupLock->lock();
+        if (job->m_states[i] != lookup_job_t::CLAIMED) {
+            providersLock.release();
+            continue;
+        }
+        job->m_states[i] = lookup_job_t::RUNNING;
+        chain->m_lookupLock->unlock();
+
+        // The result is discarded. This just gets the provider to resolve and cache the entity
+        // ahead of the caller's own query, which runs in order and determines the outcome.
+        if (chain->isProvider(job->m_children[i])) {
+            try {
+                Locker locker(job->m_children[i]);
+                job->m_children[i]->getEntityDescriptor(job->m_criteria);
+            }
+            catch (std::exception& ex) {
+                chain->m_log.debug("concurrent lookup failed: %s", ex.what());
+            }
+        }
+        providersLock.release();
+
+        chain->m_lookupLock->lock();
+        job->m_states[i] = lookup_job_t::DONE;
+        chain->m_lookupDone->broadcast();
+    }
+    chain->m_lookupLock->unlock();
+
+    return nullptr;
+}
+
+bool ChainingMetadataProvider::isProvider(const MetadataProvider* m) const
+{
+    for (ptr_vector<MetadataProvider>::const_iterator i = m_providers.begin(); i != m_providers.end(); ++i) {
+        if (&(*i) == m)
+            return true;
+    }
+    return false;
+}
+
+void ChainingMetadataProvider::dispatchLookup(const boost::shared_ptr<lookup_job_t>& job) const
+{
+    Lock lock(m_lookupLock);
+    job->m_states.assign(job->m_children.size(), lookup_job_t::QUEUED);
+    for (vector<MetadataProvider*>::size_type i = 0; i < job->m_children.size(); ++i)
+        m_lookupQueue.push_back(make_pair(job, i));
+    m_lookupWait->broadcast();
+}
+
+void ChainingMetadataProvider::awaitLookup(lookup_job_t* job, const MetadataProvider* m) const
+{
+    if (!job)
+        return;
+
+    Lock lock(m_lookupLock);
+    for (vector<MetadataProvider*>::size_type i = 0; i < job->m_children.size(); ++i) {
+        if (job->m_children[i] == m) {
+            // If no worker has started on it, the caller will just do the work itself.
+            if (job->m_states[i] == lookup_job_t::QUEUED || job->m_states[i] == lookup_job_t::CLAIMED)
+                job->m_states[i] = lookup_job_t::CANCELLED;
+            while (job->m_states[i] == lookup_job_t::RUNNING)
+                m_lookupDone->wait(m_lookupLock.get());
+            return;
+        }
+    }
+}
+
+void ChainingMetadataProvider::finishLookup(lookup_job_t& job) const
+{
+    Lock lock(m_lookupLock);
+
+    // Withdraw anything not yet started. Running work finishes on its own copy of the criteria.
+    for (lookupqueue_t::iterator q = m_lookupQueue.begin(); q != m_lookupQueue.end();) {
+        if (q->first.get() == &job)
+            q = m_lookupQueue.erase(q);
+        else
+            ++q;
+    }
+    for (vector<MetadataProvider*>::size_type i = 0; i < job.m_children.size(); ++i) {
+        if (job.m_states[i] == lookup_job_t::QUEUED || job.m_states[i] == lookup_job_t::CLAIMED)
+            job.m_states[i] = lookup_job_t::CANCELLED;
+    }
+}
+
+void ChainingMetadataProvider::updateRoutes(const MetadataProvider* m, bool lockit) const
+{
+    pair< set<string>,set<string> > keys;
+    bool complete = false;
+    const AbstractMetadataProvider* amp = dynamic_cast<const AbstractMetadataProvider*>(m);
+    if (amp) {
+        Locker locker(lockit ? const_cast<MetadataProvider*>(m) : nullptr);
+        complete = amp->getIndexKeys(keys.first, keys.second);
+    }
+
+    m_routeLock->wrlock();
+    SharedLock locker(m_routeLock, false);
+    unroute(m);
+
+    // Providers that can't enumerate their content have no keys and are always searched.
+    if (complete) {
+        for (set<string>::const_iterator k = keys.first.begin(); k != keys.first.end(); ++k)
+            m_entityRoutes[*k].insert(m);
+        for (set<string>::const_iterator k = keys.second.begin(); k != keys.second.end(); ++k)
+            m_sourceRoutes[*k].insert(m);
+        m_routeKeys[m].swap(keys);
+    }
+}
+
+void ChainingMetadataProvider::unroute(const MetadataProvider* m) const
+{
+    // Caller must hold the write lock.
+    routekeys_t::iterator keys = m_routeKeys.find(m);
+    if (keys == m_routeKeys.end())
+        return;
+
+    for (set<string>::const_iterator k = keys->second.first.begin(); k != keys->second.first.end(); ++k) {
+        routemap_t::iterator r = m_entityRoutes.find(*k);
+        if (r != m_entityRoutes.end()) {
+            r->second.erase(m);
+            if (r->second.empty())
+                m_entityRoutes.erase(r);
+        }
+    }
+    for (set<string>::const_iterator k = keys->second.second.begin(); k != keys->second.second.end(); ++k) {
+        routemap_t::iterator r = m_sourceRoutes.find(*k);
+        if (r != m_sourceRoutes.end()) {
+            r->second.erase(m);
+            if (r->second.empty())
+                m_sourceRoutes.erase(r);
+        }
+    }
+    m_routeKeys.erase(keys);
+}
+
+bool ChainingMetadataProvider::route(const Criteria& criteria, candidates_t& candidates) const
+{
+    if (!m_routeLock)
+        return false;
+
+    string key;
+    const routemap_t* routes = &m_entityRoutes;
+    if (criteria.entityID_ascii) {
+        key = criteria.entityID_ascii;
+    }
+    else if (criteria.entityID_unicode) {
+        auto_ptr_char temp(criteria.entityID_unicode);
+        key = temp.get();
+    }
+    else if (criteria.artifact) {
+        key = criteria.artifact->getSource();
+        routes = &m_sourceRoutes;
+    }
+    else {
+        return false;
+    }
+
+    SharedLock locker(m_routeLock);
+    routemap_t::const_iterator r = routes->find(key);
+    if (r != routes->end()) {
+        for (set<const MetadataProvider*>::const_iterator m = r->second.begin(); m != r->second.end(); ++m)
+            candidates.push_back(*m);
+    }
+    for (ptr_vector<MetadataProvider>::const_iterator i = m_providers.begin(); i != m_providers.end(); ++i) {
+        if (m_routeKeys.count(&(*i)) == 0)
+            candidates.push_back(&(*i));
+    }
+    return true;
+}
+
+boost::shared_ptr<const feed_cache_t> ChainingMetadataProvider::getFeed() const
+{
+    unsigned long generation;
+    {
+        Lock lock(m_trackerLock);
+        generation = m_feedGeneration;
+    }
+
+    {
+        Lock lock(m_feedLock);
+        if (m_feedCache && m_feedCache->m_generation == generation)
+            return m_feedCache;
+    }
+
+    // Rebuild without holding our own locks, since the children notify us while locked.
+    boost::shared_ptr<feed_cache_t> feed(new feed_cache_t(generation));
+    ostringstream os;
+    bool first = true;
+    for (ptr_vector<MetadataProvider>::iterator m = m_providers.begin(); m != m_providers.end(); ++m) {
+        DiscoverableMetadataProvider* d = dynamic_cast<DiscoverableMetadataProvider*>(&(*m));
+        if (d) {
+            Locker locker(d);
+            d->outputFeed(os, first, false);
+        }
+    }
+    feed->m_feed = os.str();
+    feed->m_tag = SecurityHelper::doHash("SHA1", feed->m_feed.data(), feed->m_feed.length());
+
+    try {
+        feed->m_encoding.reset(new FeedEncoding('[' + feed->m_feed + "\n]"));
+    }
+    catch (const exception& ex) {
+        m_log.warn("unable to compress aggregated discovery feed: %s", ex.what());
+    }
+
+    m_log.debug("rebuilt aggregated discovery feed (%lu bytes)", feed->m_feed.length());
+
+    Lock lock(m_feedLock);
+    if (!m_feedCache || m_feedCache->m_generation < generation)
+        m_feedCache = feed;
+    return feed;
 }
 
 void ChainingMetadataProvider::outputStatus(ostream& os) const
@@ -260,7 +1019,10 @@ void ChainingMetadataProvider::outputStatus(ostream& os) const
 
 Lockable* ChainingMetadataProvider::lock()
 {
-    return this;   // we're not lockable ourselves...
+    // We're not lockable ourselves, except to keep the set of providers stable.
+    if (m_providersLock)
+        m_providersLock->rdlock();
+    return this;
 }
 
 void ChainingMetadataProvider::unlock()
@@ -268,11 +1030,11 @@ void ChainingMetadataProvider::unlock()
     // Check for locked providers and remove role mappings.
     void* ptr=m_tlsKey->getData();
     if (ptr) {
-        tracker_t* t = reinterpret_cast<tracker_t*>(ptr);
-        for_each(t->m_locked.begin(), t->m_locked.end(), mem_fun(&Lockable::unlock));
-        t->m_locked.clear();
-        t->m_objectMap.clear();
+        reinterpret_cast<tracker_t*>(ptr)->unlockAll();
     }
+
+    if (m_providersLock)
+        m_providersLock->unlock();
 }
 
 const XMLObject* ChainingMetadataProvider::getMetadata() const
@@ -341,13 +1103,44 @@ pair<const EntityDescriptor*,const RoleDescriptor*> ChainingMetadataProvider::ge
         m_tlsKey->setData(tracker);
     }
 
+    // Narrow the search to the providers known to contain the entity, if possible.
+    candidates_t candidates;
+    bool routed = route(criteria, candidates);
+
+    // Once the ordered pass has to move on from a dynamic child, the dynamic children after it are
+    // optionally started resolving in the background, so that the rest of a miss costs the slowest
+    // of them rather than the sum. Results still come from the ordered pass.
+    lookup_holder_t lookup(*this);
+    bool fanOut = false;
+
     // Do a search.
     MetadataProvider* held = nullptr;
     pair<const EntityDescriptor*,const RoleDescriptor*> ret = pair<const EntityDescriptor*,const RoleDescriptor*>(nullptr,nullptr);
     pair<const EntityDescriptor*,const RoleDescriptor*> cur = ret;
     for (ptr_vector<MetadataProvider>::iterator i = m_providers.begin(); i != m_providers.end(); ++i) {
+        if (routed && !candidates.contains(&(*i)))
+            continue;
+        if (fanOut) {
+            fanOut = false;
+            boost::shared_ptr<lookup_job_t> job(new lookup_job_t(criteria));
+            ptr_vector<MetadataProvider>::iterator j = i;
+            for (++j; j != m_providers.end(); ++j) {
+                if (routed && !candidates.contains(&(*j)))
+                    continue;
+                // Skip anything this thread already holds, since the worker may need to write-lock it.
+                if (!tracker->m_locked.contains(&(*j)) && dynamic_cast<const AbstractDynamicMetadataProvider*>(&(*j)))
+                    job->m_children.push_back(&(*j));
+            }
+            if (!job->m_children.empty()) {
+                dispatchLookup(job);
+                lookup.m_job = job;
+            }
+        }
+        awaitLookup(lookup.m_job.get(), &(*i));
         tracker->lock_if(&(*i));
         cur = i->getEntityDescriptor(criteria);
+        if (!m_lookupPool.empty() && !lookup.m_job && dynamic_cast<const AbstractDynamicMetadataProvider*>(&(*i)))
+            fanOut = true;
         if (cur.first) {
             if (criteria.role) {
                 // We want a role also. Did we find one?
@@ -448,6 +1241,82 @@ pair<const EntityDescriptor*,const RoleDescriptor*> ChainingMetadataProvider::ge
     return ret;
 }
 
+bool ChainingMetadataProvider::getEntityPage(EntityCursor& cursor, vector<const EntityDescriptor*>& page) const
+{
+    // Ensure we have a tracker to use.
+    tracker_t* tracker = nullptr;
+    void* ptr=m_tlsKey->getData();
+    if (ptr) {
+        tracker = reinterpret_cast<tracker_t*>(ptr);
+    }
+    else {
+        tracker = new tracker_t(this);
+        m_tlsKey->setData(tracker);
+    }
+
+    // Gather a page from each child. A child with more to give bounds how far the merged
+    // page can safely extend, since its entities beyond its own page are still unseen.
+    typedef multimap< string,pair<const EntityDescriptor*,MetadataProvider*> > merged_t;
+    merged_t merged;
+    bool more = false;
+    string limit;
+    for (ptr_vector<MetadataProvider>::iterator i = m_providers.begin(); i != m_providers.end(); ++i) {
+        EntityCursor childCursor(cursor);
+        vector<const EntityDescriptor*> childPage;
+        tracker->lock_if(&(*i));
+        try {
+            if (i->getEntityPage(childCursor, childPage)) {
+                if (!more || childCursor.position < limit)
+                    limit = childCursor.position;
+                more = true;
+            }
+        }
+        catch (const MetadataException& ex) {
+            m_log.warn("skipping metadata provider (%s) during enumeration: %s", i->getId() ? i->getId() : "unnamed", ex.what());
+        }
+        if (childPage.empty()) {
+            tracker->unlock_if(&(*i));
+            continue;
+        }
+        for (vector<const EntityDescriptor*>::const_iterator e = childPage.begin(); e != childPage.end(); ++e) {
+            auto_ptr_char id((*e)->getEntityID());
+            merged.insert(merged_t::value_type(id.get() ? id.get() : "", make_pair(*e, &(*i))));
+        }
+    }
+
+    set<MetadataProvider*> used;
+    vector<const EntityDescriptor*>::size_type count = 0;
+    bool full = false;
+    for (merged_t::const_iterator m = merged.begin(); m != merged.end(); ++m) {
+        if (m->first != cursor.position) {
+            if (cursor.pageSize && count >= cursor.pageSize) {
+                full = more = true;
+                break;
+            }
+            if (more && m->first > limit)
+                break;
+            cursor.position = m->first;
+        }
+        page.push_back(m->second.first);
+        ++count;
+        tracker->remember(m->second.second, m->second.first);
+        used.insert(m->second.second);
+    }
+
+    // Every child has been examined up to the limit, so skip past it even if a scan-limited
+    // child found nothing to return there.
+    if (more && !full && limit > cursor.position)
+        cursor.position = limit;
+
+    // Release any child that contributed nothing to the final page.
+    for (merged_t::const_iterator m = merged.begin(); m != merged.end(); ++m) {
+        if (used.insert(m->second.second).second)
+            tracker->unlock_if(m->second.second);
+    }
+
+    return more;
+}
+
 const Credential* ChainingMetadataProvider::resolve(const CredentialCriteria* criteria) const
 {
     void* ptr=m_tlsKey->getData();
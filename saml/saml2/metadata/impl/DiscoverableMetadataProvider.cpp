@@ -25,19 +25,24 @@
  */
 
 #include "internal.h"
-#include "binding/SAMLArtifact.h"
 #include "saml2/metadata/EntityMatcher.h"
 #include "saml2/metadata/Metadata.h"
 #include "saml2/metadata/DiscoverableMetadataProvider.h"
 
+#include <algorithm>
+#include <cctype>
+#include <climits>
 #include <fstream>
 #include <sstream>
+#include <boost/algorithm/string.hpp>
 #include <boost/lambda/bind.hpp>
-#include <boost/lambda/casts.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/iterator/indirect_iterator.hpp>
 #include <xmltooling/logging.h>
 #include <xmltooling/XMLToolingConfig.h>
+#include <xmltooling/security/SecurityHelper.h>
+#include <xmltooling/util/Threads.h>
+#include <xmltooling/util/XMLHelper.h>
 
 using namespace opensaml::saml2;
 using namespace opensaml::saml2md;
@@ -48,7 +53,8 @@ using namespace boost;
 using namespace std;
 
 DiscoverableMetadataProvider::DiscoverableMetadataProvider(const DOMElement* e, bool deprecationSupport)
-    : MetadataProvider(e, deprecationSupport), m_legacyOrgNames(false)
+    : MetadataProvider(e, deprecationSupport), m_legacyOrgNames(false),
+        m_discoFilterResults(new EntityMatcherResults()), m_feedEncodingLock(Mutex::create())
 {
     static const XMLCh legacyOrgNames[] =   UNICODE_LITERAL_14(l,e,g,a,c,y,O,r,g,N,a,m,e,s);
     static const XMLCh matcher[] =          UNICODE_LITERAL_7(m,a,t,c,h,e,r);
@@ -105,14 +111,66 @@ DiscoverableMetadataProvider::~DiscoverableMetadataProvider()
 
 void DiscoverableMetadataProvider::generateFeed()
 {
-    m_feed.erase();
-    bool first = true;
+    // Every entity is rendered again, since a reload replaces every object in the tree.
+    m_feedFragments.clear();
     const XMLObject* object = getMetadata();
-    discoGroup(m_feed, dynamic_cast<const EntitiesDescriptor*>(object), first);
-    discoEntity(m_feed, dynamic_cast<const EntityDescriptor*>(object), first);
 
-    SAMLConfig::getConfig().generateRandomBytes(m_feedTag, 4);
-    m_feedTag = SAMLArtifact::toHex(m_feedTag);
+    // Evaluate the filters over the whole tree up front, so each group is only checked once.
+    vector<const EntityMatcher*> matchers;
+    for (vector< pair < bool, boost::shared_ptr<EntityMatcher> > >::const_iterator f = m_discoFilters.begin(); f != m_discoFilters.end(); ++f)
+        matchers.push_back(f->second.get());
+    m_discoFilterResults->compile(matchers, object);
+
+    discoGroup(dynamic_cast<const EntitiesDescriptor*>(object));
+    discoFragment(dynamic_cast<const EntityDescriptor*>(object));
+    joinFeed();
+
+    // The results point into the tree, so they mustn't outlive this pass over it.
+    m_discoFilterResults->clear();
+}
+
+void DiscoverableMetadataProvider::discoFragment(const EntityDescriptor* entity)
+{
+    if (!entity)
+        return;
+
+    m_feedFragments.push_back(feed_fragment_t());
+    m_feedFragments.back().m_json.reserve(1024);
+    bool first = true;
+    discoEntity(m_feedFragments.back().m_json, entity, first, &m_feedFragments.back().m_terms);
+    if (m_feedFragments.back().m_json.empty())
+        m_feedFragments.pop_back();
+}
+
+void DiscoverableMetadataProvider::joinFeed()
+{
+    string::size_type len = 0;
+    vector<feed_term_t>::size_type terms = 0;
+    for (vector<feed_fragment_t>::const_iterator f = m_feedFragments.begin(); f != m_feedFragments.end(); ++f) {
+        len += f->m_json.length() + 1;
+        terms += f->m_terms.size();
+    }
+
+    m_feed.erase();
+    m_feed.reserve(len);
+    m_searchIndex.clear();
+    m_searchIndex.reserve(terms);
+    for (vector<feed_fragment_t>::const_iterator f = m_feedFragments.begin(); f != m_feedFragments.end(); ++f) {
+        if (!f->m_json.empty()) {
+            if (!m_feed.empty())
+                m_feed += ',';
+            m_feed += f->m_json;
+            for (vector<feed_term_t>::const_iterator t = f->m_terms.begin(); t != f->m_terms.end(); ++t) {
+                m_searchIndex.push_back(*t);
+                m_searchIndex.back().m_fragment = f - m_feedFragments.begin();
+            }
+        }
+    }
+    sort(m_searchIndex.begin(), m_searchIndex.end());
+
+    // Derive the tag from the content so that an unchanged feed keeps its tag across reloads.
+    m_feedTag = SecurityHelper::doHash("SHA1", m_feed.data(), m_feed.length());
+    m_feedEncoding.reset();
 }
 
 string DiscoverableMetadataProvider::getCacheTag() const
@@ -135,49 +193,294 @@ void DiscoverableMetadataProvider::outputFeed(ostream& os, bool& first, bool wra
         os << "\n]";
 }
 
+const char* DiscoverableMetadataProvider::outputEncodedFeed(ostream& os, const char* acceptEncoding, string& etag) const
+{
+    etag = getCacheTag();
+    const char* coding = FeedEncoding::negotiate(acceptEncoding);
+    if (coding) {
+        getFeedEncoding()->output(os, coding);
+        // Each representation needs its own strong tag.
+        etag = etag + '-' + coding;
+    }
+    else {
+        bool first = true;
+        outputFeed(os, first);
+    }
+    return coding;
+}
+
+boost::shared_ptr<const DiscoverableMetadataProvider::FeedEncoding> DiscoverableMetadataProvider::getFeedEncoding() const
+{
+    Lock lock(m_feedEncodingLock);
+    if (!m_feedEncoding) {
+        ostringstream feed;
+        bool first = true;
+        outputFeed(feed, first);
+        m_feedEncoding.reset(new FeedEncoding(feed.str()));
+    }
+    return m_feedEncoding;
+}
+
+namespace {
+    static const unsigned long crc_nibble[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+
+    unsigned long feed_crc32(const unsigned char* buf, unsigned long len)
+    {
+        unsigned long crc = 0xffffffff;
+        while (len--) {
+            crc ^= *buf++;
+            crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+            crc = (crc >> 4) ^ crc_nibble[crc & 0x0f];
+        }
+        return crc ^ 0xffffffff;
+    }
+
+    unsigned long feed_adler32(const unsigned char* buf, unsigned long len)
+    {
+        unsigned long a = 1, b = 0;
+        while (len > 0) {
+            // Largest block that can't overflow 32 bits before reducing.
+            unsigned long block = len < 5552 ? len : 5552;
+            len -= block;
+            while (block--) {
+                a += *buf++;
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    void write_le32(ostream& os, unsigned long n)
+    {
+        char buf[4] = { (char)(n & 0xff), (char)((n >> 8) & 0xff), (char)((n >> 16) & 0xff), (char)((n >> 24) & 0xff) };
+        os.write(buf, 4);
+    }
+
+    void write_be32(ostream& os, unsigned long n)
+    {
+        char buf[4] = { (char)((n >> 24) & 0xff), (char)((n >> 16) & 0xff), (char)((n >> 8) & 0xff), (char)(n & 0xff) };
+        os.write(buf, 4);
+    }
+
+    // Returns the quality value of a single Accept-Encoding element, or -1 if the coding doesn't match.
+    int coding_quality(const string& element, const char* coding)
+    {
+        string::size_type semi = element.find(';');
+        string name = element.substr(0, semi);
+        trim(name);
+        if (!iequals(name, coding))
+            return -1;
+        if (semi == string::npos)
+            return 1000;
+        string::size_type q = element.find("q=", semi);
+        if (q == string::npos)
+            return 1000;
+        double val = atof(element.c_str() + q + 2);
+        return val <= 0 ? 0 : (val >= 1 ? 1000 : static_cast<int>(val * 1000));
+    }
+}
+
+DiscoverableMetadataProvider::FeedEncoding::FeedEncoding(const string& feed)
+{
+    const unsigned char* buf = reinterpret_cast<const unsigned char*>(feed.data());
+    m_crc = feed_crc32(buf, feed.length());
+    m_adler = feed_adler32(buf, feed.length());
+    m_size = feed.length();
+
+    unsigned int len;
+    char* deflated = XMLHelper::deflate(const_cast<char*>(feed.c_str()), feed.length(), &len);
+    if (!deflated)
+        throw MetadataException("Failed to deflate discovery feed.");
+    m_deflated.assign(deflated, len);
+    delete[] deflated;
+}
+
+DiscoverableMetadataProvider::FeedEncoding::~FeedEncoding()
+{
+}
+
+const char* DiscoverableMetadataProvider::FeedEncoding::negotiate(const char* acceptEncoding)
+{
+    if (!acceptEncoding || !*acceptEncoding)
+        return nullptr;
+
+    // Quality values for gzip, deflate, and identity, with -1 meaning unspecified.
+    static const char* codings[] = { "gzip", "deflate", "identity" };
+    int q[3] = { -1, -1, -1 };
+    int wildcard = -1;
+
+    vector<string> elements;
+    split(elements, acceptEncoding, is_any_of(","), algorithm::token_compress_on);
+    for (vector<string>::const_iterator e = elements.begin(); e != elements.end(); ++e) {
+        int val = coding_quality(*e, "*");
+        if (val >= 0) {
+            wildcard = val;
+            continue;
+        }
+        val = coding_quality(*e, "x-gzip");
+        if (val >= 0)
+            q[0] = max(q[0], val);
+        for (int i = 0; i < 3; ++i) {
+            val = coding_quality(*e, codings[i]);
+            if (val >= 0)
+                q[i] = val;
+        }
+    }
+
+    // Unlisted codings take the wildcard value, except identity, which is acceptable unless refused.
+    for (int i = 0; i < 2; ++i) {
+        if (q[i] < 0)
+            q[i] = max(wildcard, 0);
+    }
+    if (q[2] < 0)
+        q[2] = wildcard == 0 ? 0 : 1;
+
+    // Ties favor the smaller representation.
+    int best = 2;
+    for (int i = 1; i >= 0; --i) {
+        if (q[i] > 0 && q[i] >= q[best])
+            best = i;
+    }
+    return best < 2 ? codings[best] : nullptr;
+}
+
+void DiscoverableMetadataProvider::FeedEncoding::output(ostream& os, const char* coding) const
+{
+    if (coding && !strcmp(coding, "gzip")) {
+        // RFC 1952 member: fixed header with no flags or timestamp, unknown OS.
+        static const char header[] = { '\x1f', '\x8b', '\x08', 0, 0, 0, 0, 0, 0, '\xff' };
+        os.write(header, sizeof(header));
+        os.write(m_deflated.data(), m_deflated.length());
+        write_le32(os, m_crc);
+        write_le32(os, m_size);
+    }
+    else {
+        // RFC 1950 wrapper: 32K window, default compression.
+        os.write("\x78\x9c", 2);
+        os.write(m_deflated.data(), m_deflated.length());
+        write_be32(os, m_adler);
+    }
+}
+
 namespace {
     static string& json_safe(string& s, const char* buf)
     {
+        // Copy each run of characters that need no escaping in one step.
+        const char* run = buf;
         for (; *buf; ++buf) {
+            const char* esc = nullptr;
             switch (*buf) {
                 case '\\':
+                    esc = "\\\\";
+                    break;
                 case '"':
-                    s += '\\';
-                    s += *buf;
+                    esc = "\\\"";
                     break;
                 case '\b':
-                    s += "\\b";
+                    esc = "\\b";
                     break;
                 case '\t':
-                    s += "\\t";
+                    esc = "\\t";
                     break;
                 case '\n':
-                    s += "\\n";
+                    esc = "\\n";
                     break;
                 case '\f':
-                    s += "\\f";
+                    esc = "\\f";
                     break;
                 case '\r':
-                    s += "\\r";
+                    esc = "\\r";
                     break;
                 default:
-                    s += *buf;
+                    continue;
             }
+            s.append(run, buf - run);
+            s.append(esc, 2);
+            run = buf + 1;
         }
+        s.append(run, buf - run);
         return s;
     }
+
+    static string& append_int(string& s, int n)
+    {
+        char buf[16];
+        char* p = buf + sizeof(buf);
+        unsigned int u = n < 0 ? 0u - static_cast<unsigned int>(n) : static_cast<unsigned int>(n);
+        do {
+            *--p = '0' + (u % 10);
+            u /= 10;
+        } while (u);
+        if (n < 0)
+            *--p = '-';
+        s.append(p, buf + sizeof(buf) - p);
+        return s;
+    }
+
+    static const unsigned int SEARCH_WEIGHT_NAME = 8;
+    static const unsigned int SEARCH_WEIGHT_KEYWORD = 4;
+    static const unsigned int SEARCH_WEIGHT_ENTITYID = 2;
+
+    // Splits text into lowercased words at ASCII punctuation and whitespace. Other UTF-8 is kept as is.
+    static void tokenize(const char* text, vector<string>& tokens)
+    {
+        string token;
+        for (; text && *text; ++text) {
+            unsigned char c = *text;
+            if (c >= 0x80 || isalnum(c)) {
+                token += (c < 0x80) ? static_cast<char>(tolower(c)) : *text;
+            }
+            else if (!token.empty()) {
+                tokens.push_back(token);
+                token.erase();
+            }
+        }
+        if (!token.empty())
+            tokens.push_back(token);
+    }
+
+    static bool higher_score(const pair<unsigned int,string>& a, const pair<unsigned int,string>& b)
+    {
+        return a.first > b.first;
+    }
+
+    template <class T> void add_terms(vector<T>& terms, const char* text, const char* lang, unsigned int weight)
+    {
+        vector<string> tokens;
+        tokenize(text, tokens);
+        for (vector<string>::const_iterator t = tokens.begin(); t != tokens.end(); ++t) {
+            // URL schemes and the like would otherwise match nearly every entityID.
+            if (weight == SEARCH_WEIGHT_ENTITYID && (*t == "http" || *t == "https" || *t == "urn" || *t == "www"))
+                continue;
+            bool dup = false;
+            for (typename vector<T>::iterator i = terms.begin(); !dup && i != terms.end(); ++i) {
+                if (i->m_token == *t && i->m_lang == (lang ? lang : "")) {
+                    i->m_weight = max(i->m_weight, weight);
+                    dup = true;
+                }
+            }
+            if (!dup)
+                terms.push_back(T(*t, lang, weight));
+        }
+    }
 };
 
-void DiscoverableMetadataProvider::discoEntity(string& s, const EntityDescriptor* entity, bool& first) const
+void DiscoverableMetadataProvider::discoEntity(string& s, const EntityDescriptor* entity, bool& first, vector<feed_term_t>* terms) const
 {
     time_t now = time(nullptr);
     if (entity && entity->isValid(now)) {
 
-        // Check filter(s).
+        // Check filter(s), using the compiled outcomes if there are any.
+        const vector<bool>* results = m_discoFilterResults->get(*entity);
         for (vector< pair < bool, boost::shared_ptr<EntityMatcher> > >::const_iterator f = m_discoFilters.begin(); f != m_discoFilters.end(); ++f) {
             // The flag is true for an include and false for an exclude,
             // so we omit the entity if the match outcome is the inverse.
-            if (f->first != f->second->matches(*entity))
+            if (f->first != (results ? (*results)[f - m_discoFilters.begin()] : f->second->matches(*entity)))
                 return;
         }
 
@@ -192,137 +495,137 @@ void DiscoverableMetadataProvider::discoEntity(string& s, const EntityDescriptor
             s += "\n{\n \"entityID\": \"";
             json_safe(s, entityid.get());
             s += '\"';
+            if (terms)
+                add_terms(*terms, entityid.get(), nullptr, SEARCH_WEIGHT_ENTITYID);
             bool extFound = false;
             bool displayNameFound = false;
             for (indirect_iterator<vector<IDPSSODescriptor*>::const_iterator> idp = make_indirect_iterator(idps.begin());
                     !extFound && idp != make_indirect_iterator(idps.end()); ++idp) {
-                if (idp->isValid(now) && idp->getExtensions()) {
-                    const vector<XMLObject*>& exts =  const_cast<const Extensions*>(idp->getExtensions())->getUnknownXMLObjects();
-                    for (vector<XMLObject*>::const_iterator ext = exts.begin(); !extFound && ext != exts.end(); ++ext) {
-                        const UIInfo* info = dynamic_cast<UIInfo*>(*ext);
-                        if (info) {
-                            extFound = true;
-                            const vector<DisplayName*>& dispnames = info->getDisplayNames();
-                            if (!dispnames.empty()) {
-                                displayNameFound = true;
-                                s += ",\n \"DisplayNames\": [";
-                                for (indirect_iterator<vector<DisplayName*>::const_iterator> dispname = make_indirect_iterator(dispnames.begin());
-                                        dispname != make_indirect_iterator(dispnames.end()); ++dispname) {
-                                    if (dispname.base() != dispnames.begin())
-                                        s += ',';
-                                    auto_arrayptr<char> val(toUTF8(dispname->getName()));
-                                    auto_ptr_char lang(dispname->getLang());
-                                    s += "\n  {\n  \"value\": \"";
-                                    json_safe(s, val.get());
-                                    s += "\",\n  \"lang\": \"";
-                                    s += lang.get();
-                                    s += "\"\n  }";
-                                }
-                                s += "\n ]";
+                if (idp->isValid(now)) {
+                    const ExtensionIndex* index = getExtensionIndex(*idp);
+                    const UIInfo* info = index ? index->uiInfo : findExtension<UIInfo>(idp->getExtensions());
+                    if (info) {
+                        extFound = true;
+                        const vector<DisplayName*>& dispnames = info->getDisplayNames();
+                        if (!dispnames.empty()) {
+                            displayNameFound = true;
+                            s += ",\n \"DisplayNames\": [";
+                            for (indirect_iterator<vector<DisplayName*>::const_iterator> dispname = make_indirect_iterator(dispnames.begin());
+                                    dispname != make_indirect_iterator(dispnames.end()); ++dispname) {
+                                if (dispname.base() != dispnames.begin())
+                                    s += ',';
+                                auto_arrayptr<char> val(toUTF8(dispname->getName()));
+                                auto_ptr_char lang(dispname->getLang());
+                                s += "\n  {\n  \"value\": \"";
+                                json_safe(s, val.get());
+                                s += "\",\n  \"lang\": \"";
+                                s += lang.get();
+                                s += "\"\n  }";
+                                if (terms)
+                                    add_terms(*terms, val.get(), lang.get(), SEARCH_WEIGHT_NAME);
                             }
+                            s += "\n ]";
+                        }
 
-                            const vector<Description*>& descs = info->getDescriptions();
-                            if (!descs.empty()) {
-                                s += ",\n \"Descriptions\": [";
-                                for (indirect_iterator<vector<Description*>::const_iterator> desc = make_indirect_iterator(descs.begin());
-                                        desc != make_indirect_iterator(descs.end()); ++desc) {
-                                    if (desc.base() != descs.begin())
-                                        s += ',';
-                                    auto_arrayptr<char> val(toUTF8(desc->getDescription()));
-                                    auto_ptr_char lang(desc->getLang());
-                                    s += "\n  {\n  \"value\": \"";
-                                    json_safe(s, val.get());
-                                    s += "\",\n  \"lang\": \"";
-                                    s += lang.get();
-                                    s += "\"\n  }";
-                                }
-                                s += "\n ]";
+                        const vector<Description*>& descs = info->getDescriptions();
+                        if (!descs.empty()) {
+                            s += ",\n \"Descriptions\": [";
+                            for (indirect_iterator<vector<Description*>::const_iterator> desc = make_indirect_iterator(descs.begin());
+                                    desc != make_indirect_iterator(descs.end()); ++desc) {
+                                if (desc.base() != descs.begin())
+                                    s += ',';
+                                auto_arrayptr<char> val(toUTF8(desc->getDescription()));
+                                auto_ptr_char lang(desc->getLang());
+                                s += "\n  {\n  \"value\": \"";
+                                json_safe(s, val.get());
+                                s += "\",\n  \"lang\": \"";
+                                s += lang.get();
+                                s += "\"\n  }";
                             }
+                            s += "\n ]";
+                        }
 
-                            const vector<Keywords*>& keywords = info->getKeywordss();
-                            if (!keywords.empty()) {
-                                s += ",\n \"Keywords\": [";
-                                for (indirect_iterator<vector<Keywords*>::const_iterator> words = make_indirect_iterator(keywords.begin());
-                                        words != make_indirect_iterator(keywords.end()); ++words) {
-                                    if (words.base() != keywords.begin())
-                                        s += ',';
-                                    auto_arrayptr<char> val(toUTF8(words->getValues()));
-                                    auto_ptr_char lang(words->getLang());
-                                    s += "\n  {\n  \"value\": \"";
-                                    json_safe(s, val.get());
-                                    s += "\",\n  \"lang\": \"";
-                                    s += lang.get();
-                                    s += "\"\n  }";
-                                }
-                                s += "\n ]";
+                        const vector<Keywords*>& keywords = info->getKeywordss();
+                        if (!keywords.empty()) {
+                            s += ",\n \"Keywords\": [";
+                            for (indirect_iterator<vector<Keywords*>::const_iterator> words = make_indirect_iterator(keywords.begin());
+                                    words != make_indirect_iterator(keywords.end()); ++words) {
+                                if (words.base() != keywords.begin())
+                                    s += ',';
+                                auto_arrayptr<char> val(toUTF8(words->getValues()));
+                                auto_ptr_char lang(words->getLang());
+                                s += "\n  {\n  \"value\": \"";
+                                json_safe(s, val.get());
+                                s += "\",\n  \"lang\": \"";
+                                s += lang.get();
+                                s += "\"\n  }";
+                                if (terms)
+                                    add_terms(*terms, val.get(), lang.get(), SEARCH_WEIGHT_KEYWORD);
                             }
+                            s += "\n ]";
+                        }
 
-                            const vector<InformationURL*>& infurls = info->getInformationURLs();
-                            if (!infurls.empty()) {
-                                s += ",\n \"InformationURLs\": [";
-                                for (indirect_iterator<vector<InformationURL*>::const_iterator> infurl = make_indirect_iterator(infurls.begin());
-                                        infurl != make_indirect_iterator(infurls.end()); ++infurl) {
-                                    if (infurl.base() != infurls.begin())
-                                        s += ',';
-                                    auto_ptr_char val(infurl->getURL());
-                                    auto_ptr_char lang(infurl->getLang());
-                                    s += "\n  {\n  \"value\": \"";
-                                    json_safe(s, val.get());
-                                    s += "\",\n  \"lang\": \"";
-                                    s += lang.get();
-                                    s += "\"\n  }";
-                                }
-                                s += "\n ]";
+                        const vector<InformationURL*>& infurls = info->getInformationURLs();
+                        if (!infurls.empty()) {
+                            s += ",\n \"InformationURLs\": [";
+                            for (indirect_iterator<vector<InformationURL*>::const_iterator> infurl = make_indirect_iterator(infurls.begin());
+                                    infurl != make_indirect_iterator(infurls.end()); ++infurl) {
+                                if (infurl.base() != infurls.begin())
+                                    s += ',';
+                                auto_ptr_char val(infurl->getURL());
+                                auto_ptr_char lang(infurl->getLang());
+                                s += "\n  {\n  \"value\": \"";
+                                json_safe(s, val.get());
+                                s += "\",\n  \"lang\": \"";
+                                s += lang.get();
+                                s += "\"\n  }";
                             }
+                            s += "\n ]";
+                        }
 
-                            const vector<PrivacyStatementURL*>& privs = info->getPrivacyStatementURLs();
-                            if (!privs.empty()) {
-                                s += ",\n \"PrivacyStatementURLs\": [";
-                                for (indirect_iterator<vector<PrivacyStatementURL*>::const_iterator> priv = make_indirect_iterator(privs.begin());
-                                        priv != make_indirect_iterator(privs.end()); ++priv) {
-                                    if (priv.base() != privs.begin())
-                                        s += ',';
-                                    auto_ptr_char val(priv->getURL());
-                                    auto_ptr_char lang(priv->getLang());
-                                    s += "\n  {\n  \"value\": \"";
-                                    json_safe(s, val.get());
-                                    s += "\",\n  \"lang\": \"";
-                                    s += lang.get();
-                                    s += "\"\n  }";
-                                }
-                                s += "\n ]";
+                        const vector<PrivacyStatementURL*>& privs = info->getPrivacyStatementURLs();
+                        if (!privs.empty()) {
+                            s += ",\n \"PrivacyStatementURLs\": [";
+                            for (indirect_iterator<vector<PrivacyStatementURL*>::const_iterator> priv = make_indirect_iterator(privs.begin());
+                                    priv != make_indirect_iterator(privs.end()); ++priv) {
+                                if (priv.base() != privs.begin())
+                                    s += ',';
+                                auto_ptr_char val(priv->getURL());
+                                auto_ptr_char lang(priv->getLang());
+                                s += "\n  {\n  \"value\": \"";
+                                json_safe(s, val.get());
+                                s += "\",\n  \"lang\": \"";
+                                s += lang.get();
+                                s += "\"\n  }";
                             }
+                            s += "\n ]";
+                        }
 
-                            const vector<Logo*>& logos = info->getLogos();
-                            if (!logos.empty()) {
-                                s += ",\n \"Logos\": [";
-                                for (indirect_iterator<vector<Logo*>::const_iterator> logo = make_indirect_iterator(logos.begin());
-                                        logo != make_indirect_iterator(logos.end()); ++logo) {
-                                    if (logo.base() != logos.begin())
-                                        s += ',';
-                                    s += "\n  {\n";
-                                    auto_ptr_char val(logo->getURL());
-                                    s += "  \"value\": \"";
-                                    json_safe(s, val.get());
-                                    ostringstream ht;
-                                    ht << logo->getHeight().second;
-                                    s += "\",\n  \"height\": \"";
-                                    s += ht.str();
-                                    ostringstream wt;
-                                    wt << logo->getWidth().second;
-                                    s += "\",\n  \"width\": \"";
-                                    s += wt.str();
+                        const vector<Logo*>& logos = info->getLogos();
+                        if (!logos.empty()) {
+                            s += ",\n \"Logos\": [";
+                            for (indirect_iterator<vector<Logo*>::const_iterator> logo = make_indirect_iterator(logos.begin());
+                                    logo != make_indirect_iterator(logos.end()); ++logo) {
+                                if (logo.base() != logos.begin())
+                                    s += ',';
+                                s += "\n  {\n";
+                                auto_ptr_char val(logo->getURL());
+                                s += "  \"value\": \"";
+                                json_safe(s, val.get());
+                                s += "\",\n  \"height\": \"";
+                                append_int(s, logo->getHeight().second);
+                                s += "\",\n  \"width\": \"";
+                                append_int(s, logo->getWidth().second);
+                                s += '\"';
+                                if (logo->getLang()) {
+                                    auto_ptr_char lang(logo->getLang());
+                                    s += ",\n  \"lang\": \"";
+                                    s += lang.get();
                                     s += '\"';
-                                    if (logo->getLang()) {
-                                        auto_ptr_char lang(logo->getLang());
-                                        s += ",\n  \"lang\": \"";
-                                        s += lang.get();
-                                        s += '\"';
-                                    }
-                                    s += "\n  }";
                                 }
-                                s += "\n ]";
+                                s += "\n  }";
                             }
+                            s += "\n ]";
                         }
                     }
                 }
@@ -352,6 +655,8 @@ void DiscoverableMetadataProvider::discoEntity(string& s, const EntityDescriptor
                             s += "\",\n  \"lang\": \"";
                             s += lang.get();
                             s += "\"\n  }";
+                            if (terms)
+                                add_terms(*terms, val.get(), lang.get(), SEARCH_WEIGHT_NAME);
                         }
                         s += "\n ]";
                     }
@@ -361,24 +666,18 @@ void DiscoverableMetadataProvider::discoEntity(string& s, const EntityDescriptor
             if (m_entityAttributes) {
                 bool tagfirst = true;
                 // Check for an EntityAttributes extension in the entity and its parent(s).
-                const Extensions* exts = entity->getExtensions();
-                if (exts) {
-                    const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
-                    const XMLObject* xo = find_if(children, ll_dynamic_cast<EntityAttributes*>(_1) != ((EntityAttributes*)nullptr));
-                    if (xo)
-                        discoEntityAttributes(s, *dynamic_cast<const EntityAttributes*>(xo), tagfirst);
-                }
+                const ExtensionIndex* index = getExtensionIndex(*entity);
+                const EntityAttributes* ea = index ? index->entityAttributes : findExtension<EntityAttributes>(entity->getExtensions());
+                if (ea)
+                    discoEntityAttributes(s, *ea, tagfirst);
 
-                const EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(entity->getParent());
+                const EntitiesDescriptor* group = metadata_cast<EntitiesDescriptor>(entity->getParent());
                 while (group) {
-                    exts = group->getExtensions();
-                    if (exts) {
-                        const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
-                        const XMLObject* xo = find_if(children, ll_dynamic_cast<EntityAttributes*>(_1) != ((EntityAttributes*)nullptr));
-                        if (xo)
-                            discoEntityAttributes(s, *dynamic_cast<const EntityAttributes*>(xo), tagfirst);
-                    }
-                    group = dynamic_cast<EntitiesDescriptor*>(group->getParent());
+                    index = getExtensionIndex(*group);
+                    ea = index ? index->entityAttributes : findExtension<EntityAttributes>(group->getExtensions());
+                    if (ea)
+                        discoEntityAttributes(s, *ea, tagfirst);
+                    group = metadata_cast<EntitiesDescriptor>(group->getParent());
                 }
                 if (!tagfirst)
                     s += "\n ]";
@@ -390,16 +689,16 @@ void DiscoverableMetadataProvider::discoEntity(string& s, const EntityDescriptor
     }
 }
 
-void DiscoverableMetadataProvider::discoGroup(string& s, const EntitiesDescriptor* group, bool& first) const
+void DiscoverableMetadataProvider::discoGroup(const EntitiesDescriptor* group)
 {
     if (group) {
         for_each(
             group->getEntitiesDescriptors().begin(), group->getEntitiesDescriptors().end(),
-            lambda::bind(&DiscoverableMetadataProvider::discoGroup, this, boost::ref(s), _1, boost::ref(first))
+            lambda::bind(&DiscoverableMetadataProvider::discoGroup, this, _1)
             );
         for_each(
             group->getEntityDescriptors().begin(), group->getEntityDescriptors().end(),
-            lambda::bind(&DiscoverableMetadataProvider::discoEntity, this, boost::ref(s), _1, boost::ref(first))
+            lambda::bind(&DiscoverableMetadataProvider::discoFragment, this, _1)
             );
     }
 }
@@ -447,3 +746,78 @@ void DiscoverableMetadataProvider::discoAttributes(std::string& s, const vector<
         s += "\n  ]\n  }";
     }
 }
+
+void DiscoverableMetadataProvider::search(
+    const char* query, const char* lang, unsigned int maxResults, vector< pair<unsigned int,string> >& results
+    ) const
+{
+    vector<string> tokens;
+    tokenize(query, tokens);
+    if (tokens.empty() || maxResults == 0)
+        return;
+
+    // Score each fragment by its best term for every query word, dropping any fragment that misses a word.
+    map<unsigned int,unsigned int> scores;
+    for (vector<string>::const_iterator t = tokens.begin(); t != tokens.end(); ++t) {
+        map<unsigned int,unsigned int> hits;
+        for (vector<feed_term_t>::const_iterator term = lower_bound(m_searchIndex.begin(), m_searchIndex.end(), feed_term_t(*t, nullptr, 0));
+                term != m_searchIndex.end() && term->m_token.compare(0, t->length(), *t) == 0; ++term) {
+            if (t != tokens.begin() && scores.count(term->m_fragment) == 0)
+                continue;
+            unsigned int score = term->m_weight;
+            if (term->m_token.length() == t->length())
+                score += 2;
+            if (lang && term->m_lang == lang)
+                score += 1;
+            unsigned int& best = hits[term->m_fragment];
+            best = max(best, score);
+        }
+
+        if (t == tokens.begin()) {
+            scores.swap(hits);
+        }
+        else {
+            for (map<unsigned int,unsigned int>::iterator s = scores.begin(); s != scores.end();) {
+                map<unsigned int,unsigned int>::const_iterator h = hits.find(s->first);
+                if (h == hits.end()) {
+                    scores.erase(s++);
+                }
+                else {
+                    s->second += h->second;
+                    ++s;
+                }
+            }
+        }
+        if (scores.empty())
+            return;
+    }
+
+    // Highest score first, then document order.
+    vector< pair<unsigned int,unsigned int> > ranked;
+    ranked.reserve(scores.size());
+    for (map<unsigned int,unsigned int>::const_iterator s = scores.begin(); s != scores.end(); ++s)
+        ranked.push_back(make_pair(UINT_MAX - s->second, s->first));
+    vector< pair<unsigned int,unsigned int> >::iterator last = ranked.begin() + min<size_t>(maxResults, ranked.size());
+    partial_sort(ranked.begin(), last, ranked.end());
+    for (vector< pair<unsigned int,unsigned int> >::const_iterator r = ranked.begin(); r != last; ++r)
+        results.push_back(make_pair(UINT_MAX - r->first, m_feedFragments[r->second].m_json));
+}
+
+unsigned int DiscoverableMetadataProvider::outputSearch(ostream& os, const char* query, const char* lang, unsigned int maxResults) const
+{
+    vector< pair<unsigned int,string> > results;
+    search(query, lang, maxResults, results);
+    // Results may be merged from several sources, so keep the best overall.
+    stable_sort(results.begin(), results.end(), higher_score);
+    if (results.size() > maxResults)
+        results.resize(maxResults);
+
+    os << '[';
+    for (vector< pair<unsigned int,string> >::const_iterator r = results.begin(); r != results.end(); ++r) {
+        if (r != results.begin())
+            os << ',';
+        os << r->second;
+    }
+    os << "\n]";
+    return results.size();
+}
@@ -31,9 +31,6 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/iterator/indirect_iterator.hpp>
-#include <boost/lambda/bind.hpp>
-#include <boost/lambda/casts.hpp>
-#include <boost/lambda/lambda.hpp>
 #include <xercesc/util/XMLUniDefs.hpp>
 #include <xercesc/util/regx/RegularExpression.hpp>
 #include <xmltooling/logging.h>
@@ -44,7 +41,6 @@ using namespace opensaml::saml2;
 using namespace opensaml;
 using namespace xmltooling::logging;
 using namespace xmltooling;
-using namespace boost::lambda;
 using namespace boost;
 using namespace std;
 
@@ -57,13 +53,36 @@ namespace opensaml {
             ~EntityAttributesEntityMatcher() {}
 
             bool matches(const EntityDescriptor& entity) const;
+            bool matchesGroup(const EntitiesDescriptor& group) const {
+                return _matches(group.getExtensions());
+            }
+            bool matchesIgnoringGroups(const EntityDescriptor& entity) const {
+                return _matches(entity.getExtensions());
+            }
 
         private:
-            bool _matches(const EntityAttributes*, const Attribute*) const;
+            bool _matches(const Extensions*) const;
+            bool _matches(const EntityAttributes*) const;
 
             bool m_trimTags;
             vector< boost::shared_ptr<Attribute> > m_tags;
             Category& m_log;
+
+            // Each tag value is compiled once, either as a regex or as an entry in the literal map.
+            struct tag_t {
+                tag_t(const Attribute* attribute, vector<bool>::size_type offset);
+                const Attribute* m_attribute;
+                bool m_anyFormat;
+                vector<bool>::size_type m_offset;
+                vector< boost::shared_ptr<RegularExpression> > m_regexes;
+            };
+            vector<tag_t> m_compiled;
+            vector<bool>::size_type m_valueCount;
+
+            // Literal tag values keyed by attribute Name and value, pointing at a tag and its value's flag.
+            typedef multimap< pair<xstring,xstring>, pair<vector<tag_t>::size_type,vector<bool>::size_type> > literalmap_t;
+            literalmap_t m_literals;
+            bool m_hasRegex;
         };
 
         EntityMatcher* SAML_DLLLOCAL EntityAttributesEntityMatcherFactory(const DOMElement* const & e, bool deprecationSupport)
@@ -113,133 +132,152 @@ EntityAttributesEntityMatcher::EntityAttributesEntityMatcher(const DOMElement* e
 
     if (m_tags.empty())
         throw XMLToolingException("EntityAttributes EntityMatcher requires at least one saml2:Attribute to match.");
-}
 
-bool EntityAttributesEntityMatcher::matches(const EntityDescriptor& entity) const
-{
-    bool extFound = false;
-
-    // Check for a tag match in the EntityAttributes extension of the entity and its parent(s).
-    const Extensions* exts = entity.getExtensions();
-    if (exts) {
-        const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
-        const XMLObject* xo = find_if(children, ll_dynamic_cast<EntityAttributes*>(_1) != ((EntityAttributes*)nullptr));
-        if (xo) {
-            extFound = true;
-            // If we find a matching tag, we win. Each tag is treated in OR fashion.
-           for (vector< boost::shared_ptr<Attribute> >::const_iterator i = m_tags.begin(); i != m_tags.end(); ++i) {
-                if (_matches(dynamic_cast<const EntityAttributes*>(xo), i->get())) {
-                   return true;
-               }
-           }
-        }
-    }
+    xmltooling::QName regexQName(nullptr, regex);
+    m_valueCount = 0;
+    m_hasRegex = false;
+    for (vector< boost::shared_ptr<Attribute> >::const_iterator t = m_tags.begin(); t != m_tags.end(); ++t) {
+        const vector<XMLObject*>& tagvals = const_cast<const Attribute*>(t->get())->getAttributeValues();
+        m_compiled.push_back(tag_t(t->get(), m_valueCount));
+        tag_t& tag = m_compiled.back();
+        for (vector<XMLObject*>::size_type tagindex = 0; tagindex < tagvals.size(); ++tagindex) {
+            const XMLObject* tagval = tagvals[tagindex];
+            const XMLCh* tagvalstr = tagval->getTextContent();
+            tag.m_regexes.push_back(boost::shared_ptr<RegularExpression>());
 
-    const EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(entity.getParent());
-    while (group) {
-        exts = group->getExtensions();
-        if (exts) {
-            const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
-            const XMLObject* xo = find_if(children, ll_dynamic_cast<EntityAttributes*>(_1) != ((EntityAttributes*)nullptr));
-            if (xo) {
-                extFound = true;
-                // If we find a matching tag, we win. Each tag is treated in OR fashion.
-               for (vector< boost::shared_ptr<Attribute> >::const_iterator i = m_tags.begin(); i != m_tags.end(); ++i) {
-                    if (_matches(dynamic_cast<const EntityAttributes*>(xo), i->get())) {
-                        return true;
+            // Check for a regex flag.
+            if (tagvalstr && dynamic_cast<const AttributeExtensibleXMLObject*>(tagval)) {
+                const XMLCh* reflag = dynamic_cast<const AttributeExtensibleXMLObject*>(tagval)->getAttribute(regexQName);
+                if (reflag && (*reflag == chDigit_1 || *reflag == chLatin_t)) {
+                    try {
+                        tag.m_regexes.back().reset(new RegularExpression(tagvalstr));
+                        m_hasRegex = true;
                     }
-               }
+                    catch (XMLException& ex) {
+                        auto_ptr_char msg(ex.getMessage());
+                        m_log.error(msg.get());
+                    }
+                }
+            }
+
+            // A value that isn't a usable regex is compared literally.
+            if (tagvalstr && (*t)->getName() && !tag.m_regexes.back()) {
+                m_literals.insert(
+                    literalmap_t::value_type(make_pair(xstring((*t)->getName()), xstring(tagvalstr)), make_pair(m_compiled.size() - 1, m_valueCount + tagindex))
+                    );
             }
         }
-        group = dynamic_cast<EntitiesDescriptor*>(group->getParent());
+        m_valueCount += tagvals.size();
     }
+}
+
+EntityAttributesEntityMatcher::tag_t::tag_t(const Attribute* attribute, vector<bool>::size_type offset)
+    : m_attribute(attribute),
+        m_anyFormat(!attribute->getNameFormat() || XMLString::equals(attribute->getNameFormat(), Attribute::UNSPECIFIED)),
+        m_offset(offset)
+{
+}
+
+bool EntityAttributesEntityMatcher::matches(const EntityDescriptor& entity) const
+{
+    if (matchesWithGroups(entity))
+        return true;
 
-    if (!extFound && m_log.isDebugEnabled()) {
-        auto_ptr_char id (entity.getEntityID());
-        m_log.debug("no EntityAttributes extension found for (%s)", id.get());
+    if (m_log.isDebugEnabled()) {
+        bool extFound = findExtension<EntityAttributes>(entity.getExtensions()) != nullptr;
+        const EntitiesDescriptor* group = metadata_cast<EntitiesDescriptor>(entity.getParent());
+        while (group && !extFound) {
+            extFound = findExtension<EntityAttributes>(group->getExtensions()) != nullptr;
+            group = metadata_cast<EntitiesDescriptor>(group->getParent());
+        }
+        if (!extFound) {
+            auto_ptr_char id (entity.getEntityID());
+            m_log.debug("no EntityAttributes extension found for (%s)", id.get());
+        }
     }
 
     return false;
 }
 
-bool EntityAttributesEntityMatcher::_matches(const EntityAttributes* ea, const Attribute* tag) const
+bool EntityAttributesEntityMatcher::_matches(const Extensions* exts) const
+{
+    // If we find a matching tag, we win. Each tag is treated in OR fashion.
+    const EntityAttributes* ea = findExtension<EntityAttributes>(exts);
+    return ea ? _matches(ea) : false;
+}
+
+bool EntityAttributesEntityMatcher::_matches(const EntityAttributes* ea) const
 {
     const vector<Attribute*>& attrs = ea->getAttributes();
-    const vector<XMLObject*>& tagvals = tag->getAttributeValues();
-    if (!attrs.empty() && !tagvals.empty()) {
-        // Track whether we've found every tag value.
-        vector<bool> flags(tagvals.size());
-
-        // Holds the active regex, if any.
-        scoped_ptr<RegularExpression> re;
-        xmltooling::QName regexQName(nullptr, regex);
-
-        // Check each attribute/tag in the candidate.
-        for (indirect_iterator<vector<Attribute*>::const_iterator> a = make_indirect_iterator(attrs.begin());
-                a != make_indirect_iterator(attrs.end()); ++a) {
-            // Compare Name and NameFormat for a matching tag.
-            if (XMLString::equals(a->getName(), tag->getName()) &&
-                (!tag->getNameFormat() || XMLString::equals(tag->getNameFormat(), Attribute::UNSPECIFIED) ||
-                    XMLString::equals(tag->getNameFormat(), a->getNameFormat()))) {
-
-                // Check each tag value's simple content for a match.
-                for (vector<XMLObject*>::size_type tagindex = 0; tagindex < tagvals.size(); ++tagindex) {
-                    const XMLObject* tagval = tagvals[tagindex];
-                    const XMLCh* tagvalstr = tagval->getTextContent();
-                    re.reset();
-
-                    // Check for a regex flag.
-                    if (dynamic_cast<const AttributeExtensibleXMLObject*>(tagval)) {
-                        const XMLCh* reflag = dynamic_cast<const AttributeExtensibleXMLObject*>(tagval)->getAttribute(regexQName);
-                        if (reflag && (*reflag == chDigit_1 || *reflag == chLatin_t)) {
-                            try {
-                                re.reset(new RegularExpression(tagvalstr));
-                            }
-                            catch (XMLException& ex) {
-                                auto_ptr_char msg(ex.getMessage());
-                                m_log.error(msg.get());
-                            }
+    if (attrs.empty())
+        return false;
+
+    // Track which tag values have been found, across all the tags at once.
+    vector<bool> flags(m_valueCount);
+
+    // Check each attribute/tag in the candidate.
+    for (indirect_iterator<vector<Attribute*>::const_iterator> a = make_indirect_iterator(attrs.begin());
+            a != make_indirect_iterator(attrs.end()); ++a) {
+        if (!a->getName())
+            continue;
+
+        const vector<XMLObject*>& cvals = const_cast<const Attribute&>(*a).getAttributeValues();
+        for (indirect_iterator<vector<XMLObject*>::const_iterator> cval = make_indirect_iterator(cvals.begin());
+                cval != make_indirect_iterator(cvals.end()); ++cval) {
+            const XMLCh* cvalstr = cval->getTextContent();
+            if (!cvalstr)
+                continue;
+
+            // Literal values are found by lookup, and NameFormat is checked on a hit.
+            pair<xstring,xstring> key(a->getName(), cvalstr);
+            for (int pass = 0; pass < 2; ++pass) {
+                if (pass == 1) {
+                    // Only look again if trimming actually changes the candidate value.
+                    if (!m_trimTags)
+                        break;
+                    XMLCh* dup = XMLString::replicate(cvalstr);
+                    XMLString::trim(dup);
+                    bool same = (key.second == dup);
+                    key.second = dup;
+                    XMLString::release(&dup);
+                    if (same)
+                        break;
+                }
+                pair<literalmap_t::const_iterator,literalmap_t::const_iterator> hits = m_literals.equal_range(key);
+                for (; hits.first != hits.second; ++hits.first) {
+                    const tag_t& tag = m_compiled[hits.first->second.first];
+                    if (tag.m_anyFormat || XMLString::equals(tag.m_attribute->getNameFormat(), a->getNameFormat()))
+                        flags[hits.first->second.second] = true;
+                }
+            }
+
+            if (!m_hasRegex)
+                continue;
+
+            for (vector<tag_t>::const_iterator tag = m_compiled.begin(); tag != m_compiled.end(); ++tag) {
+                if (!XMLString::equals(a->getName(), tag->m_attribute->getName()) ||
+                        !(tag->m_anyFormat || XMLString::equals(tag->m_attribute->getNameFormat(), a->getNameFormat())))
+                    continue;
+                for (vector< boost::shared_ptr<RegularExpression> >::size_type i = 0; i < tag->m_regexes.size(); ++i) {
+                    if (tag->m_regexes[i] && !flags[tag->m_offset + i]) {
+                        try {
+                            if (tag->m_regexes[i]->matches(cvalstr))
+                                flags[tag->m_offset + i] = true;
                         }
-                    }
-                    
-                    const vector<XMLObject*>& cvals = const_cast<const Attribute&>(*a).getAttributeValues();
-                    for (indirect_iterator<vector<XMLObject*>::const_iterator> cval = make_indirect_iterator(cvals.begin());
-                            cval != make_indirect_iterator(cvals.end()); ++cval) {
-                        const XMLCh* cvalstr = cval->getTextContent();
-                        if (tagvalstr && cvalstr) {
-                            if (re) {
-                                try {
-                                    if (re->matches(cvalstr)) {
-                                        flags[tagindex] = true;
-                                        break;
-                                    }
-                                }
-                                catch (XMLException& ex) {
-                                    auto_ptr_char msg(ex.getMessage());
-                                    m_log.error(msg.get());
-                                }
-                            }
-                            else if (XMLString::equals(tagvalstr, cvalstr)) {
-                                flags[tagindex] = true;
-                                break;
-                            }
-                            else if (m_trimTags) {
-                                XMLCh* dup = XMLString::replicate(cvalstr);
-                                XMLString::trim(dup);
-                                if (XMLString::equals(tagvalstr, dup)) {
-                                    XMLString::release(&dup);
-                                    flags[tagindex] = true;
-                                    break;
-                                }
-                                XMLString::release(&dup);
-                            }
+                        catch (XMLException& ex) {
+                            auto_ptr_char msg(ex.getMessage());
+                            m_log.error(msg.get());
                         }
                     }
                 }
             }
         }
+    }
 
-        if (find(flags.begin(), flags.end(), false) == flags.end())
+    // A tag matches once every one of its values has been found.
+    for (vector<tag_t>::const_iterator tag = m_compiled.begin(); tag != m_compiled.end(); ++tag) {
+        if (!tag->m_regexes.empty() &&
+                find(flags.begin() + tag->m_offset, flags.begin() + tag->m_offset + tag->m_regexes.size(), false) == flags.begin() + tag->m_offset + tag->m_regexes.size())
             return true;
     }
     return false;
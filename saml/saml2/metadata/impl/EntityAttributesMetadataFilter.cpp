@@ -28,46 +28,56 @@
 #include "saml2/metadata/Metadata.h"
 #include "saml2/metadata/MetadataFilter.h"
 
-#include <boost/lambda/bind.hpp>
-#include <boost/lambda/casts.hpp>
-#include <boost/lambda/lambda.hpp>
+#include <deque>
 #include <boost/shared_ptr.hpp>
 #include <boost/iterator/indirect_iterator.hpp>
 #include <xmltooling/logging.h>
 
+#include <xercesc/util/XMLUniDefs.hpp>
 #include <xercesc/util/regx/RegularExpression.hpp>
 
 using namespace opensaml::saml2;
 using namespace opensaml::saml2md;
 using namespace xmltooling::logging;
 using namespace xmltooling;
-using namespace boost::lambda;
 using namespace boost;
 using namespace std;
 
 namespace opensaml {
     namespace saml2md {
 
-        class SAML_DLLLOCAL EntityAttributesMetadataFilter : public MetadataFilter
+        class SAML_DLLLOCAL EntityAttributesMetadataFilter : public EntityMetadataFilter
         {
         public:
             EntityAttributesMetadataFilter(const DOMElement* e);
             ~EntityAttributesMetadataFilter() {}
 
             const char* getId() const { return ENTITYATTR_METADATA_FILTER; }
-            void doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const;
+            bool filterEntity(const MetadataFilterContext* ctx, EntityDescriptor& entity) const;
 
         private:
-            void filterEntity(EntityDescriptor* entity) const;
-            void filterGroup(EntitiesDescriptor* entities) const;
             EntityAttributes* getEntityAttributes(EntityDescriptor* entity) const;
 
             Category& m_log;
             vector< boost::shared_ptr<Attribute> > m_attributes;
             typedef multimap<xstring,const Attribute*> applymap_t;
-            typedef map< boost::shared_ptr<RegularExpression>,vector<const Attribute*> > regexmap_t;
+            typedef vector< pair< boost::shared_ptr<RegularExpression>,vector<const Attribute*> > > regexmap_t;
             applymap_t m_applyMap;
             regexmap_t m_regexMap;
+
+            // Aho-Corasick automaton over the literal text each regex requires, so that an
+            // entityID is scanned once to find the only expressions that could match it.
+            struct literal_node_t {
+                literal_node_t() : m_fail(0) {}
+                map<XMLCh,unsigned int> m_next;
+                unsigned int m_fail;
+                vector<regexmap_t::size_type> m_rules;
+            };
+            void addLiteral(const xstring& literal, regexmap_t::size_type rule);
+            void linkLiterals();
+
+            vector<literal_node_t> m_literals;
+            vector<regexmap_t::size_type> m_unfiltered;
         };
 
         MetadataFilter* SAML_DLLLOCAL EntityAttributesMetadataFilterFactory(const DOMElement* const & e, bool)
@@ -78,12 +88,123 @@ namespace opensaml {
         static const XMLCh Entity[] =       UNICODE_LITERAL_6(E,n,t,i,t,y);
         static const XMLCh EntityRegex[] =  UNICODE_LITERAL_11(E,n,t,i,t,y,R,e,g,e,x);
 
+        // Given an opening parenthesis or bracket, returns the character that closes it, or null.
+        static const XMLCh* skipNested(const XMLCh* p)
+        {
+            int parens = 0, brackets = 0;
+            for (; *p; ++p) {
+                if (*p == chBackSlash) {
+                    if (!*++p)
+                        return nullptr;
+                    continue;
+                }
+                if (*p == chOpenSquare)
+                    ++brackets;
+                else if (*p == chCloseSquare)
+                    --brackets;
+                else if (brackets == 0 && *p == chOpenParen)
+                    ++parens;
+                else if (brackets == 0 && *p == chCloseParen)
+                    --parens;
+                if (parens == 0 && brackets == 0)
+                    return p;
+            }
+            return nullptr;
+        }
+
+        // Drops the last character of a literal run, along with the lead half of a surrogate pair.
+        static void dropLast(xstring& run)
+        {
+            if (!run.empty())
+                run.erase(run.length() - 1);
+            if (!run.empty() && run[run.length() - 1] >= 0xD800 && run[run.length() - 1] <= 0xDBFF)
+                run.erase(run.length() - 1);
+        }
+
+        /**
+         * Returns the longest run of literal text that any match of an expression must contain.
+         * Anything the parse isn't sure of yields an empty string, meaning the expression
+         * always has to be run. That includes any (? group, since modifiers such as (?i)
+         * change how the rest of the expression matches.
+         */
+        static xstring requiredLiteral(const XMLCh* exp)
+        {
+            for (const XMLCh* p = exp; *p; ++p) {
+                if (*p == chBackSlash) {
+                    if (!*++p)
+                        return xstring();
+                }
+                else if (*p == chOpenParen && *(p + 1) == chQuestion) {
+                    return xstring();
+                }
+            }
+
+            xstring best, run;
+            for (const XMLCh* p = exp; *p; ++p) {
+                switch (*p) {
+                    case chPipe:
+                    case chCloseParen:
+                    case chCloseSquare:
+                    case chCloseCurly:
+                        // Top-level alternation leaves nothing required, and a stray close is a mystery.
+                        return xstring();
+
+                    case chOpenParen:
+                    case chOpenSquare:
+                        if (run.length() > best.length())
+                            best = run;
+                        run.erase();
+                        p = skipNested(p);
+                        if (!p)
+                            return xstring();
+                        break;
+
+                    case chOpenCurly:
+                        // A bounded quantifier may allow zero occurrences, so give up the preceding atom.
+                        dropLast(run);
+                        if (run.length() > best.length())
+                            best = run;
+                        run.erase();
+                        while (*p && *p != chCloseCurly)
+                            ++p;
+                        if (!*p)
+                            return xstring();
+                        break;
+
+                    case chAsterisk:
+                    case chQuestion:
+                        dropLast(run);
+                        // fall through
+                    case chPlus:
+                    case chPeriod:
+                    case chCaret:
+                    case chDollarSign:
+                        if (run.length() > best.length())
+                            best = run;
+                        run.erase();
+                        break;
+
+                    case chBackSlash:
+                        if (!*++p)
+                            return xstring();
+                        // Class, code point and back reference escapes can't be told apart from what follows them.
+                        if ((*p >= chLatin_a && *p <= chLatin_z) || (*p >= chLatin_A && *p <= chLatin_Z) || (*p >= chDigit_0 && *p <= chDigit_9))
+                            return xstring();
+                        run += *p;
+                        break;
+
+                    default:
+                        run += *p;
+                }
+            }
+            return run.length() > best.length() ? run : best;
+        }
     };
 };
 
 
 EntityAttributesMetadataFilter::EntityAttributesMetadataFilter(const DOMElement* e)
-    : m_log(Category::getInstance(SAML_LOGCAT".MetadataFilter.EntityAttributes"))
+    : m_log(Category::getInstance(SAML_LOGCAT".MetadataFilter.EntityAttributes")), m_literals(1)
 {
     // Contains ordered set of Attribute and Entity elements.
     // We track each Attribute we find, and then consume an Entity by adding.
@@ -92,6 +213,8 @@ EntityAttributesMetadataFilter::EntityAttributesMetadataFilter(const DOMElement*
     while (child) {
         if (XMLHelper::isNodeNamed(child, samlconstants::SAML20_NS, Attribute::LOCAL_NAME)) {
             boost::shared_ptr<XMLObject> obj(AttributeBuilder::buildOneFromElement(child));
+            // Without a DOM to clone, each copy is made directly from the object tree.
+            obj->releaseThisAndChildrenDOM();
             m_attributes.push_back(boost::dynamic_pointer_cast<Attribute>(obj));
         }
         else if (XMLString::equals(child->getLocalName(), Entity)) {
@@ -107,9 +230,16 @@ EntityAttributesMetadataFilter::EntityAttributesMetadataFilter(const DOMElement*
                 boost::shared_ptr<RegularExpression> regexp;
                 try {
                     regexp.reset(new RegularExpression(exp));
-                    vector<const Attribute*>& tags = m_regexMap[regexp];
+                    m_regexMap.push_back(make_pair(regexp, vector<const Attribute*>()));
+                    vector<const Attribute*>& tags = m_regexMap.back().second;
                     for (vector< boost::shared_ptr<Attribute> >::const_iterator a = m_attributes.begin(); a != m_attributes.end(); ++a)
                         tags.push_back(a->get());
+
+                    xstring literal = requiredLiteral(exp);
+                    if (literal.empty())
+                        m_unfiltered.push_back(m_regexMap.size() - 1);
+                    else
+                        addLiteral(literal, m_regexMap.size() - 1);
                 }
                 catch (XMLException& ex) {
                     auto_ptr_char msg(ex.getMessage());
@@ -119,42 +249,65 @@ EntityAttributesMetadataFilter::EntityAttributesMetadataFilter(const DOMElement*
         }
         child = XMLHelper::getNextSiblingElement(child);
     }
+
+    linkLiterals();
+    if (!m_regexMap.empty()) {
+        m_log.debug(
+            "prefiltering %u of %u entity expression(s) on literal text",
+            static_cast<unsigned int>(m_regexMap.size() - m_unfiltered.size()), static_cast<unsigned int>(m_regexMap.size())
+            );
+    }
 }
 
-void EntityAttributesMetadataFilter::doFilter(const MetadataFilterContext*, XMLObject& xmlObject) const
+void EntityAttributesMetadataFilter::addLiteral(const xstring& literal, regexmap_t::size_type rule)
 {
-    EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(&xmlObject);
-    if (group) {
-        filterGroup(group);
-    }
-    else {
-        EntityDescriptor* entity = dynamic_cast<EntityDescriptor*>(&xmlObject);
-        if (entity) {
-            filterEntity(entity);
+    unsigned int node = 0;
+    for (xstring::const_iterator c = literal.begin(); c != literal.end(); ++c) {
+        map<XMLCh,unsigned int>::const_iterator next = m_literals[node].m_next.find(*c);
+        if (next == m_literals[node].m_next.end()) {
+            m_literals.push_back(literal_node_t());
+            m_literals[node].m_next[*c] = m_literals.size() - 1;
+            node = m_literals.size() - 1;
         }
         else {
-            throw MetadataFilterException(ENTITYATTR_METADATA_FILTER " MetadataFilter was given an improper metadata instance to filter.");
+            node = next->second;
         }
     }
+    m_literals[node].m_rules.push_back(rule);
 }
 
-void EntityAttributesMetadataFilter::filterGroup(EntitiesDescriptor* entities) const
+void EntityAttributesMetadataFilter::linkLiterals()
 {
-    const vector<EntityDescriptor*>& v = const_cast<const EntitiesDescriptor*>(entities)->getEntityDescriptors();
-    for_each(v.begin(), v.end(), lambda::bind(&EntityAttributesMetadataFilter::filterEntity, this, _1));
-
-    const vector<EntitiesDescriptor*>& v2 = const_cast<const EntitiesDescriptor*>(entities)->getEntitiesDescriptors();
-    for_each(v2.begin(), v2.end(), lambda::bind(&EntityAttributesMetadataFilter::filterGroup, this, _1));
+    // Breadth-first, so that a node's failure link is complete before its children need it.
+    deque<unsigned int> queue(1, 0);
+    while (!queue.empty()) {
+        unsigned int node = queue.front();
+        queue.pop_front();
+        for (map<XMLCh,unsigned int>::const_iterator child = m_literals[node].m_next.begin(); child != m_literals[node].m_next.end(); ++child) {
+            if (node > 0) {
+                unsigned int fail = m_literals[node].m_fail;
+                map<XMLCh,unsigned int>::const_iterator next;
+                while ((next = m_literals[fail].m_next.find(child->first)) == m_literals[fail].m_next.end() && fail > 0)
+                    fail = m_literals[fail].m_fail;
+                if (next != m_literals[fail].m_next.end())
+                    m_literals[child->second].m_fail = next->second;
+                // Anything reached through the failure link is a suffix of this match too.
+                const vector<regexmap_t::size_type>& inherited = m_literals[m_literals[child->second].m_fail].m_rules;
+                m_literals[child->second].m_rules.insert(m_literals[child->second].m_rules.end(), inherited.begin(), inherited.end());
+            }
+            queue.push_back(child->second);
+        }
+    }
 }
 
-void EntityAttributesMetadataFilter::filterEntity(EntityDescriptor* entity) const
+bool EntityAttributesMetadataFilter::filterEntity(const MetadataFilterContext*, EntityDescriptor& entity) const
 {
-    if (!entity->getEntityID())
-        return;
+    if (!entity.getEntityID())
+        return false;
     
-    pair<applymap_t::const_iterator,applymap_t::const_iterator> tags = m_applyMap.equal_range(entity->getEntityID());
+    pair<applymap_t::const_iterator,applymap_t::const_iterator> tags = m_applyMap.equal_range(entity.getEntityID());
     if (tags.first != tags.second) {
-        EntityAttributes* wrapper = getEntityAttributes(entity);
+        EntityAttributes* wrapper = getEntityAttributes(&entity);
         VectorOf(Attribute) attrs = wrapper->getAttributes();
         for (; tags.first != tags.second; ++tags.first) {
             auto_ptr<Attribute> np(tags.first->second->cloneAttribute());
@@ -163,10 +316,31 @@ void EntityAttributesMetadataFilter::filterEntity(EntityDescriptor* entity) cons
         }
     }
 
+    if (m_regexMap.empty())
+        return false;
+
+    // Find the expressions whose required text appears in the entityID.
+    vector<bool> candidates(m_regexMap.size());
+    for (vector<regexmap_t::size_type>::const_iterator u = m_unfiltered.begin(); u != m_unfiltered.end(); ++u)
+        candidates[*u] = true;
+    unsigned int node = 0;
+    for (const XMLCh* c = entity.getEntityID(); *c; ++c) {
+        map<XMLCh,unsigned int>::const_iterator next;
+        while ((next = m_literals[node].m_next.find(*c)) == m_literals[node].m_next.end() && node > 0)
+            node = m_literals[node].m_fail;
+        if (next != m_literals[node].m_next.end()) {
+            node = next->second;
+            for (vector<regexmap_t::size_type>::const_iterator r = m_literals[node].m_rules.begin(); r != m_literals[node].m_rules.end(); ++r)
+                candidates[*r] = true;
+        }
+    }
+
     for (regexmap_t::const_iterator i = m_regexMap.begin(); i != m_regexMap.end(); ++i) {
+        if (!candidates[i - m_regexMap.begin()])
+            continue;
         try {
-            if (i->first->matches(entity->getEntityID())) {
-                EntityAttributes* wrapper = getEntityAttributes(entity);
+            if (i->first->matches(entity.getEntityID())) {
+                EntityAttributes* wrapper = getEntityAttributes(&entity);
                 VectorOf(Attribute) attrs = wrapper->getAttributes();
                 for (vector<const Attribute*>::const_iterator a = i->second.begin(); a != i->second.end(); ++a) {
                     auto_ptr<Attribute> np((*a)->cloneAttribute());
@@ -180,6 +354,7 @@ void EntityAttributesMetadataFilter::filterEntity(EntityDescriptor* entity) cons
             m_log.error(msg.get());
         }
     }
+    return false;
 }
 
 EntityAttributes* EntityAttributesMetadataFilter::getEntityAttributes(EntityDescriptor* entity) const
@@ -189,13 +364,8 @@ EntityAttributes* EntityAttributesMetadataFilter::getEntityAttributes(EntityDesc
         entity->setExtensions(ExtensionsBuilder::buildExtensions());
         exts = entity->getExtensions();
     }
-    EntityAttributes* wrapper = nullptr;
-    const vector<XMLObject*>& children = const_cast<const Extensions*>(exts)->getUnknownXMLObjects();
-    XMLObject* xo = find_if(children, ll_dynamic_cast<EntityAttributes*>(_1) != ((EntityAttributes*)nullptr));
-    if (xo) {
-        wrapper = dynamic_cast<EntityAttributes*>(xo);
-    }
-    else {
+    EntityAttributes* wrapper = findExtension<EntityAttributes>(exts);
+    if (!wrapper) {
         wrapper = EntityAttributesBuilder::buildEntityAttributes();
         exts->getUnknownXMLObjects().push_back(wrapper);
     }
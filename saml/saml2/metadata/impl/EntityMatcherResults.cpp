@@ -0,0 +1,98 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+/**
+ * EntityMatcherResults.cpp
+ *
+ * Outcomes of a set of EntityMatchers compiled against a metadata tree.
+ */
+
+#include "internal.h"
+#include "saml2/metadata/EntityMatcher.h"
+#include "saml2/metadata/Metadata.h"
+
+using namespace opensaml::saml2md;
+using namespace xmltooling;
+using namespace std;
+
+EntityMatcherResults::EntityMatcherResults()
+{
+}
+
+EntityMatcherResults::~EntityMatcherResults()
+{
+}
+
+void EntityMatcherResults::compile(const vector<const EntityMatcher*>& matchers, const XMLObject* metadata)
+{
+    m_results.clear();
+    if (matchers.empty())
+        return;
+
+    // The root has no enclosing groups, so nothing is inherited.
+    vector<bool> inherited(matchers.size());
+    const EntitiesDescriptor* group = dynamic_cast<const EntitiesDescriptor*>(metadata);
+    if (group) {
+        compileGroup(matchers, *group, inherited);
+    }
+    else {
+        const EntityDescriptor* entity = dynamic_cast<const EntityDescriptor*>(metadata);
+        if (entity)
+            compileEntity(matchers, *entity, inherited);
+    }
+}
+
+void EntityMatcherResults::compileGroup(const vector<const EntityMatcher*>& matchers, const EntitiesDescriptor& group, const vector<bool>& inherited)
+{
+    vector<bool> matched(inherited);
+    for (vector<const EntityMatcher*>::size_type i = 0; i < matchers.size(); ++i) {
+        if (!matched[i])
+            matched[i] = matchers[i]->matchesGroup(group);
+    }
+
+    const vector<EntitiesDescriptor*>& groups = group.getEntitiesDescriptors();
+    for (vector<EntitiesDescriptor*>::const_iterator g = groups.begin(); g != groups.end(); ++g)
+        compileGroup(matchers, **g, matched);
+
+    const vector<EntityDescriptor*>& entities = group.getEntityDescriptors();
+    for (vector<EntityDescriptor*>::const_iterator e = entities.begin(); e != entities.end(); ++e)
+        compileEntity(matchers, **e, matched);
+}
+
+void EntityMatcherResults::compileEntity(const vector<const EntityMatcher*>& matchers, const EntityDescriptor& entity, const vector<bool>& inherited)
+{
+    vector<bool>& matched = m_results[&entity];
+    matched = inherited;
+    for (vector<const EntityMatcher*>::size_type i = 0; i < matchers.size(); ++i) {
+        if (!matched[i])
+            matched[i] = matchers[i]->matchesIgnoringGroups(entity);
+    }
+}
+
+void EntityMatcherResults::clear()
+{
+    m_results.clear();
+}
+
+const vector<bool>* EntityMatcherResults::get(const EntityDescriptor& entity) const
+{
+    map< const EntityDescriptor*,vector<bool> >::const_iterator i = m_results.find(&entity);
+    return i != m_results.end() ? &(i->second) : nullptr;
+}
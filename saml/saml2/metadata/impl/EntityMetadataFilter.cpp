@@ -0,0 +1,267 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+/**
+ * EntityMetadataFilter.cpp
+ *
+ * Single-pass application of per-entity metadata filters.
+ */
+
+#include "internal.h"
+#include "saml2/metadata/Metadata.h"
+#include "saml2/metadata/MetadataFilter.h"
+
+#include <set>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lambda/bind.hpp>
+#include <boost/lambda/lambda.hpp>
+#include <xmltooling/logging.h>
+#include <xmltooling/util/NDC.h>
+#include <xmltooling/util/Threads.h>
+
+using namespace opensaml::saml2md;
+using namespace xmltooling::logging;
+using namespace xmltooling;
+using namespace boost::lambda;
+using namespace boost;
+using namespace std;
+
+namespace {
+    // Entities handed out to each worker at a time.
+    static const vector<EntityDescriptor*>::size_type FILTER_BATCH_SIZE = 64;
+
+    struct SAML_DLLLOCAL filter_pass_t {
+        filter_pass_t(const MetadataFilterContext* ctx, const vector<const EntityMetadataFilter*>& filters)
+            : m_ctx(ctx), m_filters(filters), m_next(0) {}
+
+        bool enterGroup(EntitiesDescriptor& group) const {
+            for (vector<const EntityMetadataFilter*>::const_iterator f = m_filters.begin(); f != m_filters.end(); ++f) {
+                if ((*f)->enterGroup(m_ctx, group))
+                    return true;
+            }
+            return false;
+        }
+
+        bool leaveGroup(EntitiesDescriptor& group) const {
+            for (vector<const EntityMetadataFilter*>::const_iterator f = m_filters.begin(); f != m_filters.end(); ++f) {
+                if ((*f)->leaveGroup(m_ctx, group))
+                    return true;
+            }
+            return false;
+        }
+
+        bool filterEntity(EntityDescriptor& entity) const {
+            for (vector<const EntityMetadataFilter*>::const_iterator f = m_filters.begin(); f != m_filters.end(); ++f) {
+                if ((*f)->filterEntity(m_ctx, entity))
+                    return true;
+            }
+            return false;
+        }
+
+        // Sequential pass: visits and prunes the tree in one walk.
+        bool filterGroup(EntitiesDescriptor& group, bool root) const {
+            if (enterGroup(group) && !root)
+                return true;
+
+            const EntitiesDescriptor& children = group;
+            removeChildren(group, children.getEntityDescriptors(), lambda::bind(&filter_pass_t::filterEntity, this, *_1));
+            removeChildren(group, children.getEntitiesDescriptors(), lambda::bind(&filter_pass_t::filterGroup, this, *_1, false));
+
+            return leaveGroup(group) && !root;
+        }
+
+        // Concurrent pass, step one: prunes groups and collects the entities left to visit.
+        bool collectGroup(EntitiesDescriptor& group, bool root) {
+            if (enterGroup(group) && !root)
+                return true;
+
+            // Parent DOM is released up front so that changes to entities only read it.
+            group.releaseDOM();
+
+            const EntitiesDescriptor& children = group;
+            const vector<EntityDescriptor*>& v = children.getEntityDescriptors();
+            m_entities.insert(m_entities.end(), v.begin(), v.end());
+
+            removeChildren(group, children.getEntitiesDescriptors(), lambda::bind(&filter_pass_t::collectGroup, this, *_1, false));
+            return false;
+        }
+
+        // Concurrent pass, step three: removes the flagged entities and finishes the groups.
+        bool pruneGroup(EntitiesDescriptor& group, bool root) const {
+            const EntitiesDescriptor& children = group;
+            removeChildren(group, children.getEntityDescriptors(), lambda::bind(&filter_pass_t::isRemoved, this, _1));
+            removeChildren(group, children.getEntitiesDescriptors(), lambda::bind(&filter_pass_t::pruneGroup, this, *_1, false));
+
+            return leaveGroup(group) && !root;
+        }
+
+        bool isRemoved(const EntityDescriptor* entity) const {
+            return m_removed.count(entity) > 0;
+        }
+
+        void work() {
+            vector<EntityDescriptor*> removed;
+            try {
+                while (true) {
+                    vector<EntityDescriptor*>::size_type start, end;
+                    {
+                        Lock lock(m_lock);
+                        if (m_next >= m_entities.size() || !m_error.empty())
+                            break;
+                        start = m_next;
+                        end = m_next = min(m_next + FILTER_BATCH_SIZE, m_entities.size());
+                    }
+                    for (; start < end; ++start) {
+                        if (filterEntity(*m_entities[start]))
+                            removed.push_back(m_entities[start]);
+                    }
+                }
+            }
+            catch (const std::exception& ex) {
+                Lock lock(m_lock);
+                if (m_error.empty())
+                    m_error = ex.what();
+            }
+
+            Lock lock(m_lock);
+            m_removed.insert(removed.begin(), removed.end());
+        }
+
+        const MetadataFilterContext* m_ctx;
+        const vector<const EntityMetadataFilter*>& m_filters;
+        vector<EntityDescriptor*> m_entities;
+        vector<EntityDescriptor*>::size_type m_next;
+        set<const EntityDescriptor*> m_removed;
+        string m_error;
+        scoped_ptr<Mutex> m_lock;
+    };
+
+    void* SAML_DLLLOCAL filter_fn(void* pv)
+    {
+#ifndef WIN32
+        // First, let's block all signals
+        Thread::mask_all_signals();
+#endif
+
+#ifdef _DEBUG
+        xmltooling::NDC ndc("filter");
+#endif
+
+        reinterpret_cast<filter_pass_t*>(pv)->work();
+        return nullptr;
+    }
+
+    void SAML_DLLLOCAL doPass(
+        const MetadataFilterContext* ctx, XMLObject& xmlObject, const vector<const EntityMetadataFilter*>& filters, unsigned int threads
+        )
+    {
+        filter_pass_t pass(ctx, filters);
+
+        EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(&xmlObject);
+        if (!group) {
+            EntityDescriptor* entity = dynamic_cast<EntityDescriptor*>(&xmlObject);
+            if (!entity)
+                throw MetadataFilterException(string(filters.front()->getId()) + " MetadataFilter was given an improper metadata instance to filter.");
+            pass.filterEntity(*entity);
+            return;
+        }
+
+        if (threads <= 1) {
+            pass.filterGroup(*group, true);
+            return;
+        }
+
+        pass.collectGroup(*group, true);
+        if (pass.m_entities.size() <= FILTER_BATCH_SIZE)
+            threads = 1;
+        else if (threads > pass.m_entities.size() / FILTER_BATCH_SIZE)
+            threads = pass.m_entities.size() / FILTER_BATCH_SIZE;
+
+        Category::getInstance(SAML_LOGCAT ".MetadataFilter").debug(
+            "applying %u metadata filter(s) to %u entities using %u thread(s)",
+            static_cast<unsigned int>(filters.size()), static_cast<unsigned int>(pass.m_entities.size()), threads
+            );
+
+        pass.m_lock.reset(Mutex::create());
+        vector<Thread*> workers;
+        try {
+            while (workers.size() + 1 < threads)
+                workers.push_back(Thread::create(&filter_fn, &pass));
+        }
+        catch (const std::exception& ex) {
+            Category::getInstance(SAML_LOGCAT ".MetadataFilter").warn("unable to start filter thread: %s", ex.what());
+        }
+        pass.work();
+        for (vector<Thread*>::iterator t = workers.begin(); t != workers.end(); ++t) {
+            (*t)->join(nullptr);
+            delete *t;
+        }
+
+        if (!pass.m_error.empty())
+            throw MetadataFilterException(pass.m_error.c_str());
+
+        pass.pruneGroup(*group, true);
+    }
+};
+
+EntityMetadataFilter::EntityMetadataFilter()
+{
+}
+
+EntityMetadataFilter::~EntityMetadataFilter()
+{
+}
+
+bool EntityMetadataFilter::enterGroup(const MetadataFilterContext*, EntitiesDescriptor&) const
+{
+    return false;
+}
+
+bool EntityMetadataFilter::leaveGroup(const MetadataFilterContext*, EntitiesDescriptor&) const
+{
+    return false;
+}
+
+bool EntityMetadataFilter::prunesGroups() const
+{
+    return false;
+}
+
+void EntityMetadataFilter::doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const
+{
+    vector<const EntityMetadataFilter*> filters(1, this);
+    doFilters(ctx, xmlObject, filters);
+}
+
+void EntityMetadataFilter::doFilters(
+    const MetadataFilterContext* ctx, XMLObject& xmlObject, const vector<const EntityMetadataFilter*>& filters, unsigned int threads
+    )
+{
+    // A filter that prunes groups on the way out would otherwise see the removals made by
+    // the filters after it, so it closes the pass it's in.
+    vector<const EntityMetadataFilter*> pass;
+    for (vector<const EntityMetadataFilter*>::const_iterator f = filters.begin(); f != filters.end(); ++f) {
+        pass.push_back(*f);
+        if ((*f)->prunesGroups() || f + 1 == filters.end()) {
+            doPass(ctx, xmlObject, pass, threads);
+            pass.clear();
+        }
+    }
+}
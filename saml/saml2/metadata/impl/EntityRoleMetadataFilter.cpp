@@ -28,11 +28,15 @@
 #include "saml2/metadata/Metadata.h"
 #include "saml2/metadata/MetadataFilter.h"
 
+#include <boost/lambda/bind.hpp>
+#include <boost/lambda/lambda.hpp>
 #include <xmltooling/logging.h>
 
 using namespace opensaml::saml2md;
 using namespace xmltooling::logging;
 using namespace xmltooling;
+using namespace boost::lambda;
+using namespace boost;
 using namespace std;
 
 using boost::scoped_ptr;
@@ -40,18 +44,19 @@ using boost::scoped_ptr;
 namespace opensaml {
     namespace saml2md {
 
-        class SAML_DLLLOCAL EntityRoleMetadataFilter : public MetadataFilter
+        class SAML_DLLLOCAL EntityRoleMetadataFilter : public EntityMetadataFilter
         {
         public:
             EntityRoleMetadataFilter(const DOMElement* e);
             ~EntityRoleMetadataFilter() {}
 
             const char* getId() const { return ENTITYROLE_METADATA_FILTER; }
-            void doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const;
+            bool filterEntity(const MetadataFilterContext* ctx, EntityDescriptor& entity) const;
+            bool leaveGroup(const MetadataFilterContext* ctx, EntitiesDescriptor& group) const;
+            bool prunesGroups() const { return m_removeEmptyEntitiesDescriptors; }
 
         private:
-            void doFilter(EntityDescriptor& entity) const;
-            void doFilter(EntitiesDescriptor& entities) const;
+            bool rejectRole(const RoleDescriptor* role) const;
 
             bool m_removeRolelessEntityDescriptors, m_removeEmptyEntitiesDescriptors;
             set<xmltooling::QName> m_roles;
@@ -102,71 +107,7 @@ EntityRoleMetadataFilter::EntityRoleMetadataFilter(const DOMElement* e)
     }
 }
 
-void EntityRoleMetadataFilter::doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const
-{
-    EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(&xmlObject);
-    if (group) {
-        doFilter(*group);
-    }
-    else {
-        EntityDescriptor* entity = dynamic_cast<EntityDescriptor*>(&xmlObject);
-        if (entity) {
-            doFilter(*entity);
-        }
-        else {
-            throw MetadataFilterException(ENTITYROLE_METADATA_FILTER " MetadataFilter was given an improper metadata instance to filter.");
-        }
-    }
-}
-
-void EntityRoleMetadataFilter::doFilter(EntitiesDescriptor& entities) const
-{
-    Category& log=Category::getInstance(SAML_LOGCAT ".MetadataFilter." ENTITYROLE_METADATA_FILTER);
-
-    VectorOf(EntityDescriptor) v = entities.getEntityDescriptors();
-    for (VectorOf(EntityDescriptor)::size_type i = 0; i < v.size(); ) {
-        doFilter(*v[i]);
-        if (m_removeRolelessEntityDescriptors) {
-            const EntityDescriptor& e = const_cast<const EntityDescriptor&>(*v[i]);
-            if (e.getIDPSSODescriptors().empty() &&
-                    e.getSPSSODescriptors().empty() &&
-                    e.getAuthnAuthorityDescriptors().empty() &&
-                    e.getAttributeAuthorityDescriptors().empty() &&
-                    e.getPDPDescriptors().empty() &&
-                    e.getAuthnQueryDescriptorTypes().empty() &&
-                    e.getAttributeQueryDescriptorTypes().empty() &&
-                    e.getAuthzDecisionQueryDescriptorTypes().empty() &&
-                    e.getRoleDescriptors().empty()) {
-                auto_ptr_char temp(e.getEntityID());
-                log.debug("filtering out role-less entity (%s)", temp.get());
-                v.erase(v.begin() + i);
-                continue;
-            }
-        }
-        i++;
-    }
-
-    VectorOf(EntitiesDescriptor) groups = entities.getEntitiesDescriptors();
-    for (VectorOf(EntitiesDescriptor)::size_type j = 0; j < groups.size(); ) {
-        EntitiesDescriptor* group = groups[j];
-        doFilter(*group);
-        if (m_removeEmptyEntitiesDescriptors && group->getEntitiesDescriptors().empty() && group->getEntityDescriptors().empty()) {
-            auto_ptr_char temp(entities.getName());
-            auto_ptr_char temp2(group->getName());
-            log.debug(
-                "filtering out empty EntitiesDescriptor (%s) from EntitiesDescriptor (%s)",
-                temp2.get() ? temp2.get() : "unnamed",
-                temp.get() ? temp.get() : "unnamed"
-                );
-            groups.erase(groups.begin() + j);
-        }
-        else {
-            j++;
-        }
-    }
-}
-
-void EntityRoleMetadataFilter::doFilter(EntityDescriptor& entity) const
+bool EntityRoleMetadataFilter::filterEntity(const MetadataFilterContext*, EntityDescriptor& entity) const
 {
     if (!m_idp)
         entity.getIDPSSODescriptors().clear();
@@ -185,12 +126,45 @@ void EntityRoleMetadataFilter::doFilter(EntityDescriptor& entity) const
     if (!m_authzq)
         entity.getAuthzDecisionQueryDescriptorTypes().clear();
 
-    VectorOf(RoleDescriptor) v = entity.getRoleDescriptors();
-    for (VectorOf(RoleDescriptor)::size_type i = 0; i < v.size(); ) {
-        const xmltooling::QName* type = v[i]->getSchemaType();
-        if (!type || m_roles.find(*type) != m_roles.end())
-            v.erase(v.begin() + i);
-        else
-            i++;
+    removeChildren(entity, const_cast<const EntityDescriptor&>(entity).getRoleDescriptors(), lambda::bind(&EntityRoleMetadataFilter::rejectRole, this, _1));
+
+    if (m_removeRolelessEntityDescriptors) {
+        const EntityDescriptor& e = const_cast<const EntityDescriptor&>(entity);
+        if (e.getIDPSSODescriptors().empty() &&
+                e.getSPSSODescriptors().empty() &&
+                e.getAuthnAuthorityDescriptors().empty() &&
+                e.getAttributeAuthorityDescriptors().empty() &&
+                e.getPDPDescriptors().empty() &&
+                e.getAuthnQueryDescriptorTypes().empty() &&
+                e.getAttributeQueryDescriptorTypes().empty() &&
+                e.getAuthzDecisionQueryDescriptorTypes().empty() &&
+                e.getRoleDescriptors().empty()) {
+            auto_ptr_char temp(e.getEntityID());
+            Category::getInstance(SAML_LOGCAT ".MetadataFilter." ENTITYROLE_METADATA_FILTER).debug("filtering out role-less entity (%s)", temp.get());
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EntityRoleMetadataFilter::rejectRole(const RoleDescriptor* role) const
+{
+    const xmltooling::QName* type = role->getSchemaType();
+    return !type || m_roles.find(*type) != m_roles.end();
+}
+
+bool EntityRoleMetadataFilter::leaveGroup(const MetadataFilterContext*, EntitiesDescriptor& group) const
+{
+    if (m_removeEmptyEntitiesDescriptors && group.getEntitiesDescriptors().empty() && group.getEntityDescriptors().empty()) {
+        const EntitiesDescriptor* parent = dynamic_cast<const EntitiesDescriptor*>(group.getParent());
+        auto_ptr_char temp(parent ? parent->getName() : nullptr);
+        auto_ptr_char temp2(group.getName());
+        Category::getInstance(SAML_LOGCAT ".MetadataFilter." ENTITYROLE_METADATA_FILTER).debug(
+            "filtering out empty EntitiesDescriptor (%s) from EntitiesDescriptor (%s)",
+            temp2.get() ? temp2.get() : "unnamed",
+            temp.get() ? temp.get() : "unnamed"
+            );
+        return true;
     }
+    return false;
 }
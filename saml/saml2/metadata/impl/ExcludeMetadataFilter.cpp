@@ -41,17 +41,17 @@ using namespace std;
 
 namespace opensaml {
     namespace saml2md {
-        class SAML_DLLLOCAL ExcludeMetadataFilter : public MetadataFilter
+        class SAML_DLLLOCAL ExcludeMetadataFilter : public EntityMetadataFilter
         {
         public:
             ExcludeMetadataFilter(const DOMElement* e, bool deprecationSupport=true);
             ~ExcludeMetadataFilter() {}
             
             const char* getId() const { return EXCLUDE_METADATA_FILTER; }
-            void doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const;
+            bool filterEntity(const MetadataFilterContext* ctx, EntityDescriptor& entity) const;
+            bool enterGroup(const MetadataFilterContext* ctx, EntitiesDescriptor& group) const;
 
         private:
-            void filterGroup(EntitiesDescriptor*) const;
             bool included(const EntityDescriptor&) const;
 
             set<xstring> m_entities;
@@ -86,55 +86,29 @@ ExcludeMetadataFilter::ExcludeMetadataFilter(const DOMElement* e, bool deprecati
     }
 }
 
-void ExcludeMetadataFilter::doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const
+bool ExcludeMetadataFilter::filterEntity(const MetadataFilterContext*, EntityDescriptor& entity) const
 {
-    EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(&xmlObject);
-    if (group) {
-        if (group->getName() && !m_entities.empty() && m_entities.count(group->getName()) > 0)
-            throw MetadataFilterException(EXCLUDE_METADATA_FILTER " MetadataFilter instructed to filter the root group in the metadata.");
-        filterGroup(group);
-    }
-    else {
-        EntityDescriptor* entity = dynamic_cast<EntityDescriptor*>(&xmlObject);
-        if (entity) {
-            if (included(*entity))
-                throw MetadataFilterException(EXCLUDE_METADATA_FILTER " MetadataFilter instructed to filter the root/only entity in the metadata.");
-        }
-        else {
-            throw MetadataFilterException(EXCLUDE_METADATA_FILTER " MetadataFilter was given an improper metadata instance to filter.");
-        }
-    }
+    if (!included(entity))
+        return false;
+    if (!entity.getParent())
+        throw MetadataFilterException(EXCLUDE_METADATA_FILTER " MetadataFilter instructed to filter the root/only entity in the metadata.");
+
+    auto_ptr_char id(entity.getEntityID());
+    Category::getInstance(SAML_LOGCAT ".MetadataFilter." EXCLUDE_METADATA_FILTER).info("filtering out blacklisted entity (%s)", id.get());
+    return true;
 }
 
-void ExcludeMetadataFilter::filterGroup(EntitiesDescriptor* entities) const
+bool ExcludeMetadataFilter::enterGroup(const MetadataFilterContext*, EntitiesDescriptor& group) const
 {
-    Category& log = Category::getInstance(SAML_LOGCAT ".MetadataFilter." EXCLUDE_METADATA_FILTER);
-
-    VectorOf(EntityDescriptor) v = entities->getEntityDescriptors();
-    for (VectorOf(EntityDescriptor)::size_type i = 0; i < v.size(); ) {
-        if (included(*v[i])) {
-            auto_ptr_char id(v[i]->getEntityID());
-            log.info("filtering out blacklisted entity (%s)", id.get());
-            v.erase(v.begin() + i);
-        }
-        else {
-            i++;
-        }
-    }
-
-    VectorOf(EntitiesDescriptor) w = entities->getEntitiesDescriptors();
-    for (VectorOf(EntitiesDescriptor)::size_type j = 0; j < w.size(); ) {
-        const XMLCh* name = w[j]->getName();
-        if (name && !m_entities.empty() && m_entities.count(name) > 0) {
-            auto_ptr_char name2(name);
-            log.info("filtering out blacklisted group (%s)", name2.get());
-            w.erase(w.begin() + j);
-        }
-        else {
-            filterGroup(w[j]);
-            j++;
-        }
-    }
+    const XMLCh* name = group.getName();
+    if (!name || m_entities.empty() || m_entities.count(name) == 0)
+        return false;
+    if (!group.getParent())
+        throw MetadataFilterException(EXCLUDE_METADATA_FILTER " MetadataFilter instructed to filter the root group in the metadata.");
+
+    auto_ptr_char name2(name);
+    Category::getInstance(SAML_LOGCAT ".MetadataFilter." EXCLUDE_METADATA_FILTER).info("filtering out blacklisted group (%s)", name2.get());
+    return true;
 }
 
 bool ExcludeMetadataFilter::included(const EntityDescriptor& entity) const
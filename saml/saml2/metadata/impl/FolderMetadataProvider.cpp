@@ -35,6 +35,7 @@
 #include <xmltooling/XMLToolingConfig.h>
 #include <xmltooling/util/DirectoryWalker.h>
 #include <xmltooling/util/PathResolver.h>
+#include <xmltooling/util/XMLConstants.h>
 #include <xmltooling/util/XMLHelper.h>
 
 using namespace opensaml::saml2md;
@@ -51,39 +52,28 @@ namespace opensaml {
         static const XMLCh _MetadataProvider[] =    UNICODE_LITERAL_16(M,e,t,a,d,a,t,a,P,r,o,v,i,d,e,r);
         static const XMLCh discoveryFeed[] =        UNICODE_LITERAL_13(d,i,s,c,o,v,e,r,y,F,e,e,d);
         static const XMLCh dropDOM[] =              UNICODE_LITERAL_7(d,r,o,p,D,O,M);
+        static const XMLCh folder[] =               UNICODE_LITERAL_6(f,o,l,d,e,r);
+        static const XMLCh FolderTemplate[] =       UNICODE_LITERAL_14(F,o,l,d,e,r,T,e,m,p,l,a,t,e);
+        static const XMLCh initThreads[] =          UNICODE_LITERAL_11(i,n,i,t,T,h,r,e,a,d,s);
         static const XMLCh legacyOrgNames[] =       UNICODE_LITERAL_14(l,e,g,a,c,y,O,r,g,N,a,m,e,s);
         static const XMLCh nested[] =               UNICODE_LITERAL_6(n,e,s,t,e,d);
         static const XMLCh path[] =                 UNICODE_LITERAL_4(p,a,t,h);
         static const XMLCh precedence[] =           UNICODE_LITERAL_10(p,r,e,c,e,d,e,n,c,e);
         static const XMLCh reloadChanges[] =        UNICODE_LITERAL_13(r,e,l,o,a,d,C,h,a,n,g,e,s);
+        static const XMLCh sharedMaintenance[] =    UNICODE_LITERAL_17(s,h,a,r,e,d,M,a,i,n,t,e,n,a,n,c,e);
         static const XMLCh validate[] =             UNICODE_LITERAL_8(v,a,l,i,d,a,t,e);
+        static const XMLCh watchFolder[] =          UNICODE_LITERAL_11(w,a,t,c,h,F,o,l,d,e,r);
+        static const XMLCh watchInterval[] =        UNICODE_LITERAL_13(w,a,t,c,h,I,n,t,e,r,v,a,l);
         static const XMLCh _type[] =                UNICODE_LITERAL_4(t,y,p,e);
         static const XMLCh _XML[] =                 UNICODE_LITERAL_3(X,M,L);
     
         static void FolderCallback(const char* pathname, struct stat& stat_buf, void* data) {
-            // data is a pair of DOM elements, the config root and the mocked up Chaining child
+            // data is a pair of DOM elements, the child template and the mocked up Chaining root
             pair<const DOMElement*,DOMElement*>* p = reinterpret_cast<pair<const DOMElement*,DOMElement*>*>(data);
             auto_ptr_XMLCh entry(pathname);
 
-            DOMElement* child = p->first->getOwnerDocument()->createElementNS(nullptr, _MetadataProvider);
-            child->setAttributeNS(nullptr, _type, _XML);
+            DOMElement* child = static_cast<DOMElement*>(p->first->cloneNode(true));
             child->setAttributeNS(nullptr, path, entry.get());
-            if (p->first->hasAttributeNS(nullptr, validate))
-                child->setAttributeNS(nullptr, validate, p->first->getAttributeNS(nullptr, validate));
-            if (p->first->hasAttributeNS(nullptr, reloadChanges))
-                child->setAttributeNS(nullptr, reloadChanges, p->first->getAttributeNS(nullptr, reloadChanges));
-            if (p->first->hasAttributeNS(nullptr, discoveryFeed))
-                child->setAttributeNS(nullptr, discoveryFeed, p->first->getAttributeNS(nullptr, discoveryFeed));
-            if (p->first->hasAttributeNS(nullptr, legacyOrgNames))
-                child->setAttributeNS(nullptr, legacyOrgNames, p->first->getAttributeNS(nullptr, legacyOrgNames));
-            if (p->first->hasAttributeNS(nullptr, dropDOM))
-                child->setAttributeNS(nullptr, dropDOM, p->first->getAttributeNS(nullptr, dropDOM));
-
-            DOMElement* filter = XMLHelper::getFirstChildElement(p->first);
-            while (filter) {
-                child->appendChild(filter->cloneNode(true));
-                filter = XMLHelper::getNextSiblingElement(filter);
-            }
             p->second->appendChild(child);
         }
 
@@ -100,19 +90,59 @@ namespace opensaml {
             string fullname, loc(p.get());
             XMLToolingConfig::getConfig().getPathResolver()->resolve(loc, PathResolver::XMLTOOLING_CFG_FILE);
 
-            // First we build a new root element of the right type, and copy in the precedence setting.
+            // First we build a new root element of the right type, and copy in the precedence and threading settings.
             DOMElement* root = e->getOwnerDocument()->createElementNS(nullptr, _MetadataProvider);
             root->setAttributeNS(nullptr, _type, Chaining);
             if (e->hasAttributeNS(nullptr, precedence))
                 root->setAttributeNS(nullptr, precedence, e->getAttributeNS(nullptr, precedence));
+            if (e->hasAttributeNS(nullptr, initThreads))
+                root->setAttributeNS(nullptr, initThreads, e->getAttributeNS(nullptr, initThreads));
+
+            // Next we build the template for each file's provider, minus the path.
+            DOMElement* child = e->getOwnerDocument()->createElementNS(nullptr, _MetadataProvider);
+            child->setAttributeNS(nullptr, _type, _XML);
+            if (e->hasAttributeNS(nullptr, validate))
+                child->setAttributeNS(nullptr, validate, e->getAttributeNS(nullptr, validate));
+            if (e->hasAttributeNS(nullptr, reloadChanges))
+                child->setAttributeNS(nullptr, reloadChanges, e->getAttributeNS(nullptr, reloadChanges));
+            if (e->hasAttributeNS(nullptr, discoveryFeed))
+                child->setAttributeNS(nullptr, discoveryFeed, e->getAttributeNS(nullptr, discoveryFeed));
+            if (e->hasAttributeNS(nullptr, legacyOrgNames))
+                child->setAttributeNS(nullptr, legacyOrgNames, e->getAttributeNS(nullptr, legacyOrgNames));
+            if (e->hasAttributeNS(nullptr, dropDOM))
+                child->setAttributeNS(nullptr, dropDOM, e->getAttributeNS(nullptr, dropDOM));
+            // Large folders would otherwise start a monitoring thread per file, so default to the shared scheduler.
+            if (e->hasAttributeNS(nullptr, sharedMaintenance))
+                child->setAttributeNS(nullptr, sharedMaintenance, e->getAttributeNS(nullptr, sharedMaintenance));
+            else
+                child->setAttributeNS(nullptr, sharedMaintenance, xmlconstants::XML_TRUE);
+
+            DOMElement* filter = XMLHelper::getFirstChildElement(e);
+            while (filter) {
+                child->appendChild(filter->cloneNode(true));
+                filter = XMLHelper::getNextSiblingElement(filter);
+            }
+
+            bool recurse = XMLHelper::getAttrBool(e, false, nested);
 
             Category& log = Category::getInstance(SAML_LOGCAT ".MetadataProvider.Folder");
             log.info("loading metadata files from folder (%s)", loc.c_str());
 
-            DirectoryWalker walker(log, loc.c_str(), XMLHelper::getAttrBool(e, false, nested));
-            pair<const DOMElement*,DOMElement*> data = make_pair(e, root);
+            DirectoryWalker walker(log, loc.c_str(), recurse);
+            pair<const DOMElement*,DOMElement*> data = make_pair(child, root);
             walker.walk(FolderCallback, &data);
 
+            if (XMLHelper::getAttrBool(e, false, watchFolder)) {
+                // Hand the chain what it needs to pick up added and removed files on its own.
+                auto_ptr_XMLCh widenit(loc.c_str());
+                root->setAttributeNS(nullptr, folder, widenit.get());
+                if (recurse)
+                    root->setAttributeNS(nullptr, nested, xmlconstants::XML_TRUE);
+                if (e->hasAttributeNS(nullptr, watchInterval))
+                    root->setAttributeNS(nullptr, watchInterval, e->getAttributeNS(nullptr, watchInterval));
+                root->appendChild(e->getOwnerDocument()->renameNode(child, nullptr, FolderTemplate));
+            }
+
             return SAMLConfig::getConfig().MetadataProviderManager.newPlugin(CHAINING_METADATA_PROVIDER, root, deprecationSupport);
         }
 
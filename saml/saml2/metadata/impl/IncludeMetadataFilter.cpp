@@ -29,8 +29,6 @@
 #include "saml2/metadata/Metadata.h"
 #include "saml2/metadata/MetadataFilter.h"
 
-#define BOOST_BIND_GLOBAL_PLACEHOLDERS
-#include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <xmltooling/logging.h>
 
@@ -43,17 +41,16 @@ using namespace std;
 
 namespace opensaml {
     namespace saml2md {
-        class SAML_DLLLOCAL IncludeMetadataFilter : public MetadataFilter
+        class SAML_DLLLOCAL IncludeMetadataFilter : public EntityMetadataFilter
         {
         public:
             IncludeMetadataFilter(const DOMElement* e, bool deprecationSupport=true);
             ~IncludeMetadataFilter() {}
 
             const char* getId() const { return INCLUDE_METADATA_FILTER; }
-            void doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const;
+            bool filterEntity(const MetadataFilterContext* ctx, EntityDescriptor& entity) const;
 
         private:
-            void filterGroup(EntitiesDescriptor*) const;
             bool included(const EntityDescriptor&) const;
 
             set<xstring> m_entities;
@@ -88,42 +85,16 @@ IncludeMetadataFilter::IncludeMetadataFilter(const DOMElement* e, bool deprecati
     }
 }
 
-void IncludeMetadataFilter::doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const
+bool IncludeMetadataFilter::filterEntity(const MetadataFilterContext*, EntityDescriptor& entity) const
 {
-    EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(&xmlObject);
-    if (group) {
-        filterGroup(group);
-    }
-    else {
-        EntityDescriptor* entity = dynamic_cast<EntityDescriptor*>(&xmlObject);
-        if (entity) {
-            if (!included(*entity))
-                throw MetadataFilterException(INCLUDE_METADATA_FILTER " MetadataFilter instructed to filter the root/only entity in the metadata.");
-        }
-        else {
-            throw MetadataFilterException(INCLUDE_METADATA_FILTER " MetadataFilter was given an improper metadata instance to filter.");
-        }
-    }
-}
-
-void IncludeMetadataFilter::filterGroup(EntitiesDescriptor* entities) const
-{
-    Category& log = Category::getInstance(SAML_LOGCAT ".MetadataFilter." INCLUDE_METADATA_FILTER);
-
-    VectorOf(EntityDescriptor) v = entities->getEntityDescriptors();
-    for (VectorOf(EntityDescriptor)::size_type i = 0; i < v.size(); ) {
-        if (!included(*v[i])) {
-            auto_ptr_char id(v[i]->getEntityID());
-            log.info("filtering out non-included entity (%s)", id.get());
-            v.erase(v.begin() + i);
-        }
-        else {
-            i++;
-        }
-    }
-
-    const vector<EntitiesDescriptor*>& groups = const_cast<const EntitiesDescriptor*>(entities)->getEntitiesDescriptors();
-    for_each(groups.begin(), groups.end(), boost::bind(&IncludeMetadataFilter::filterGroup, this, _1));
+    if (included(entity))
+        return false;
+    if (!entity.getParent())
+        throw MetadataFilterException(INCLUDE_METADATA_FILTER " MetadataFilter instructed to filter the root/only entity in the metadata.");
+
+    auto_ptr_char id(entity.getEntityID());
+    Category::getInstance(SAML_LOGCAT ".MetadataFilter." INCLUDE_METADATA_FILTER).info("filtering out non-included entity (%s)", id.get());
+    return true;
 }
 
 bool IncludeMetadataFilter::included(const EntityDescriptor& entity) const
@@ -28,9 +28,6 @@
 #include "saml2/metadata/Metadata.h"
 #include "saml2/metadata/MetadataFilter.h"
 
-#include <boost/lambda/bind.hpp>
-#include <boost/lambda/casts.hpp>
-#include <boost/lambda/lambda.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <xmltooling/logging.h>
 
@@ -38,24 +35,19 @@ using namespace opensaml::saml2md;
 using namespace opensaml::saml2;
 using namespace xmltooling::logging;
 using namespace xmltooling;
-using namespace boost::lambda;
 using namespace boost;
 using namespace std;
 
 namespace opensaml {
     namespace saml2md {
-        class SAML_DLLLOCAL InlineLogoMetadataFilter : public MetadataFilter
+        class SAML_DLLLOCAL InlineLogoMetadataFilter : public EntityMetadataFilter
         {
         public:
             InlineLogoMetadataFilter(const DOMElement* e, bool deprecationSupport=true) {}
             ~InlineLogoMetadataFilter() {}
             
             const char* getId() const { return EXCLUDE_METADATA_FILTER; }
-            void doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const;
-
-        private:
-            void filterGroup(EntitiesDescriptor*) const;
-            void filterEntity(EntityDescriptor*) const;
+            bool filterEntity(const MetadataFilterContext* ctx, EntityDescriptor& entity) const;
         }; 
 
         MetadataFilter* SAML_DLLLOCAL InlineLogoMetadataFilterFactory(const DOMElement* const & e, bool deprecationSupport)
@@ -66,37 +58,11 @@ namespace opensaml {
 };
 
 
-void InlineLogoMetadataFilter::doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const
-{
-    EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(&xmlObject);
-    if (group) {
-        filterGroup(group);
-    }
-    else {
-        EntityDescriptor* entity = dynamic_cast<EntityDescriptor*>(&xmlObject);
-        if (entity) {
-            filterEntity(entity);
-        }
-        else {
-            throw MetadataFilterException(INLINELOGO_METADATA_FILTER " MetadataFilter was given an improper metadata instance to filter.");
-        }
-    }
-}
-
-void InlineLogoMetadataFilter::filterGroup(EntitiesDescriptor* entities) const
-{
-    const vector<EntityDescriptor*>& v = const_cast<const EntitiesDescriptor*>(entities)->getEntityDescriptors();
-    for_each(v.begin(), v.end(), lambda::bind(&InlineLogoMetadataFilter::filterEntity, this, _1));
-
-    const vector<EntitiesDescriptor*>& v2 = const_cast<const EntitiesDescriptor*>(entities)->getEntitiesDescriptors();
-    for_each(v2.begin(), v2.end(), lambda::bind(&InlineLogoMetadataFilter::filterGroup, this, _1));
-}
-
-void InlineLogoMetadataFilter::filterEntity(EntityDescriptor* entity) const
+bool InlineLogoMetadataFilter::filterEntity(const MetadataFilterContext*, EntityDescriptor& entity) const
 {
     static const XMLCh prefix[] = { chLatin_d, chLatin_a, chLatin_t, chLatin_a, chColon, chNull };
 
-    const list<XMLObject*>& children = const_cast<const EntityDescriptor*>(entity)->getOrderedChildren();
+    const list<XMLObject*>& children = const_cast<const EntityDescriptor&>(entity).getOrderedChildren();
     for (list<XMLObject*>::const_iterator child = children.begin(); child != children.end(); ++child) {
         if (dynamic_cast<const RoleDescriptor*>(*child)) {
             const Extensions* ext = dynamic_cast<const RoleDescriptor*>(*child)->getExtensions();
@@ -104,7 +70,7 @@ void InlineLogoMetadataFilter::filterEntity(EntityDescriptor* entity) const
                 continue;
             const vector<XMLObject*>& exts = ext->getUnknownXMLObjects();
             for (vector<XMLObject*>::const_iterator ext = exts.begin(); ext != exts.end(); ++ext) {
-                UIInfo* info = dynamic_cast<UIInfo*>(*ext);
+                UIInfo* info = metadata_cast<UIInfo>(*ext);
                 if (info) {
                     VectorOf(Logo) v = info->getLogos();
                     for (VectorOf(Logo)::size_type i = 0; i < v.size(); ) {
@@ -122,4 +88,5 @@ void InlineLogoMetadataFilter::filterEntity(EntityDescriptor* entity) const
             }
         }
     }
+    return false;
 }
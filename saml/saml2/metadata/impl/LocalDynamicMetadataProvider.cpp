@@ -65,7 +65,13 @@ namespace opensaml {
             */
             LocalDynamicMetadataProvider(const xercesc::DOMElement* e=nullptr);
 
-            void init() {};
+            virtual ~LocalDynamicMetadataProvider() {
+                stopChangeEvents();
+            }
+
+            void init() {
+                startChangeEvents();
+            }
 
         protected:
             virtual EntityDescriptor* resolve(const Criteria& criteria, string& cacheTag) const;
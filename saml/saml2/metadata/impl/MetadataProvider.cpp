@@ -25,6 +25,8 @@
  */
 
 #include "internal.h"
+#include "saml2/metadata/EntityMatcher.h"
+#include "saml2/metadata/Metadata.h"
 #include "saml2/metadata/MetadataFilter.h"
 #include "saml2/metadata/MetadataProvider.h"
 
@@ -100,10 +102,12 @@ static const XMLCh SigFilter[] =            UNICODE_LITERAL_23(S,i,g,n,a,t,u,r,e
 static const XMLCh Exclude[] =              UNICODE_LITERAL_7(E,x,c,l,u,d,e);
 static const XMLCh Include[] =              UNICODE_LITERAL_7(I,n,c,l,u,d,e);
 static const XMLCh _type[] =                UNICODE_LITERAL_4(t,y,p,e);
+static const XMLCh filterThreads[] =        UNICODE_LITERAL_13(f,i,l,t,e,r,T,h,r,e,a,d,s);
 
 MetadataProvider::MetadataProvider() { throw MetadataException("Illegal constructor call"); }
 
-MetadataProvider::MetadataProvider(const DOMElement* e, bool deprecationSupport) : m_filterContext(nullptr)
+MetadataProvider::MetadataProvider(const DOMElement* e, bool deprecationSupport)
+    : m_filterContext(nullptr), m_filterThreads(max(XMLHelper::getAttrInt(e, 1, filterThreads), 1))
 {
 #ifdef _DEBUG
     NDC ndc("MetadataProvider");
@@ -202,10 +206,25 @@ void MetadataProvider::setContext(const MetadataFilterContext* ctx)
 void MetadataProvider::doFilters(const MetadataFilterContext* ctx, XMLObject& xmlObject) const
 {
     Category& log = Category::getInstance(SAML_LOGCAT ".MetadataProvider");
+
+    // Runs of per-entity filters are applied together, everything else one at a time.
+    vector<const EntityMetadataFilter*> fused;
     for (ptr_vector<MetadataFilter>::const_iterator i = m_filters.begin(); i != m_filters.end(); i++) {
+        const EntityMetadataFilter* ef = dynamic_cast<const EntityMetadataFilter*>(&(*i));
+        if (ef) {
+            log.info("applying metadata filter (%s)", i->getId());
+            fused.push_back(ef);
+            continue;
+        }
+        if (!fused.empty()) {
+            EntityMetadataFilter::doFilters(ctx ? ctx : m_filterContext, xmlObject, fused, m_filterThreads);
+            fused.clear();
+        }
         log.info("applying metadata filter (%s)", i->getId());
         i->doFilter(ctx ? ctx : m_filterContext, xmlObject);
     }
+    if (!fused.empty())
+        EntityMetadataFilter::doFilters(ctx ? ctx : m_filterContext, xmlObject, fused, m_filterThreads);
 }
 
 void MetadataProvider::outputStatus(ostream& os) const
@@ -218,23 +237,71 @@ const EntitiesDescriptor* MetadataProvider::getEntitiesDescriptor(const XMLCh* n
     return getEntitiesDescriptor(temp.get(),strict);
 }
 
+const MetadataProvider::ExtensionIndex* MetadataProvider::getExtensionIndex(const XMLObject&) const
+{
+    return nullptr;
+}
+
+MetadataProvider::ExtensionIndex::ExtensionIndex(const Extensions* exts)
+    : uiInfo(nullptr), discoHints(nullptr), entityAttributes(nullptr), registrationInfo(nullptr), sourceID(nullptr)
+{
+    if (!exts)
+        return;
+
+    // The first of each singular extension wins, as with a scan.
+    const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
+    for (vector<XMLObject*>::const_iterator i = children.begin(); i != children.end(); ++i) {
+        if (!uiInfo && (uiInfo = metadata_cast<UIInfo>(*i)))
+            continue;
+        if (!discoHints && (discoHints = metadata_cast<DiscoHints>(*i)))
+            continue;
+        if (!entityAttributes && (entityAttributes = metadata_cast<EntityAttributes>(*i)))
+            continue;
+        if (!registrationInfo && (registrationInfo = metadata_cast<RegistrationInfo>(*i)))
+            continue;
+        const SourceID* source = metadata_cast<SourceID>(*i);
+        if (source) {
+            // A SourceID without an ID is passed over, as with a scan.
+            if (!sourceID && source->getID())
+                sourceID = source;
+            continue;
+        }
+        const DigestMethod* digest = metadata_cast<DigestMethod>(*i);
+        if (digest) {
+            digestMethods.push_back(digest);
+            continue;
+        }
+        const SigningMethod* signing = metadata_cast<SigningMethod>(*i);
+        if (signing)
+            signingMethods.push_back(signing);
+    }
+}
+
+MetadataProvider::ExtensionIndex::~ExtensionIndex()
+{
+}
+
 MetadataProvider::Criteria::Criteria()
-    : entityID_unicode(nullptr), entityID_ascii(nullptr), artifact(nullptr), role(nullptr), protocol(nullptr), protocol2(nullptr), validOnly(true)
+    : entityID_unicode(nullptr), entityID_ascii(nullptr), artifact(nullptr), role(nullptr), protocol(nullptr), protocol2(nullptr), validOnly(true), location(nullptr),
+        keyFingerprint(nullptr), keyUsage(0)
 {
 }
 
 MetadataProvider::Criteria::Criteria(const XMLCh* id, const xmltooling::QName* q, const XMLCh* prot, bool valid)
-    : entityID_unicode(id), entityID_ascii(nullptr), artifact(nullptr), role(q), protocol(prot), protocol2(nullptr), validOnly(valid)
+    : entityID_unicode(id), entityID_ascii(nullptr), artifact(nullptr), role(q), protocol(prot), protocol2(nullptr), validOnly(valid), location(nullptr),
+        keyFingerprint(nullptr), keyUsage(0)
 {
 }
 
 MetadataProvider::Criteria::Criteria(const char* id, const xmltooling::QName* q, const XMLCh* prot, bool valid)
-    : entityID_unicode(nullptr), entityID_ascii(id), artifact(nullptr), role(q), protocol(prot), protocol2(nullptr), validOnly(valid)
+    : entityID_unicode(nullptr), entityID_ascii(id), artifact(nullptr), role(q), protocol(prot), protocol2(nullptr), validOnly(valid), location(nullptr),
+        keyFingerprint(nullptr), keyUsage(0)
 {
 }
 
 MetadataProvider::Criteria::Criteria(const SAMLArtifact* a, const xmltooling::QName* q, const XMLCh* prot, bool valid)
-    : entityID_unicode(nullptr), entityID_ascii(nullptr), artifact(a), role(q), protocol(prot), protocol2(nullptr), validOnly(valid)
+    : entityID_unicode(nullptr), entityID_ascii(nullptr), artifact(a), role(q), protocol(prot), protocol2(nullptr), validOnly(valid), location(nullptr),
+        keyFingerprint(nullptr), keyUsage(0)
 {
 }
 
@@ -251,6 +318,38 @@ void MetadataProvider::Criteria::reset()
     protocol = nullptr;
     protocol2 = nullptr;
     validOnly = true;
+    location = nullptr;
+    keyFingerprint = nullptr;
+    keyUsage = 0;
+}
+
+MetadataProvider::EntityCursor::EntityCursor(
+    unsigned int size, const xmltooling::QName* q, const XMLCh* prot, const EntityMatcher* m, bool valid, unsigned int scan
+    ) : pageSize(size), scanLimit(scan), role(q), protocol(prot), matcher(m), validOnly(valid)
+{
+}
+
+MetadataProvider::EntityCursor::~EntityCursor()
+{
+}
+
+void MetadataProvider::EntityCursor::rewind()
+{
+    position.erase();
+}
+
+bool MetadataProvider::EntityCursor::matches(const EntityDescriptor& entity) const
+{
+    if (validOnly && !entity.isValid())
+        return false;
+    if (role && !entity.getRoleDescriptor(*role, protocol))
+        return false;
+    return !matcher || matcher->matches(entity);
+}
+
+bool MetadataProvider::getEntityPage(EntityCursor&, vector<const EntityDescriptor*>&) const
+{
+    throw MetadataException("Entity enumeration not implemented on this provider.");
 }
 
 MetadataFilter::MetadataFilter()
@@ -0,0 +1,221 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+/**
+ * MetadataScheduler.cpp
+ *
+ * Process-wide scheduler for background metadata maintenance.
+ */
+
+#include "internal.h"
+#include "saml2/metadata/MetadataScheduler.h"
+
+#include <xmltooling/logging.h>
+#include <xmltooling/util/NDC.h>
+#include <xmltooling/util/Threads.h>
+
+using namespace opensaml::saml2md;
+using namespace opensaml;
+using namespace xmltooling::logging;
+using namespace xmltooling;
+using namespace std;
+
+MetadataScheduler::Task::Task()
+{
+}
+
+MetadataScheduler::Task::~Task()
+{
+}
+
+const char* MetadataScheduler::Task::getId() const
+{
+    return nullptr;
+}
+
+MetadataScheduler::MetadataScheduler(unsigned int workers, unsigned int maxThrottled)
+    : m_shutdown(false), m_maxThrottled(maxThrottled ? maxThrottled : 1), m_runningThrottled(0),
+        m_lock(Mutex::create()), m_wakeup(CondWait::create()), m_finished(CondWait::create())
+{
+    if (workers == 0)
+        workers = 1;
+    Category::getInstance(SAML_LOGCAT ".MetadataScheduler").info(
+        "starting %u metadata maintenance thread(s), running at most %u reload(s) at once", workers, m_maxThrottled
+        );
+    for (unsigned int i = 0; i < workers; ++i)
+        m_workers.push_back(Thread::create(&worker_fn, this));
+}
+
+MetadataScheduler::~MetadataScheduler()
+{
+    shutdown();
+}
+
+MetadataScheduler& MetadataScheduler::getScheduler()
+{
+    return SAMLInternalConfig::getInternalConfig().getMetadataScheduler();
+}
+
+void MetadataScheduler::configure(unsigned int workers, unsigned int maxThrottled)
+{
+    SAMLInternalConfig::getInternalConfig().setMetadataScheduling(workers, maxThrottled);
+}
+
+void MetadataScheduler::shutdown()
+{
+    m_lock->lock();
+    m_shutdown = true;
+    m_tasks.clear();
+    m_wakeup->broadcast();
+    m_lock->unlock();
+
+    for (vector<Thread*>::iterator i = m_workers.begin(); i != m_workers.end(); ++i) {
+        (*i)->join(nullptr);
+        delete *i;
+    }
+    m_workers.clear();
+}
+
+void MetadataScheduler::schedule(Task* task, time_t delay, bool throttled)
+{
+    if (!task)
+        return;
+    Lock lock(m_lock);
+    if (m_shutdown)
+        return;
+    unschedule(task);
+    m_cancelled.erase(task);
+    m_tasks.insert(timerheap_t::value_type(time(nullptr) + (delay > 0 ? delay : 0), entry_t(task, throttled)));
+    m_wakeup->signal();
+}
+
+void MetadataScheduler::cancel(Task* task)
+{
+    if (!task)
+        return;
+    Lock lock(m_lock);
+    unschedule(task);
+    if (m_running.count(task) > 0) {
+        // Prevent the worker from rescheduling it, and wait for it to finish.
+        m_cancelled.insert(task);
+        while (m_running.count(task) > 0)
+            m_finished->wait(m_lock.get());
+    }
+}
+
+bool MetadataScheduler::unschedule(Task* task)
+{
+    bool found = false;
+    for (timerheap_t::iterator i = m_tasks.begin(); i != m_tasks.end();) {
+        if (i->second.task == task) {
+            m_tasks.erase(i++);
+            found = true;
+        }
+        else {
+            ++i;
+        }
+    }
+    return found;
+}
+
+void* MetadataScheduler::worker_fn(void* pv)
+{
+#ifndef WIN32
+    // First, let's block all signals
+    Thread::mask_all_signals();
+#endif
+
+#ifdef _DEBUG
+    xmltooling::NDC ndc("maintenance");
+#endif
+
+    reinterpret_cast<MetadataScheduler*>(pv)->work();
+    return nullptr;
+}
+
+void MetadataScheduler::work()
+{
+    Category& log = Category::getInstance(SAML_LOGCAT ".MetadataScheduler");
+
+    m_lock->lock();
+    while (!m_shutdown) {
+        time_t now = time(nullptr);
+
+        // Find the earliest due task that isn't blocked by the reload cap.
+        timerheap_t::iterator next = m_tasks.end();
+        // A task rescheduled while it is still running waits for that run to finish.
+        for (timerheap_t::iterator i = m_tasks.begin(); i != m_tasks.end() && i->first <= now; ++i) {
+            if ((!i->second.throttled || m_runningThrottled < m_maxThrottled) && m_running.count(i->second.task) == 0) {
+                next = i;
+                break;
+            }
+        }
+
+        if (next == m_tasks.end()) {
+            // Sleep until the next future deadline. Completion of a throttled task wakes us early.
+            int delay = 60;
+            timerheap_t::const_iterator future = m_tasks.upper_bound(now);
+            if (future != m_tasks.end() && future->first - now < delay)
+                delay = static_cast<int>(future->first - now);
+            m_wakeup->timedwait(m_lock.get(), delay > 0 ? delay : 1);
+            continue;
+        }
+
+        entry_t e = next->second;
+        m_tasks.erase(next);
+        m_running.insert(e.task);
+        if (e.throttled)
+            ++m_runningThrottled;
+        m_lock->unlock();
+
+        time_t again = 0;
+        try {
+            again = e.task->run();
+        }
+        catch (const exception& ex) {
+            log.error("uncaught exception in maintenance task (%s): %s", e.task->getId() ? e.task->getId() : "unknown", ex.what());
+            again = 300;
+        }
+        catch (...) {
+            log.error("uncaught unknown exception in maintenance task (%s)", e.task->getId() ? e.task->getId() : "unknown");
+            again = 300;
+        }
+
+        m_lock->lock();
+        m_running.erase(e.task);
+        if (e.throttled)
+            --m_runningThrottled;
+        bool pending = false;
+        if (m_cancelled.erase(e.task) == 0 && !m_shutdown) {
+            // An explicit reschedule while the task was running takes precedence.
+            timerheap_t::iterator i = m_tasks.begin();
+            while (i != m_tasks.end() && i->second.task != e.task)
+                ++i;
+            if (i != m_tasks.end())
+                pending = true;
+            else if (again > 0)
+                m_tasks.insert(timerheap_t::value_type(time(nullptr) + again, e));
+        }
+        m_finished->broadcast();
+        if (e.throttled || pending)
+            m_wakeup->broadcast();
+    }
+    m_lock->unlock();
+}
@@ -45,7 +45,11 @@ namespace opensaml {
             }
             ~NameEntityMatcher() {}
 
-            bool matches(const EntityDescriptor& entity) const;
+            bool matches(const EntityDescriptor& entity) const {
+                return matchesWithGroups(entity);
+            }
+            bool matchesGroup(const EntitiesDescriptor& group) const;
+            bool matchesIgnoringGroups(const EntityDescriptor& entity) const;
 
         private:
             const XMLCh* m_name;
@@ -76,15 +80,35 @@ EntityMatcher::~EntityMatcher()
 {
 }
 
-bool NameEntityMatcher::matches(const EntityDescriptor& entity) const
+bool EntityMatcher::matchesGroup(const EntitiesDescriptor&) const
+{
+    return false;
+}
+
+bool EntityMatcher::matchesIgnoringGroups(const EntityDescriptor& entity) const
+{
+    return matches(entity);
+}
+
+bool EntityMatcher::matchesWithGroups(const EntityDescriptor& entity) const
 {
-    if (XMLString::equals(m_name, entity.getEntityID()))
+    if (matchesIgnoringGroups(entity))
         return true;
-    const EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(entity.getParent());
+    const EntitiesDescriptor* group = metadata_cast<EntitiesDescriptor>(entity.getParent());
     while (group) {
-        if (XMLString::equals(m_name, group->getName()))
+        if (matchesGroup(*group))
             return true;
-        group = dynamic_cast<EntitiesDescriptor*>(group->getParent());
+        group = metadata_cast<EntitiesDescriptor>(group->getParent());
     }
     return false;
 }
+
+bool NameEntityMatcher::matchesGroup(const EntitiesDescriptor& group) const
+{
+    return XMLString::equals(m_name, group.getName());
+}
+
+bool NameEntityMatcher::matchesIgnoringGroups(const EntityDescriptor& entity) const
+{
+    return XMLString::equals(m_name, entity.getEntityID());
+}
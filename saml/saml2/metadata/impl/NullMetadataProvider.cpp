@@ -47,9 +47,13 @@ namespace opensaml {
                     m_template.reset(dynamic_cast<EntityDescriptor*>(XMLObjectBuilder::buildOneFromElement(const_cast<DOMElement*>(e))));
             }
 
-            virtual ~NullMetadataProvider() {}
+            virtual ~NullMetadataProvider() {
+                stopChangeEvents();
+            }
 
-            void init() {}
+            void init() {
+                startChangeEvents();
+            }
 
         protected:
             EntityDescriptor* resolve(const MetadataProvider::Criteria& criteria, string& cacheTag) const;
@@ -27,34 +27,141 @@
 #include "internal.h"
 #include "saml2/metadata/ObservableMetadataProvider.h"
 
-#define BOOST_BIND_GLOBAL_PLACEHOLDERS
-#include <boost/bind.hpp>
+#include <algorithm>
+#include <xercesc/util/XMLUniDefs.hpp>
+#include <xmltooling/logging.h>
+#include <xmltooling/util/NDC.h>
 #include <xmltooling/util/Threads.h>
+#include <xmltooling/util/XMLHelper.h>
 
 using namespace opensaml::saml2md;
+using namespace xmltooling::logging;
 using namespace xmltooling;
 using namespace boost;
 using namespace std;
 
+static const XMLCh asyncEvents[] = UNICODE_LITERAL_11(a,s,y,n,c,E,v,e,n,t,s);
+
 ObservableMetadataProvider::ObservableMetadataProvider(const xercesc::DOMElement* e, bool deprecationSupport)
-    : MetadataProvider(e, deprecationSupport), m_observerLock(Mutex::create())
+    : MetadataProvider(e, deprecationSupport), m_observerLock(Mutex::create()),
+        m_asyncEvents(XMLHelper::getAttrBool(e, false, asyncEvents)), m_eventPending(false), m_dispatchShutdown(false)
 {
+    if (m_asyncEvents) {
+        m_dispatchLock.reset(Mutex::create());
+        m_dispatchWait.reset(CondWait::create());
+    }
 }
 
 ObservableMetadataProvider::~ObservableMetadataProvider()
 {
+    // Only reached with delivery running if a subclass failed to stop it.
+    if (m_dispatchThread) {
+        Category::getInstance(SAML_LOGCAT ".MetadataProvider").error(
+            "metadata change event delivery was still running when provider (%s) was destroyed", getId() ? getId() : "unnamed"
+            );
+        stopChangeEvents();
+    }
+}
+
+void ObservableMetadataProvider::startChangeEvents()
+{
+    if (!m_asyncEvents || m_dispatchThread)
+        return;
+
+    m_dispatchShutdown = false;
+    m_dispatchThread.reset(Thread::create(&dispatch_fn, this));
+}
+
+void ObservableMetadataProvider::stopChangeEvents()
+{
+    if (!m_dispatchThread)
+        return;
+
+    m_dispatchLock->lock();
+    m_dispatchShutdown = true;
+    m_dispatchWait->signal();
+    m_dispatchLock->unlock();
+
+    m_dispatchThread->join(nullptr);
+    m_dispatchThread.reset();
+}
+
+void ObservableMetadataProvider::queueChangeEvent() const
+{
+    Lock lock(m_dispatchLock);
+    if (!m_eventPending) {
+        m_eventPending = true;
+        m_dispatchWait->signal();
+    }
+}
+
+void* ObservableMetadataProvider::dispatch_fn(void* pv)
+{
+#ifndef WIN32
+    // First, let's block all signals
+    Thread::mask_all_signals();
+#endif
+
+#ifdef _DEBUG
+    xmltooling::NDC ndc("dispatch");
+#endif
+
+    reinterpret_cast<ObservableMetadataProvider*>(pv)->dispatch();
+    return nullptr;
+}
+
+void ObservableMetadataProvider::dispatch()
+{
+    Category& log = Category::getInstance(SAML_LOGCAT ".MetadataProvider");
+
+    m_dispatchLock->lock();
+    while (!m_dispatchShutdown) {
+        if (!m_eventPending) {
+            m_dispatchWait->wait(m_dispatchLock.get());
+            continue;
+        }
+
+        // Anything raised from here on is coalesced into the next delivery.
+        m_eventPending = false;
+        m_dispatchLock->unlock();
+        try {
+            Locker locker(this);
+            Lock lock(m_observerLock);
+            for (vector<const Observer*>::const_iterator o = m_observers.begin(); o != m_observers.end(); ++o) {
+                if (!(*o)->synchronous())
+                    (*o)->onEvent(*this);
+            }
+        }
+        catch (const std::exception& ex) {
+            log.error("uncaught exception delivering metadata change event (%s): %s", getId() ? getId() : "unnamed", ex.what());
+        }
+        m_dispatchLock->lock();
+    }
+    m_dispatchLock->unlock();
 }
 
 void ObservableMetadataProvider::emitChangeEvent() const
 {
     Lock lock(m_observerLock);
-    for_each(m_observers.begin(), m_observers.end(), boost::bind(&Observer::onEvent, _1, boost::cref(*this)));
+    for (vector<const Observer*>::const_iterator o = m_observers.begin(); o != m_observers.end(); ++o) {
+        if (!m_dispatchThread || (*o)->synchronous())
+            (*o)->onEvent(*this);
+    }
+    if (m_dispatchThread)
+        queueChangeEvent();
 }
 
 void ObservableMetadataProvider::emitChangeEvent(const EntityDescriptor& entity) const
 {
+    // The entity may be gone by the time a queued event is delivered, so only
+    // synchronous observers see it.
     Lock lock(m_observerLock);
-    for_each(m_observers.begin(), m_observers.end(), boost::bind(&Observer::onEvent, _1, boost::cref(*this), boost::cref(entity)));
+    for (vector<const Observer*>::const_iterator o = m_observers.begin(); o != m_observers.end(); ++o) {
+        if (!m_dispatchThread || (*o)->synchronous())
+            (*o)->onEvent(*this, entity);
+    }
+    if (m_dispatchThread)
+        queueChangeEvent();
 }
 
 void ObservableMetadataProvider::addObserver(const Observer* newObserver) const
@@ -86,3 +193,8 @@ void ObservableMetadataProvider::Observer::onEvent(const ObservableMetadataProvi
 { 
     onEvent(provider);
 }
+
+bool ObservableMetadataProvider::Observer::synchronous() const
+{
+    return false;
+}
@@ -28,9 +28,6 @@
 #include "saml2/metadata/EntityMatcher.h"
 #include "saml2/metadata/Metadata.h"
 
-#include <boost/lambda/bind.hpp>
-#include <boost/lambda/casts.hpp>
-#include <boost/lambda/lambda.hpp>
 #include <xercesc/util/XMLUniDefs.hpp>
 #include <xmltooling/logging.h>
 #include <xmltooling/util/XMLHelper.h>
@@ -40,7 +37,6 @@ using namespace opensaml::saml2;
 using namespace opensaml;
 using namespace xmltooling::logging;
 using namespace xmltooling;
-using namespace boost::lambda;
 using namespace boost;
 using namespace std;
 
@@ -53,8 +49,16 @@ namespace opensaml {
             ~RegistrationAuthorityEntityMatcher() {}
 
             bool matches(const EntityDescriptor& entity) const;
+            bool matchesGroup(const EntitiesDescriptor& group) const {
+                return _matches(group.getExtensions());
+            }
+            bool matchesIgnoringGroups(const EntityDescriptor& entity) const {
+                return _matches(entity.getExtensions());
+            }
 
         private:
+            bool _matches(const Extensions* exts) const;
+
             set<xstring> m_authorities;
             Category& m_log;
         };
@@ -90,42 +94,27 @@ RegistrationAuthorityEntityMatcher::RegistrationAuthorityEntityMatcher(const DOM
 
 bool RegistrationAuthorityEntityMatcher::matches(const EntityDescriptor& entity) const
 {
-    bool extFound = false;
-
-    const Extensions* exts = entity.getExtensions();
-    if (exts) {
-        const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
-        const XMLObject* xo = find_if(children, ll_dynamic_cast<RegistrationInfo*>(_1) != ((RegistrationInfo*)nullptr));
-        if (xo) {
-            extFound = true;
-            const RegistrationInfo* regInfo = dynamic_cast<const RegistrationInfo*>(xo);
-            if (regInfo->getRegistrationAuthority() && m_authorities.find(regInfo->getRegistrationAuthority()) != m_authorities.end()) {
-                return true;
-            }
+    if (matchesWithGroups(entity))
+        return true;
+
+    if (m_log.isDebugEnabled()) {
+        bool extFound = findExtension<RegistrationInfo>(entity.getExtensions()) != nullptr;
+        const EntitiesDescriptor* group = metadata_cast<EntitiesDescriptor>(entity.getParent());
+        while (group && !extFound) {
+            extFound = findExtension<RegistrationInfo>(group->getExtensions()) != nullptr;
+            group = metadata_cast<EntitiesDescriptor>(group->getParent());
         }
-    }
-
-    const EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(entity.getParent());
-    while (group) {
-        exts = group->getExtensions();
-        if (exts) {
-            const vector<XMLObject*>& children = exts->getUnknownXMLObjects();
-            const XMLObject* xo = find_if(children, ll_dynamic_cast<RegistrationInfo*>(_1) != ((RegistrationInfo*)nullptr));
-            if (xo) {
-                extFound = true;
-                const RegistrationInfo* regInfo = dynamic_cast<const RegistrationInfo*>(xo);
-                if (regInfo->getRegistrationAuthority() && m_authorities.find(regInfo->getRegistrationAuthority()) != m_authorities.end()) {
-                    return true;
-                }
-            }
+        if (!extFound) {
+            auto_ptr_char id (entity.getEntityID());
+            m_log.debug("no RegistrationAuthority extension found for (%s)", id.get());
         }
-        group = dynamic_cast<EntitiesDescriptor*>(group->getParent());
-    }
-
-    if (!extFound && m_log.isDebugEnabled()) {
-        auto_ptr_char id (entity.getEntityID());
-        m_log.debug("no RegistrationAuthority extension found for (%s)", id.get());
     }
 
     return false;
 }
+
+bool RegistrationAuthorityEntityMatcher::_matches(const Extensions* exts) const
+{
+    const RegistrationInfo* regInfo = findExtension<RegistrationInfo>(exts);
+    return regInfo && regInfo->getRegistrationAuthority() && m_authorities.find(regInfo->getRegistrationAuthority()) != m_authorities.end();
+}
@@ -29,6 +29,8 @@
 #include "saml2/metadata/MetadataFilter.h"
 #include "signature/SignatureProfileValidator.h"
 
+#include <boost/lambda/bind.hpp>
+#include <boost/lambda/lambda.hpp>
 #include <xmltooling/logging.h>
 #include <xmltooling/XMLToolingConfig.h>
 #include <xmltooling/security/Credential.h>
@@ -44,6 +46,8 @@ using namespace opensaml;
 using namespace xmlsignature;
 using namespace xmltooling::logging;
 using namespace xmltooling;
+using namespace boost::lambda;
+using namespace boost;
 using namespace std;
 
 using boost::scoped_ptr;
@@ -64,6 +68,9 @@ namespace opensaml {
             void doFilter(EntitiesDescriptor& entities, bool rootObject=false) const;
             void doFilter(EntityDescriptor& entity, bool rootObject=false) const;
             void verifySignature(Signature* sig, const XMLCh* peerName) const;
+            bool rejectGroup(EntitiesDescriptor* group) const;
+            bool rejectEntity(EntityDescriptor* entity) const;
+            bool rejectRole(const EntityDescriptor* entity, const char* kind, RoleDescriptor* role) const;
 
             bool m_verifyRoles,m_verifyName,m_verifyBackup;
             scoped_ptr<CredentialResolver> m_credResolver,m_dummyResolver;
@@ -144,28 +151,28 @@ void SignatureMetadataFilter::doFilter(const MetadataFilterContext* ctx, XMLObje
         return;
     }
 
-    try {
-        EntitiesDescriptor& entities = dynamic_cast<EntitiesDescriptor&>(xmlObject);
-        doFilter(entities, true);
-        return;
-    }
-    catch (bad_cast&) {
-    }
-    catch (exception& ex) {
-        m_log.warn("filtering out group at root of instance after failed signature check: %s", ex.what());
-        throw MetadataFilterException("SignatureMetadataFilter unable to verify signature at root of metadata instance.");
+    EntitiesDescriptor* entities = metadata_cast<EntitiesDescriptor>(&xmlObject);
+    if (entities) {
+        try {
+            doFilter(*entities, true);
+            return;
+        }
+        catch (exception& ex) {
+            m_log.warn("filtering out group at root of instance after failed signature check: %s", ex.what());
+            throw MetadataFilterException("SignatureMetadataFilter unable to verify signature at root of metadata instance.");
+        }
     }
 
-    try {
-        EntityDescriptor& entity = dynamic_cast<EntityDescriptor&>(xmlObject);
-        doFilter(entity, true);
-        return;
-    }
-    catch (bad_cast&) {
-    }
-    catch (exception& ex) {
-        m_log.warn("filtering out entity at root of instance after failed signature check: %s", ex.what());
-        throw MetadataFilterException("SignatureMetadataFilter unable to verify signature at root of metadata instance.");
+    EntityDescriptor* entity = metadata_cast<EntityDescriptor>(&xmlObject);
+    if (entity) {
+        try {
+            doFilter(*entity, true);
+            return;
+        }
+        catch (exception& ex) {
+            m_log.warn("filtering out entity at root of instance after failed signature check: %s", ex.what());
+            throw MetadataFilterException("SignatureMetadataFilter unable to verify signature at root of metadata instance.");
+        }
     }
 
     throw MetadataFilterException("SignatureMetadataFilter was given an improper metadata instance to filter.");
@@ -178,178 +185,78 @@ void SignatureMetadataFilter::doFilter(EntitiesDescriptor& entities, bool rootOb
         throw MetadataFilterException("Root metadata element was unsigned.");
     verifySignature(sig, entities.getName());
 
-    VectorOf(EntityDescriptor) v = entities.getEntityDescriptors();
-    for (VectorOf(EntityDescriptor)::size_type i = 0; i < v.size(); ) {
-        try {
-            doFilter(*(v[i]));
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(v[i]->getEntityID());
-            m_log.warn("filtering out entity (%s) after failed signature check: %s", id.get(), e.what());
-            v.erase(v.begin() + i);
-        }
-    }
-
-    VectorOf(EntitiesDescriptor) w = entities.getEntitiesDescriptors();
-    for (VectorOf(EntitiesDescriptor)::size_type j = 0; j < w.size(); ) {
-        try {
-            doFilter(*w[j], false);
-            j++;
-        }
-        catch (exception& e) {
-            auto_ptr_char name(w[j]->getName());
-            m_log.warn("filtering out group (%s) after failed signature check: %s", name.get(), e.what());
-            w.erase(w.begin() + j);
-        }
-    }
+    const EntitiesDescriptor& group = entities;
+    removeChildren(entities, group.getEntityDescriptors(), lambda::bind(&SignatureMetadataFilter::rejectEntity, this, _1));
+    removeChildren(entities, group.getEntitiesDescriptors(), lambda::bind(&SignatureMetadataFilter::rejectGroup, this, _1));
 }
 
-void SignatureMetadataFilter::doFilter(EntityDescriptor& entity, bool rootObject) const
+bool SignatureMetadataFilter::rejectGroup(EntitiesDescriptor* group) const
 {
-    Signature* sig = entity.getSignature();
-    if (!sig && rootObject)
-        throw MetadataFilterException("Root metadata element was unsigned.");
-    verifySignature(sig, entity.getEntityID());
-
-    if (!m_verifyRoles)
-        return;
-
-    VectorOf(IDPSSODescriptor) idp = entity.getIDPSSODescriptors();
-    for (VectorOf(IDPSSODescriptor)::size_type i = 0; i < idp.size(); ) {
-        try {
-            verifySignature(idp[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out IDPSSODescriptor for entity (%s) after failed signature check: %s", id.get(), e.what()
-                );
-            idp.erase(idp.begin() + i);
-        }
+    try {
+        doFilter(*group, false);
+        return false;
     }
-
-    VectorOf(SPSSODescriptor) sp = entity.getSPSSODescriptors();
-    for (VectorOf(SPSSODescriptor)::size_type i = 0; i < sp.size(); ) {
-        try {
-            verifySignature(sp[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out SPSSODescriptor for entity (%s) after failed signature check: %s", id.get(), e.what()
-                );
-            sp.erase(sp.begin() + i);
-        }
+    catch (exception& e) {
+        auto_ptr_char name(group->getName());
+        m_log.warn("filtering out group (%s) after failed signature check: %s", name.get(), e.what());
     }
+    return true;
+}
 
-    VectorOf(AuthnAuthorityDescriptor) authn = entity.getAuthnAuthorityDescriptors();
-    for (VectorOf(AuthnAuthorityDescriptor)::size_type i = 0; i < authn.size(); ) {
-        try {
-            verifySignature(authn[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out AuthnAuthorityDescriptor for entity (%s) after failed signature check: %s", id.get(), e.what()
-                );
-            authn.erase(authn.begin() + i);
-        }
+bool SignatureMetadataFilter::rejectEntity(EntityDescriptor* entity) const
+{
+    try {
+        doFilter(*entity);
+        return false;
     }
-
-    VectorOf(AttributeAuthorityDescriptor) aa = entity.getAttributeAuthorityDescriptors();
-    for (VectorOf(AttributeAuthorityDescriptor)::size_type i = 0; i < aa.size(); ) {
-        try {
-            verifySignature(aa[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out AttributeAuthorityDescriptor for entity (%s) after failed signature check: %s", id.get(), e.what()
-                );
-            aa.erase(aa.begin() + i);
-        }
+    catch (exception& e) {
+        auto_ptr_char id(entity->getEntityID());
+        m_log.warn("filtering out entity (%s) after failed signature check: %s", id.get(), e.what());
     }
+    return true;
+}
 
-    VectorOf(PDPDescriptor) pdp = entity.getPDPDescriptors();
-    for (VectorOf(AuthnAuthorityDescriptor)::size_type i = 0; i < pdp.size(); ) {
-        try {
-            verifySignature(pdp[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out PDPDescriptor for entity (%s) after failed signature check: %s", id.get(), e.what()
-                );
-            pdp.erase(pdp.begin() + i);
-        }
+bool SignatureMetadataFilter::rejectRole(const EntityDescriptor* entity, const char* kind, RoleDescriptor* role) const
+{
+    try {
+        verifySignature(role->getSignature(), entity->getEntityID());
+        return false;
     }
-
-    VectorOf(AuthnQueryDescriptorType) authnq = entity.getAuthnQueryDescriptorTypes();
-    for (VectorOf(AuthnQueryDescriptorType)::size_type i = 0; i < authnq.size(); ) {
-        try {
-            verifySignature(authnq[i]->getSignature(), entity.getEntityID());
-            i++;
+    catch (exception& e) {
+        auto_ptr_char id(entity->getEntityID());
+        if (kind) {
+            m_log.warn("filtering out %s for entity (%s) after failed signature check: %s", kind, id.get(), e.what());
         }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
+        else {
             m_log.warn(
-                "filtering out AuthnQueryDescriptorType for entity (%s) after failed signature check: %s", id.get(), e.what()
+                "filtering out role (%s) for entity (%s) after failed signature check: %s",
+                role->getElementQName().toString().c_str(), id.get(), e.what()
                 );
-            authnq.erase(authnq.begin() + i);
         }
     }
+    return true;
+}
 
-    VectorOf(AttributeQueryDescriptorType) attrq = entity.getAttributeQueryDescriptorTypes();
-    for (VectorOf(AttributeQueryDescriptorType)::size_type i = 0; i < attrq.size(); ) {
-        try {
-            verifySignature(attrq[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out AttributeQueryDescriptorType for entity (%s) after failed signature check: %s", id.get(), e.what()
-                );
-            attrq.erase(attrq.begin() + i);
-        }
-    }
+void SignatureMetadataFilter::doFilter(EntityDescriptor& entity, bool rootObject) const
+{
+    Signature* sig = entity.getSignature();
+    if (!sig && rootObject)
+        throw MetadataFilterException("Root metadata element was unsigned.");
+    verifySignature(sig, entity.getEntityID());
 
-    VectorOf(AuthzDecisionQueryDescriptorType) authzq = entity.getAuthzDecisionQueryDescriptorTypes();
-    for (VectorOf(AuthzDecisionQueryDescriptorType)::size_type i = 0; i < authzq.size(); ) {
-        try {
-            verifySignature(authzq[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out AuthzDecisionQueryDescriptorType for entity (%s) after failed signature check: %s", id.get(), e.what()
-                );
-            authzq.erase(authzq.begin() + i);
-        }
-    }
+    if (!m_verifyRoles)
+        return;
 
-    VectorOf(RoleDescriptor) v = entity.getRoleDescriptors();
-    for (VectorOf(RoleDescriptor)::size_type i = 0; i < v.size(); ) {
-        try {
-            verifySignature(v[i]->getSignature(), entity.getEntityID());
-            i++;
-        }
-        catch (exception& e) {
-            auto_ptr_char id(entity.getEntityID());
-            m_log.warn(
-                "filtering out role (%s) for entity (%s) after failed signature check: %s",
-                v[i]->getElementQName().toString().c_str(), id.get(), e.what()
-                );
-            v.erase(v.begin() + i);
-        }
-    }
+    const EntityDescriptor& e = entity;
+    removeChildren(entity, e.getIDPSSODescriptors(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "IDPSSODescriptor", _1));
+    removeChildren(entity, e.getSPSSODescriptors(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "SPSSODescriptor", _1));
+    removeChildren(entity, e.getAuthnAuthorityDescriptors(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "AuthnAuthorityDescriptor", _1));
+    removeChildren(entity, e.getAttributeAuthorityDescriptors(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "AttributeAuthorityDescriptor", _1));
+    removeChildren(entity, e.getPDPDescriptors(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "PDPDescriptor", _1));
+    removeChildren(entity, e.getAuthnQueryDescriptorTypes(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "AuthnQueryDescriptorType", _1));
+    removeChildren(entity, e.getAttributeQueryDescriptorTypes(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "AttributeQueryDescriptorType", _1));
+    removeChildren(entity, e.getAuthzDecisionQueryDescriptorTypes(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, "AuthzDecisionQueryDescriptorType", _1));
+    removeChildren(entity, e.getRoleDescriptors(), lambda::bind(&SignatureMetadataFilter::rejectRole, this, &entity, static_cast<const char*>(nullptr), _1));
 
     if (entity.getAffiliationDescriptor()) {
         try {
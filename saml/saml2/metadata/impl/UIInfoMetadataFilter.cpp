@@ -46,18 +46,16 @@ using namespace std;
 namespace opensaml {
     namespace saml2md {
 
-        class SAML_DLLLOCAL UIInfoMetadataFilter : public MetadataFilter
+        class SAML_DLLLOCAL UIInfoMetadataFilter : public EntityMetadataFilter
         {
         public:
             UIInfoMetadataFilter(const DOMElement* e);
             ~UIInfoMetadataFilter() {}
 
             const char* getId() const { return UIINFO_METADATA_FILTER; }
-            void doFilter(const MetadataFilterContext* ctx, XMLObject& xmlObject) const;
+            bool filterEntity(const MetadataFilterContext* ctx, EntityDescriptor& entity) const;
 
         private:
-            void filterEntity(EntityDescriptor* entity) const;
-            void filterGroup(EntitiesDescriptor* entities) const;
             Extensions* getContainer(IDPSSODescriptor* entity) const;
 
             Category& m_log;
@@ -92,6 +90,8 @@ UIInfoMetadataFilter::UIInfoMetadataFilter(const DOMElement* e)
     while (child) {
         if (XMLHelper::isNodeNamed(child, samlconstants::SAML20MD_UI_NS, UIInfo::LOCAL_NAME)) {
             boost::shared_ptr<XMLObject> obj(UIInfoBuilder::buildOneFromElement(child));
+            // Without a DOM to clone, each copy is made directly from the object tree.
+            obj->releaseThisAndChildrenDOM();
             m_infos.push_back(boost::dynamic_pointer_cast<UIInfo>(obj));
             lastSeen = m_infos.back().get();
         }
@@ -112,45 +112,16 @@ UIInfoMetadataFilter::UIInfoMetadataFilter(const DOMElement* e)
     }
 }
 
-void UIInfoMetadataFilter::doFilter(const MetadataFilterContext*, XMLObject& xmlObject) const
+bool UIInfoMetadataFilter::filterEntity(const MetadataFilterContext*, EntityDescriptor& entity) const
 {
-    if (m_applyMap.empty())
-        return;
+    if (m_applyMap.empty() || !entity.getEntityID())
+        return false;
 
-    EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(&xmlObject);
-    if (group) {
-        filterGroup(group);
-    }
-    else {
-        EntityDescriptor* entity = dynamic_cast<EntityDescriptor*>(&xmlObject);
-        if (entity) {
-            filterEntity(entity);
-        }
-        else {
-            throw MetadataFilterException(UIINFO_METADATA_FILTER " MetadataFilter was given an improper metadata instance to filter.");
-        }
-    }
-}
-
-void UIInfoMetadataFilter::filterGroup(EntitiesDescriptor* entities) const
-{
-    const vector<EntityDescriptor*>& v = const_cast<const EntitiesDescriptor*>(entities)->getEntityDescriptors();
-    for_each(v.begin(), v.end(), lambda::bind(&UIInfoMetadataFilter::filterEntity, this, _1));
-
-    const vector<EntitiesDescriptor*>& v2 = const_cast<const EntitiesDescriptor*>(entities)->getEntitiesDescriptors();
-    for_each(v2.begin(), v2.end(), lambda::bind(&UIInfoMetadataFilter::filterGroup, this, _1));
-}
-
-void UIInfoMetadataFilter::filterEntity(EntityDescriptor* entity) const
-{
-    if (!entity->getEntityID())
-        return;
-
-    applymap_t::const_iterator uiinfo = m_applyMap.find(entity->getEntityID());
+    applymap_t::const_iterator uiinfo = m_applyMap.find(entity.getEntityID());
     if (uiinfo == m_applyMap.end())
-        return;
+        return false;
 
-    VectorOf(IDPSSODescriptor) roles = entity->getIDPSSODescriptors();
+    VectorOf(IDPSSODescriptor) roles = entity.getIDPSSODescriptors();
     for (VectorOf(IDPSSODescriptor)::iterator i = roles.begin(); i != roles.end(); ++i) {
         Extensions* ext = getContainer(*i);
         if (ext) {
@@ -159,6 +130,7 @@ void UIInfoMetadataFilter::filterEntity(EntityDescriptor* entity) const
             dup.release();
         }
     }
+    return false;
 }
 
 Extensions* UIInfoMetadataFilter::getContainer(IDPSSODescriptor* role) const
@@ -171,7 +143,7 @@ Extensions* UIInfoMetadataFilter::getContainer(IDPSSODescriptor* role) const
 
     VectorOf(XMLObject) children = exts->getUnknownXMLObjects();
     for (VectorOf(XMLObject)::iterator i = children.begin(); i != children.end(); ++i) {
-        if (dynamic_cast<UIInfo*>(*i)) {
+        if (metadata_cast<UIInfo>(*i)) {
             if (!m_replace)
                 return nullptr;
             children.erase(i);
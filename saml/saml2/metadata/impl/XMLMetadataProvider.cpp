@@ -30,8 +30,11 @@
 #include "saml2/metadata/MetadataFilter.h"
 #include "saml2/metadata/AbstractMetadataProvider.h"
 #include "saml2/metadata/DiscoverableMetadataProvider.h"
+#include "saml2/metadata/MetadataScheduler.h"
 
 #include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <xmltooling/XMLToolingConfig.h>
 #include <xmltooling/io/HTTPResponse.h>
 #include <xmltooling/util/NDC.h>
@@ -67,7 +70,12 @@ namespace opensaml {
             XMLMetadataProvider(const DOMElement* e, bool deprecationSupport=true);
 
             virtual ~XMLMetadataProvider() {
+                stopChangeEvents();
+                if (m_reloadTask)
+                    MetadataScheduler::getScheduler().cancel(m_reloadTask.get());
                 shutdown();
+                // Stops any credential preloading before the metadata it reads is freed.
+                clearDescriptorIndex();
             }
 
             void init();
@@ -82,6 +90,11 @@ namespace opensaml {
                 return m_object.get();
             }
 
+            bool getIndexKeys(set<string>& entityIDs, set<string>& sources) const {
+                // Nothing is known about the content until a load has succeeded.
+                return m_object && AbstractMetadataProvider::getIndexKeys(entityIDs, sources);
+            }
+
         protected:
             pair<bool,DOMElement*> load(bool backup, string backingFile);
             pair<bool,DOMElement*> background_load();
@@ -89,9 +102,21 @@ namespace opensaml {
         private:
             void index(time_t& validUntil);
             time_t computeNextRefresh();
+            void startMaintenance();
+            time_t scheduledReload();
+
+            class SAML_DLLLOCAL ReloadTask : public MetadataScheduler::Task {
+            public:
+                ReloadTask(XMLMetadataProvider& provider) : m_provider(provider) {}
+                const char* getId() const { return m_provider.getId(); }
+                time_t run() { return m_provider.scheduledReload(); }
+            private:
+                XMLMetadataProvider& m_provider;
+            };
 
             scoped_ptr<XMLObject> m_object;
-            bool m_discoveryFeed,m_dropDOM;
+            scoped_ptr<ReloadTask> m_reloadTask;
+            bool m_discoveryFeed,m_dropDOM,m_sharedMaintenance,m_initialized;
             double m_refreshDelayFactor;
             unsigned int m_backoffFactor;
             time_t m_minRefreshDelay,m_maxRefreshDelay,m_lastValidUntil;
@@ -106,6 +131,7 @@ namespace opensaml {
         static const XMLCh dropDOM[] =              UNICODE_LITERAL_7(d,r,o,p,D,O,M);
         static const XMLCh minRefreshDelay[] =      UNICODE_LITERAL_15(m,i,n,R,e,f,r,e,s,h,D,e,l,a,y);
         static const XMLCh refreshDelayFactor[] =   UNICODE_LITERAL_18(r,e,f,r,e,s,h,D,e,l,a,y,F,a,c,t,o,r);
+        static const XMLCh sharedMaintenance[] =    UNICODE_LITERAL_17(s,h,a,r,e,d,M,a,i,n,t,e,n,a,n,c,e);
 
     };
 };
@@ -119,6 +145,7 @@ XMLMetadataProvider::XMLMetadataProvider(const DOMElement* e, bool deprecationSu
         ReloadableXMLFile(e, Category::getInstance(SAML_LOGCAT ".MetadataProvider.XML"), false, deprecationSupport),
         m_discoveryFeed(XMLHelper::getAttrBool(e, true, discoveryFeed)),
         m_dropDOM(XMLHelper::getAttrBool(e, true, dropDOM)),
+        m_sharedMaintenance(XMLHelper::getAttrBool(e, false, sharedMaintenance)), m_initialized(false),
         m_refreshDelayFactor(0.75), m_backoffFactor(1),
         m_minRefreshDelay(XMLHelper::getAttrInt(e, 600, minRefreshDelay)),
         m_maxRefreshDelay(m_reloadInterval), m_lastValidUntil(SAMLTIME_MAX)
@@ -149,11 +176,14 @@ void XMLMetadataProvider::init()
             threadid += m_id + ']';
             logging::NDC::push(threadid);
         }
+        startChangeEvents();
         background_load();
-        startup();
+        m_initialized = true;
+        startMaintenance();
     }
     catch (...) {
-        startup();
+        m_initialized = true;
+        startMaintenance();
         if (!m_id.empty()) {
             logging::NDC::pop();
         }
@@ -165,6 +195,76 @@ void XMLMetadataProvider::init()
     }
 }
 
+void XMLMetadataProvider::startMaintenance()
+{
+    if (!m_sharedMaintenance) {
+        // Traditional model with a dedicated reload thread.
+        startup();
+        return;
+    }
+
+    // The lock only exists if the resource is being monitored.
+    if (m_lock && !m_reloadTask) {
+        m_reloadTask.reset(new ReloadTask(*this));
+        MetadataScheduler::getScheduler().schedule(m_reloadTask.get(), m_reloadInterval > 0 ? m_reloadInterval : 60, true);
+        m_log.info("registered %s resource for shared background maintenance", m_local ? "local" : "remote");
+    }
+}
+
+time_t XMLMetadataProvider::scheduledReload()
+{
+    if (!m_id.empty()) {
+        string threadid("[");
+        threadid += m_id + ']';
+        logging::NDC::push(threadid);
+    }
+
+    bool reload = true;
+    if (m_local) {
+#ifdef WIN32
+        struct _stat stat_buf;
+        if (_stat(m_source.c_str(), &stat_buf) != 0)
+#else
+        struct stat stat_buf;
+        if (stat(m_source.c_str(), &stat_buf) != 0)
+#endif
+        {
+            reload = false;
+        }
+        else if (m_filestamp >= stat_buf.st_mtime) {
+            reload = false;
+        }
+        else {
+            // Record the new timestamp under the lock, then let the load process lock as needed.
+            m_lock->wrlock();
+            if (m_filestamp >= stat_buf.st_mtime)
+                reload = false;
+            else
+                m_filestamp = stat_buf.st_mtime;
+            m_lock->unlock();
+        }
+    }
+
+    if (reload) {
+        m_log.info("reloading %s metadata resource...", m_local ? "local" : "remote");
+        try {
+            background_load();
+        }
+        catch (long) {
+            // The refresh interval was already adjusted.
+        }
+        catch (const std::exception& ex) {
+            m_log.crit("maintaining existing metadata, exception reloading resource: %s", ex.what());
+        }
+    }
+
+    if (!m_id.empty()) {
+        logging::NDC::pop();
+    }
+
+    return m_reloadInterval > 0 ? m_reloadInterval : 60;
+}
+
 pair<bool,DOMElement*> XMLMetadataProvider::load(bool backup, string backingFile)
 {
     if (!backup) {
@@ -247,7 +347,8 @@ pair<bool,DOMElement*> XMLMetadataProvider::load(bool backup, string backingFile
     if (m_lock)
         m_lock->wrlock();
     SharedLock locker(m_lock, false);
-    bool changed = m_object!=nullptr;
+    // A first load that only succeeds after init is still news to observers.
+    bool changed = m_object || m_initialized;
     m_object.swap(xmlObject);
     m_lastValidUntil = SAMLTIME_MAX;
     index(m_lastValidUntil);
@@ -370,5 +471,7 @@ void XMLMetadataProvider::outputStatus(ostream& os) const
         os << " reloadInterval='" << m_reloadInterval << "'";
     }
 
+    outputPreloadStatus(os);
+
     os << "/>";
 }
@@ -0,0 +1,553 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#include "internal.h"
+#include <saml/SAMLConfig.h>
+#include <saml/saml2/metadata/DiscoverableMetadataProvider.h>
+#include <saml/saml2/metadata/Metadata.h>
+#include <saml/saml2/metadata/MetadataCredentialCriteria.h>
+#include <saml/saml2/metadata/MetadataProvider.h>
+#include <saml/saml2/metadata/ObservableMetadataProvider.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+#include <sys/types.h>
+#ifdef WIN32
+# include <sys/utime.h>
+#else
+# include <utime.h>
+#endif
+#include <xmltooling/security/Credential.h>
+#include <xmltooling/security/KeyInfoResolver.h>
+#include <xmltooling/security/SecurityHelper.h>
+#include <xmltooling/security/X509Credential.h>
+#include <xmltooling/signature/KeyInfo.h>
+#include <xmltooling/util/Threads.h>
+
+using namespace opensaml::saml2md;
+using namespace opensaml;
+
+class ChainingMetadataProviderTest : public CxxTest::TestSuite, public SAMLObjectBaseTestCase {
+    XMLCh* entityID;
+    XMLCh* entityID2;
+    XMLCh* sharedID;
+    XMLCh* missingID;
+
+    // A metadata file in the temporary directory, removed when it goes out of scope.
+    class ScratchFile {
+    public:
+        ScratchFile(const char* name) : m_stamp(0) {
+            const char* dir = getenv("TMPDIR");
+            if (!dir)
+                dir = getenv("TEMP");
+            if (!dir)
+                dir = getenv("TMP");
+            XMLCh* id = SAMLConfig::getConfig().generateIdentifier();
+            auto_ptr_char unique(id);
+            XMLString::release(&id);
+            m_path = string(dir ? dir : "/tmp") + "/samltest" + unique.get() + '-' + name;
+        }
+
+        ~ScratchFile() {
+            remove(m_path.c_str());
+        }
+
+        const string& path() const {
+            return m_path;
+        }
+
+        // Replaces the content and moves the timestamp ahead, so a reload sees a change without waiting out the clock.
+        void write(const string& content) {
+            {
+                ofstream out(m_path.c_str());
+                out << content;
+            }
+            m_stamp = max(time(nullptr) + 2, m_stamp + 1);
+#ifdef WIN32
+            struct _utimbuf times;
+            times.actime = times.modtime = m_stamp;
+            _utime(m_path.c_str(), &times);
+#else
+            struct utimbuf times;
+            times.actime = times.modtime = m_stamp;
+            utime(m_path.c_str(), &times);
+#endif
+        }
+
+        void copy(const string& source) {
+            ifstream in(source.c_str());
+            ostringstream content;
+            content << in.rdbuf();
+            write(content.str());
+        }
+
+    private:
+        string m_path;
+        time_t m_stamp;
+    };
+
+    // Counts the change events a provider raises, so tests can wait for a reload rather than sleep through it.
+    class ChangeWaiter : public ObservableMetadataProvider::Observer {
+    public:
+        ChangeWaiter() : m_count(0), m_lock(Mutex::create()), m_changed(CondWait::create()) {}
+
+        void onEvent(const ObservableMetadataProvider&) const {
+            Lock lock(m_lock);
+            ++m_count;
+            m_changed->broadcast();
+        }
+
+        int count() const {
+            Lock lock(m_lock);
+            return m_count;
+        }
+
+        // Waits up to thirty seconds for the count to pass the given one.
+        bool waitPast(int count) const {
+            Lock lock(m_lock);
+            time_t deadline = time(nullptr) + 30;
+            while (m_count <= count && time(nullptr) < deadline)
+                m_changed->timedwait(m_lock.get(), 1);
+            return m_count > count;
+        }
+
+    private:
+        mutable int m_count;
+        scoped_ptr<Mutex> m_lock;
+        scoped_ptr<CondWait> m_changed;
+    };
+
+    MetadataProvider* buildChain() {
+        string config = data_path + "saml2/metadata/ChainingMetadataProvider.xml";
+        ifstream in(config.c_str());
+        return buildChain(in);
+    }
+
+    MetadataProvider* buildChain(istream& in) {
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        XercesJanitor<DOMDocument> janitor(doc);
+
+        auto_ptr<MetadataProvider> metadataProvider(
+            SAMLConfig::getConfig().MetadataProviderManager.newPlugin(CHAINING_METADATA_PROVIDER, doc->getDocumentElement(), false)
+            );
+        try {
+            metadataProvider->init();
+        }
+        catch (const XMLToolingException& ex) {
+            TS_TRACE(ex.what());
+            throw;
+        }
+        return metadataProvider.release();
+    }
+
+public:
+    void setUp() {
+        entityID=XMLString::transcode("https://idp1.example.org/idp/shibboleth");
+        entityID2=XMLString::transcode("https://idp4.example.org/idp/shibboleth");
+        sharedID=XMLString::transcode("https://shared.example.org/idp/shibboleth");
+        missingID=XMLString::transcode("https://missing.example.org/idp/shibboleth");
+        SAMLObjectBaseTestCase::setUp();
+    }
+
+    void tearDown() {
+        XMLString::release(&entityID);
+        XMLString::release(&entityID2);
+        XMLString::release(&sharedID);
+        XMLString::release(&missingID);
+        SAMLObjectBaseTestCase::tearDown();
+    }
+
+    void testChainedLookup() {
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain());
+
+        Locker locker(metadataProvider.get());
+        const EntityDescriptor* descriptor = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(entityID,nullptr,nullptr,false)).first;
+        TSM_ASSERT("Retrieved entity descriptor was null", descriptor!=nullptr);
+        assertEquals("Entity's ID does not match requested ID", entityID, descriptor->getEntityID());
+
+        descriptor = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(entityID2,nullptr,nullptr,false)).first;
+        TSM_ASSERT("Retrieved entity descriptor was null", descriptor!=nullptr);
+        assertEquals("Entity's ID does not match requested ID", entityID2, descriptor->getEntityID());
+
+        // Last match wins, so the shared entity should come from the second file.
+        descriptor = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(sharedID,&IDPSSODescriptor::ELEMENT_QNAME,nullptr,false)).first;
+        TSM_ASSERT("Retrieved entity descriptor was null", descriptor!=nullptr);
+        const EntitiesDescriptor* group = dynamic_cast<const EntitiesDescriptor*>(descriptor->getParent());
+        TSM_ASSERT("Retrieved entity descriptor had no parent group", group!=nullptr);
+        auto_ptr_char name(group->getName());
+        TSM_ASSERT_EQUALS("Precedence did not select the last matching copy", string("urn:example:chained:2"), string(name.get()));
+
+        descriptor = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(missingID,nullptr,nullptr,false)).first;
+        TSM_ASSERT("Retrieved entity descriptor was not null", descriptor==nullptr);
+    }
+
+    void testLateChild() {
+        // The second file starts out unusable, so the child fails to initialize.
+        ScratchFile late("LateChild.xml");
+        late.write("<NotMetadata/>");
+
+        ostringstream config;
+        config << "<MetadataProvider type='Chaining'>"
+            << "<MetadataProvider type='XML' path='" << data_path << "saml2/metadata/ChainedMetadata1.xml' validate='0'/>"
+            << "<MetadataProvider type='XML' path='" << late.path() << "' validate='0' sharedMaintenance='true' minRefreshDelay='1'/>"
+            << "</MetadataProvider>";
+        istringstream in(config.str());
+        ChangeWaiter waiter;
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain(in));
+        dynamic_cast<ObservableMetadataProvider*>(metadataProvider.get())->addObserver(&waiter);
+        DiscoverableMetadataProvider* disco = dynamic_cast<DiscoverableMetadataProvider*>(metadataProvider.get());
+        TSM_ASSERT("Chaining provider was not discoverable", disco!=nullptr);
+
+        {
+            Locker locker(metadataProvider.get());
+            TSM_ASSERT("Entity found before its file was loaded",
+                metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(entityID2,nullptr,nullptr,false)).first==nullptr);
+            ostringstream feed;
+            bool first = true;
+            disco->outputFeed(feed, first);
+            TSM_ASSERT("Feed included an unloaded entity", feed.str().find("https://idp4.example.org/idp/shibboleth") == string::npos);
+        }
+
+        // Replace the file with usable metadata.
+        int events = waiter.count();
+        late.copy(data_path + "saml2/metadata/ChainedMetadata2.xml");
+        TSM_ASSERT("Chain did not report the late load", waiter.waitPast(events));
+
+        Locker locker(metadataProvider.get());
+        TSM_ASSERT("Entity was not found after its file was loaded",
+            metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(entityID2,nullptr,nullptr,false)).first!=nullptr);
+        ostringstream feed;
+        bool first = true;
+        disco->outputFeed(feed, first);
+        TSM_ASSERT("Feed was not refreshed after a late load", feed.str().find("https://idp4.example.org/idp/shibboleth") != string::npos);
+    }
+
+    void testLocationLookup() {
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain());
+
+        Locker locker(metadataProvider.get());
+        MetadataProvider::Criteria mc(static_cast<const XMLCh*>(nullptr), &IDPSSODescriptor::ELEMENT_QNAME, samlconstants::SAML20P_NS, false);
+        mc.location = "HTTPS://IdP1.Example.org:443/idp/profile/SAML2/Redirect/SSO#frag";
+        pair<const EntityDescriptor*,const RoleDescriptor*> result = metadataProvider->getEntityDescriptor(mc);
+        TSM_ASSERT("Retrieved entity descriptor was null", result.first!=nullptr);
+        assertEquals("Entity's ID does not match requested location", entityID, result.first->getEntityID());
+        TSM_ASSERT("Retrieved role was null", result.second!=nullptr && result.second->getParent()==result.first);
+
+        mc.role = &SPSSODescriptor::ELEMENT_QNAME;
+        result = metadataProvider->getEntityDescriptor(mc);
+        TSM_ASSERT("Location matched the wrong role", result.second==nullptr);
+
+        mc.role = &IDPSSODescriptor::ELEMENT_QNAME;
+        mc.location = "https://idp1.example.org/idp/profile/saml2/redirect/sso";
+        result = metadataProvider->getEntityDescriptor(mc);
+        TSM_ASSERT("Location path should be case-sensitive", result.first==nullptr);
+    }
+
+    void testKeyLookup() {
+        // The child loads from a copy, so that the key can be taken away by a reload.
+        ScratchFile keyed("KeyedChild.xml");
+        keyed.copy(data_path + "saml2/metadata/KeyedMetadata.xml");
+
+        ostringstream config;
+        config << "<MetadataProvider type='Chaining'>"
+            << "<MetadataProvider type='XML' path='" << keyed.path() << "' validate='0' indexKeys='true' sharedMaintenance='true' minRefreshDelay='1'/>"
+            << "</MetadataProvider>";
+        istringstream in(config.str());
+        ChangeWaiter waiter;
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain(in));
+        dynamic_cast<ObservableMetadataProvider*>(metadataProvider.get())->addObserver(&waiter);
+
+        string fingerprint;
+        {
+            Locker locker(metadataProvider.get());
+            auto_ptr_XMLCh keyedID("https://keyed.example.org/idp/shibboleth");
+            const EntityDescriptor* keyedEntity = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(keyedID.get(),nullptr,nullptr,false)).first;
+            TSM_ASSERT("Keyed entity was not loaded", keyedEntity!=nullptr);
+            const xmlsignature::KeyInfo* keyInfo = keyedEntity->getIDPSSODescriptors().front()->getKeyDescriptors().front()->getKeyInfo();
+            scoped_ptr<Credential> cred(XMLToolingConfig::getConfig().getKeyInfoResolver()->resolve(keyInfo));
+            TSM_ASSERT("Key was not resolved", cred.get()!=nullptr);
+            fingerprint = SecurityHelper::getDEREncoding(*cred, "SHA256");
+
+            MetadataProvider::Criteria mc(static_cast<const XMLCh*>(nullptr), nullptr, nullptr, false);
+            mc.keyFingerprint = fingerprint.c_str();
+            pair<const EntityDescriptor*,const RoleDescriptor*> result = metadataProvider->getEntityDescriptor(mc);
+            TSM_ASSERT("Retrieved entity descriptor was null", result.first!=nullptr);
+            assertEquals("Entity's ID does not match requested key", keyedID.get(), result.first->getEntityID());
+            TSM_ASSERT("Role containing the key was not returned",
+                dynamic_cast<const IDPSSODescriptor*>(result.second)!=nullptr && result.second->getParent()==result.first);
+
+            mc.keyUsage = Credential::SIGNING_CREDENTIAL;
+            result = metadataProvider->getEntityDescriptor(mc);
+            TSM_ASSERT("Signing key was not found for signing", result.first!=nullptr);
+
+            mc.keyUsage = Credential::ENCRYPTION_CREDENTIAL;
+            result = metadataProvider->getEntityDescriptor(mc);
+            TSM_ASSERT("Signing key was found for encryption", result.first==nullptr);
+
+            mc.keyUsage = 0;
+            mc.role = &SPSSODescriptor::ELEMENT_QNAME;
+            mc.protocol = samlconstants::SAML20P_NS;
+            result = metadataProvider->getEntityDescriptor(mc);
+            TSM_ASSERT("Key matched the wrong role", result.first==nullptr);
+
+            mc.role = &IDPSSODescriptor::ELEMENT_QNAME;
+            result = metadataProvider->getEntityDescriptor(mc);
+            TSM_ASSERT("Key was not found in its role", result.first!=nullptr);
+        }
+
+        // Replace the file with keyless metadata.
+        int events = waiter.count();
+        keyed.copy(data_path + "saml2/metadata/ChainedMetadata2.xml");
+        TSM_ASSERT("Chain did not report the reload", waiter.waitPast(events));
+
+        Locker locker(metadataProvider.get());
+        MetadataProvider::Criteria mc(static_cast<const XMLCh*>(nullptr), nullptr, nullptr, false);
+        mc.keyFingerprint = fingerprint.c_str();
+        TSM_ASSERT("Key was still indexed after a reload", metadataProvider->getEntityDescriptor(mc).first==nullptr);
+    }
+
+    // Resolves the IdP credentials of both shared-key entities, checking they share one parsed certificate.
+    void checkSharedCredentials(MetadataProvider* metadataProvider, const EntityDescriptor* entities[2]) {
+        const char* ids[2] = { "https://shared1.example.org/idp/shibboleth", "https://shared2.example.org/idp/shibboleth" };
+        const X509Credential* creds[2];
+        for (int i = 0; i < 2; ++i) {
+            auto_ptr_XMLCh id(ids[i]);
+            entities[i] = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(id.get(),nullptr,nullptr,false)).first;
+            TSM_ASSERT("Retrieved entity descriptor was null", entities[i]!=nullptr);
+            MetadataCredentialCriteria mcc(*entities[i]->getIDPSSODescriptors().front());
+            creds[i] = dynamic_cast<const X509Credential*>(metadataProvider->resolve(&mcc));
+            TSM_ASSERT("Role credential was not resolved", creds[i]!=nullptr && creds[i]->getEntityCertificate()!=nullptr);
+        }
+        TSM_ASSERT("Preloaded roles did not share the certificate", creds[0]->getEntityCertificate()==creds[1]->getEntityCertificate());
+    }
+
+    // Waits up to thirty seconds for a provider to report the given number of roles as preloaded.
+    bool waitForPreload(MetadataProvider* metadataProvider, int roles) {
+        ostringstream expected;
+        expected << "preloadedRoles='" << roles << "'";
+        scoped_ptr<Mutex> mutex(Mutex::create());
+        scoped_ptr<CondWait> tick(CondWait::create());
+        Lock lock(mutex.get());
+        time_t deadline = time(nullptr) + 30;
+        while (true) {
+            ostringstream status;
+            {
+                Locker locker(metadataProvider);
+                metadataProvider->outputStatus(status);
+            }
+            if (status.str().find(expected.str()) != string::npos)
+                return true;
+            if (time(nullptr) >= deadline)
+                return false;
+            tick->timedwait(mutex.get(), 1);
+        }
+    }
+
+    void testPreloadCredentials() {
+        string source = data_path + "saml2/metadata/SharedKeyMetadata.xml";
+        ScratchFile preloaded("PreloadChild.xml");
+        preloaded.copy(source);
+
+        ostringstream config;
+        config << "<MetadataProvider type='Chaining'>"
+            << "<MetadataProvider type='XML' path='" << preloaded.path() << "' validate='0' preloadCredentials='IDPSSODescriptor'"
+            << " sharedMaintenance='true' minRefreshDelay='1'/>"
+            << "</MetadataProvider>";
+        istringstream in(config.str());
+        ChangeWaiter waiter;
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain(in));
+        dynamic_cast<ObservableMetadataProvider*>(metadataProvider.get())->addObserver(&waiter);
+
+        // Only a preload marks roles as preloaded, and nothing has asked for a credential yet.
+        TSM_ASSERT("Credentials were not preloaded", waitForPreload(metadataProvider.get(), 2));
+        const EntityDescriptor* entities[2];
+        {
+            Locker locker(metadataProvider.get());
+            checkSharedCredentials(metadataProvider.get(), entities);
+        }
+
+        // A reload cancels whatever is queued for the old entities and preloads the new ones.
+        int events = waiter.count();
+        preloaded.copy(source);
+        TSM_ASSERT("Metadata was not reloaded", waiter.waitPast(events));
+        TSM_ASSERT("Reloaded credentials were not preloaded", waitForPreload(metadataProvider.get(), 2));
+
+        Locker locker(metadataProvider.get());
+        const EntityDescriptor* reloaded[2];
+        checkSharedCredentials(metadataProvider.get(), reloaded);
+        TSM_ASSERT("Metadata was not replaced", reloaded[0] != entities[0]);
+    }
+
+    void testPreloadCancellation() {
+        // Many roles with distinctly named keys keep the preload busy while the provider is torn down.
+        string cert = "MIICjzCCAfigAwIBAgIJAKk8t1hYcMkhMA0GCSqGSIb3DQEBBAUAMDoxCzAJBgNV"
+            "BAYTAlVTMRIwEAYDVQQKEwlJbnRlcm5ldDIxFzAVBgNVBAMTDnNwLmV4YW1wbGUu"
+            "b3JnMB4XDTA1MDYyMDE1NDgzNFoXDTMyMTEwNTE1NDgzNFowOjELMAkGA1UEBhMC"
+            "VVMxEjAQBgNVBAoTCUludGVybmV0MjEXMBUGA1UEAxMOc3AuZXhhbXBsZS5vcmcw"
+            "gZ8wDQYJKoZIhvcNAQEBBQADgY0AMIGJAoGBANlZ1L1mKzYbUVKiMQLhZlfGDyYa"
+            "/jjCiaXP0WhLNgvJpOTeajvsrApYNnFX5MLNzuC3NeQIjXUNLN2Yo2MCSthBIOL5"
+            "qE5dka4z9W9zytoflW1LmJ8vXpx8Ay/meG4z//J5iCpYVEquA0xl28HUIlownZUF"
+            "7w7bx0cF/02qrR23AgMBAAGjgZwwgZkwHQYDVR0OBBYEFJZiO1qsyAyc3HwMlL9p"
+            "JpN6fbGwMGoGA1UdIwRjMGGAFJZiO1qsyAyc3HwMlL9pJpN6fbGwoT6kPDA6MQsw"
+            "CQYDVQQGEwJVUzESMBAGA1UEChMJSW50ZXJuZXQyMRcwFQYDVQQDEw5zcC5leGFt"
+            "cGxlLm9yZ4IJAKk8t1hYcMkhMAwGA1UdEwQFMAMBAf8wDQYJKoZIhvcNAQEEBQAD"
+            "gYEAMFq/UeSQyngE0GpZueyD2UW0M358uhseYOgGEIfm+qXIFQF6MYwNoX7WFzhC"
+            "LJZ2E6mEvZZFHCHUtl7mGDvsRwgZ85YCtRbvleEpqfgNQToto9pLYe+X6vvH9Z6p"
+            "gmYsTmak+kxO93JprrOd9xp8aZPMEprL7VCdrhbZEfyYER0=";
+        ostringstream md;
+        md << "<EntitiesDescriptor xmlns='urn:oasis:names:tc:SAML:2.0:metadata' xmlns:ds='http://www.w3.org/2000/09/xmldsig#'>";
+        for (int i = 0; i < 500; ++i) {
+            md << "<EntityDescriptor entityID='https://preload" << i << ".example.org/idp'>"
+                << "<IDPSSODescriptor protocolSupportEnumeration='urn:oasis:names:tc:SAML:2.0:protocol'>"
+                << "<KeyDescriptor><ds:KeyInfo><ds:KeyName>key" << i << "</ds:KeyName>"
+                << "<ds:X509Data><ds:X509Certificate>" << cert << "</ds:X509Certificate></ds:X509Data></ds:KeyInfo></KeyDescriptor>"
+                << "<SingleSignOnService Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-Redirect' Location='https://preload" << i << ".example.org/sso'/>"
+                << "</IDPSSODescriptor></EntityDescriptor>";
+        }
+        md << "</EntitiesDescriptor>";
+        ScratchFile preloaded("PreloadMany.xml");
+        preloaded.write(md.str());
+
+        ostringstream config;
+        config << "<MetadataProvider type='Chaining'>"
+            << "<MetadataProvider type='XML' path='" << preloaded.path() << "' validate='0' preloadCredentials='true'/>"
+            << "</MetadataProvider>";
+        for (int i = 0; i < 5; ++i) {
+            istringstream in(config.str());
+            scoped_ptr<MetadataProvider> metadataProvider(buildChain(in));
+            Locker locker(metadataProvider.get());
+            auto_ptr_XMLCh id("https://preload499.example.org/idp");
+            const EntityDescriptor* entity = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(id.get(),nullptr,nullptr,false)).first;
+            TSM_ASSERT("Retrieved entity descriptor was null", entity!=nullptr);
+            MetadataCredentialCriteria mcc(*entity->getIDPSSODescriptors().front());
+            TSM_ASSERT("Role credential was not resolved alongside the preload", metadataProvider->resolve(&mcc)!=nullptr);
+        }
+    }
+
+    void testEntityPaging() {
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain());
+
+        MetadataProvider::EntityCursor cursor(2, &IDPSSODescriptor::ELEMENT_QNAME, samlconstants::SAML20P_NS, nullptr, false);
+        vector<string> ids;
+        int pages = 0;
+        bool more = true;
+        while (more) {
+            Locker locker(metadataProvider.get());
+            vector<const EntityDescriptor*> page;
+            more = metadataProvider->getEntityPage(cursor, page);
+            ++pages;
+            for (vector<const EntityDescriptor*>::const_iterator i = page.begin(); i != page.end(); ++i) {
+                auto_ptr_char id((*i)->getEntityID());
+                ids.push_back(id.get());
+            }
+        }
+
+        TSM_ASSERT_EQUALS("Wrong number of pages", 3, pages);
+        TSM_ASSERT_EQUALS("Wrong number of entities", 6, ids.size());
+        for (vector<string>::size_type i = 1; i < ids.size(); ++i)
+            TSM_ASSERT("Entities were not in entityID order", ids[i - 1] <= ids[i]);
+        TSM_ASSERT_EQUALS("Copies of the shared entity were split", ids[4], ids[5]);
+    }
+
+    void testEntityScanLimit() {
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain());
+
+        // Scanning one entityID at a time must still visit everything the unbounded cursor does.
+        vector<string> expected, ids;
+        for (unsigned int scan = 0; scan <= 1; ++scan) {
+            MetadataProvider::EntityCursor cursor(0, &IDPSSODescriptor::ELEMENT_QNAME, samlconstants::SAML20P_NS, nullptr, false, scan);
+            vector<string>& out = scan ? ids : expected;
+            int pages = 0;
+            bool more = true;
+            while (more && pages < 100) {
+                Locker locker(metadataProvider.get());
+                vector<const EntityDescriptor*> page;
+                more = metadataProvider->getEntityPage(cursor, page);
+                ++pages;
+                for (vector<const EntityDescriptor*>::const_iterator i = page.begin(); i != page.end(); ++i) {
+                    auto_ptr_char id((*i)->getEntityID());
+                    out.push_back(id.get());
+                }
+            }
+            if (scan)
+                TSM_ASSERT("Scan limit did not end pages early", pages > 1);
+            else
+                TSM_ASSERT_EQUALS("Unbounded cursor used more than one page", 1, pages);
+        }
+        TSM_ASSERT("Scan limit changed the entities returned", expected == ids);
+    }
+
+    void testFeedEncoding() {
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain());
+        DiscoverableMetadataProvider* disco = dynamic_cast<DiscoverableMetadataProvider*>(metadataProvider.get());
+        TSM_ASSERT("Chaining provider was not discoverable", disco!=nullptr);
+
+        Locker locker(metadataProvider.get());
+        ostringstream plain;
+        bool first = true;
+        disco->outputFeed(plain, first);
+
+        string etag;
+        ostringstream identity;
+        TSM_ASSERT("Unexpected content coding", disco->outputEncodedFeed(identity, "br;q=1, gzip;q=0", etag)==nullptr);
+        TSM_ASSERT_EQUALS("Uncompressed feed did not match", plain.str(), identity.str());
+        TSM_ASSERT_EQUALS("ETag did not match", disco->getCacheTag(), etag);
+
+        ostringstream gzipped;
+        const char* coding = disco->outputEncodedFeed(gzipped, "deflate;q=0.5, gzip", etag);
+        TSM_ASSERT("Feed was not gzipped", coding && !strcmp(coding, "gzip"));
+        TSM_ASSERT("Missing gzip header", gzipped.str().length() > 18 && gzipped.str()[0]=='\x1f' && gzipped.str()[1]=='\x8b');
+        TSM_ASSERT_EQUALS("ETag did not distinguish encoding", disco->getCacheTag() + "-gzip", etag);
+
+        ostringstream zlib;
+        coding = disco->outputEncodedFeed(zlib, "deflate, gzip;q=0.5", etag);
+        TSM_ASSERT("Feed was not deflated", coding && !strcmp(coding, "deflate"));
+        TSM_ASSERT("Missing zlib header", zlib.str().length() > 6 && zlib.str()[0]=='\x78' && zlib.str()[1]=='\x9c');
+    }
+
+    void testSearch() {
+        scoped_ptr<MetadataProvider> metadataProvider(buildChain());
+        DiscoverableMetadataProvider* disco = dynamic_cast<DiscoverableMetadataProvider*>(metadataProvider.get());
+        TSM_ASSERT("Chaining provider was not discoverable", disco!=nullptr);
+
+        Locker locker(metadataProvider.get());
+        ostringstream out;
+        TSM_ASSERT_EQUALS("Wrong number of matches", 1, disco->outputSearch(out, "IdP4"));
+        TSM_ASSERT("Wrong entity matched", out.str().find("https://idp4.example.org/idp/shibboleth") != string::npos);
+
+        ostringstream shared;
+        TSM_ASSERT_EQUALS("Both copies of the shared entity should match", 2, disco->outputSearch(shared, "shared ex"));
+
+        ostringstream limited;
+        TSM_ASSERT_EQUALS("Result limit was not honored", 3, disco->outputSearch(limited, "shib", nullptr, 3));
+
+        ostringstream none;
+        TSM_ASSERT_EQUALS("Unexpected match", 0, disco->outputSearch(none, "idp4 missing"));
+
+        // The chain merges its children's hits itself, rather than leaving it to outputSearch.
+        vector< pair<unsigned int,string> > results;
+        disco->search("shib", nullptr, 3, results);
+        TSM_ASSERT_EQUALS("Chain did not cut merged results to the limit", 3, results.size());
+        for (vector< pair<unsigned int,string> >::size_type i = 1; i < results.size(); ++i)
+            TSM_ASSERT("Merged results were not ranked by score", results[i - 1].first >= results[i].first);
+    }
+};
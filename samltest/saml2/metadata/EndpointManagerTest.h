@@ -0,0 +1,139 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#include "internal.h"
+#include <saml/saml2/metadata/EndpointManager.h>
+#include <saml/saml2/metadata/Metadata.h>
+
+#include <sstream>
+#include <boost/shared_ptr.hpp>
+
+using namespace opensaml::saml2md;
+using namespace opensaml;
+
+class EndpointManagerTest : public CxxTest::TestSuite, public SAMLObjectBaseTestCase {
+
+    scoped_ptr<XMLObject> m_entity;
+    vector< boost::shared_ptr<auto_ptr_XMLCh> > m_bindings;
+
+    static bool at(const EndpointType* endpoint, const char* location) {
+        auto_ptr_XMLCh loc(location);
+        return endpoint && XMLString::equals(endpoint->getLocation(), loc.get());
+    }
+
+    const XMLCh* binding(const char* b) {
+        m_bindings.push_back(boost::shared_ptr<auto_ptr_XMLCh>(new auto_ptr_XMLCh(b)));
+        return m_bindings.back()->get();
+    }
+
+    const EntityDescriptor* entity() const {
+        return dynamic_cast<const EntityDescriptor*>(m_entity.get());
+    }
+
+public:
+    void setUp() {
+        SAMLObjectBaseTestCase::setUp();
+
+        string md = string("<EntityDescriptor xmlns='urn:oasis:names:tc:SAML:2.0:metadata' entityID='https://endpoints.example.org'>")
+            + "<IDPSSODescriptor protocolSupportEnumeration='urn:oasis:names:tc:SAML:2.0:protocol'>"
+            + "<ArtifactResolutionService index='1' Binding='urn:oasis:names:tc:SAML:2.0:bindings:SOAP' Location='https://endpoints.example.org/ars1'/>"
+            + "<ArtifactResolutionService index='2' Binding='urn:oasis:names:tc:SAML:2.0:bindings:SOAP' Location='https://endpoints.example.org/ars2'/>"
+            + "<SingleSignOnService Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-Redirect' Location='https://endpoints.example.org/sso'/>"
+            + "</IDPSSODescriptor>"
+            + "<SPSSODescriptor protocolSupportEnumeration='urn:oasis:names:tc:SAML:2.0:protocol'>"
+            + "<SingleLogoutService Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-Redirect' Location='https://endpoints.example.org/slo1'/>"
+            + "<SingleLogoutService Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-Redirect' Location='https://endpoints.example.org/slo2'/>"
+            + "<AssertionConsumerService index='1' Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-POST' Location='https://endpoints.example.org/post1'/>"
+            + "<AssertionConsumerService index='2' Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-Artifact' Location='https://endpoints.example.org/artifact'/>"
+            + "<AssertionConsumerService index='3' Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-POST' Location='https://endpoints.example.org/post3' isDefault='true'/>"
+            + "</SPSSODescriptor>"
+            + "</EntityDescriptor>";
+        istringstream in(md);
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        m_entity.reset(XMLObjectBuilder::buildOneFromElement(doc->getDocumentElement(), true));
+    }
+
+    void tearDown() {
+        m_entity.reset();
+        m_bindings.clear();
+        SAMLObjectBaseTestCase::tearDown();
+    }
+
+    void testDocumentOrder() {
+        const SPSSODescriptor* sp = entity()->getSPSSODescriptors().front();
+        EndpointManager<SingleLogoutService> slo(sp->getSingleLogoutServices());
+        TSM_ASSERT("First endpoint for a binding was not chosen", at(slo.getByBinding(binding(samlconstants::SAML20_BINDING_HTTP_REDIRECT)), "https://endpoints.example.org/slo1"));
+        TSM_ASSERT("Unsupported binding found an endpoint", slo.getByBinding(binding(samlconstants::SAML20_BINDING_HTTP_POST)) == nullptr);
+
+        // Without the default preference, an indexed list is also searched in document order.
+        EndpointManager<AssertionConsumerService> acs(sp->getAssertionConsumerServices());
+        TSM_ASSERT("First endpoint for a binding was not chosen", at(acs.getByBinding(binding(samlconstants::SAML20_BINDING_HTTP_POST)), "https://endpoints.example.org/post1"));
+
+        // With no endpoint flagged, the first one is the default.
+        const IDPSSODescriptor* idp = entity()->getIDPSSODescriptors().front();
+        IndexedEndpointManager<ArtifactResolutionService> ars(idp->getArtifactResolutionServices());
+        TSM_ASSERT("First endpoint was not the default", at(ars.getDefault(), "https://endpoints.example.org/ars1"));
+        TSM_ASSERT("First endpoint for a binding was not chosen", at(ars.getByBinding(binding(samlconstants::SAML20_BINDING_SOAP)), "https://endpoints.example.org/ars1"));
+        TSM_ASSERT("Index lookup failed", at(ars.getByIndex(2), "https://endpoints.example.org/ars2"));
+    }
+
+    void testDefaultPreference() {
+        const SPSSODescriptor* sp = entity()->getSPSSODescriptors().front();
+        IndexedEndpointManager<AssertionConsumerService> acs(sp->getAssertionConsumerServices());
+        TSM_ASSERT("Flagged endpoint was not the default", at(acs.getDefault(), "https://endpoints.example.org/post3"));
+        TSM_ASSERT("Default was not favored for its binding", at(acs.getByBinding(binding(samlconstants::SAML20_BINDING_HTTP_POST)), "https://endpoints.example.org/post3"));
+        TSM_ASSERT("Other binding did not fall back to document order", at(acs.getByBinding(binding(samlconstants::SAML20_BINDING_HTTP_ARTIFACT)), "https://endpoints.example.org/artifact"));
+        TSM_ASSERT("Index lookup failed", at(acs.getByIndex(1), "https://endpoints.example.org/post1"));
+        TSM_ASSERT("Unknown index found an endpoint", acs.getByIndex(9) == nullptr);
+    }
+
+    void testTableLookup() {
+        const SPSSODescriptor* sp = entity()->getSPSSODescriptors().front();
+        const XMLCh* post = binding(samlconstants::SAML20_BINDING_HTTP_POST);
+        const XMLCh* artifact = binding(samlconstants::SAML20_BINDING_HTTP_ARTIFACT);
+        const XMLCh* redirect = binding(samlconstants::SAML20_BINDING_HTTP_REDIRECT);
+
+        // One table serves every manager built over the role, and has to agree with scanning.
+        IndexedEndpointTable<AssertionConsumerService> table(sp->getAssertionConsumerServices());
+        IndexedEndpointManager<AssertionConsumerService> scanned(sp->getAssertionConsumerServices());
+        for (int pass = 0; pass < 2; ++pass) {
+            IndexedEndpointManager<AssertionConsumerService> acs(table);
+            TSM_ASSERT_EQUALS("Table default differs", scanned.getDefault(), acs.getDefault());
+            TSM_ASSERT_EQUALS("Table binding lookup differs", scanned.getByBinding(post), acs.getByBinding(post));
+            TSM_ASSERT_EQUALS("Table binding lookup differs", scanned.getByBinding(artifact), acs.getByBinding(artifact));
+            TSM_ASSERT("Unsupported binding found an endpoint", acs.getByBinding(redirect) == nullptr);
+            for (unsigned short index = 0; index < 5; ++index)
+                TSM_ASSERT_EQUALS("Table index lookup differs", scanned.getByIndex(index), acs.getByIndex(index));
+        }
+        TSM_ASSERT("Default was not favored for its binding", at(IndexedEndpointManager<AssertionConsumerService>(table).getByBinding(post), "https://endpoints.example.org/post3"));
+        TSM_ASSERT("Document order was not kept without the default", at(EndpointManager<AssertionConsumerService>(table).getByBinding(post), "https://endpoints.example.org/post1"));
+
+        vector<const AssertionConsumerService*> all;
+        TSM_ASSERT_EQUALS("Wrong number of endpoints for a binding", 2U, table.getAllByBinding(post, all));
+        TSM_ASSERT("Endpoints for a binding out of order", all.size() == 2 && at(all[0], "https://endpoints.example.org/post1") && at(all[1], "https://endpoints.example.org/post3"));
+        TSM_ASSERT_EQUALS("Unsupported binding found endpoints", 0U, table.getAllByBinding(redirect, all));
+
+        // Duplicate bindings in an unindexed list resolve to the first one.
+        EndpointTable<SingleLogoutService> sloTable(sp->getSingleLogoutServices());
+        EndpointManager<SingleLogoutService> slo(sloTable);
+        TSM_ASSERT("First endpoint for a binding was not chosen", at(slo.getByBinding(redirect), "https://endpoints.example.org/slo1"));
+        TSM_ASSERT("Unsupported binding found an endpoint", slo.getByBinding(post) == nullptr);
+    }
+};
@@ -0,0 +1,213 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#include "internal.h"
+#include <saml/SAMLConfig.h>
+#include <saml/saml2/metadata/EntityMatcher.h>
+#include <saml/saml2/metadata/Metadata.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+using namespace opensaml::saml2md;
+using namespace opensaml;
+
+class EntityMatcherTest : public CxxTest::TestSuite, public SAMLObjectBaseTestCase {
+
+    scoped_ptr<XMLObject> m_metadata;
+
+    static string tagged(const char* entityID, const char* format, const string& values) {
+        return string("<EntityDescriptor entityID='") + entityID + "'><Extensions><mdattr:EntityAttributes>"
+            + "<saml:Attribute Name='urn:example:tag' NameFormat='" + format + "'>" + values + "</saml:Attribute>"
+            + "</mdattr:EntityAttributes></Extensions></EntityDescriptor>";
+    }
+
+    static string value(const char* val) {
+        return string("<saml:AttributeValue>") + val + "</saml:AttributeValue>";
+    }
+
+    EntityMatcher* buildMatcher(const char* type, const string& config) {
+        string xml = "<EntityMatcher xmlns:saml='urn:oasis:names:tc:SAML:2.0:assertion' " + config;
+        istringstream in(xml);
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        XercesJanitor<DOMDocument> janitor(doc);
+        return SAMLConfig::getConfig().EntityMatcherManager.newPlugin(type, doc->getDocumentElement(), false);
+    }
+
+    const EntityDescriptor& entity(const char* entityID) const {
+        auto_ptr_XMLCh id(entityID);
+        const EntitiesDescriptor* root = dynamic_cast<const EntitiesDescriptor*>(m_metadata.get());
+        const vector<EntitiesDescriptor*>& groups = root->getEntitiesDescriptors();
+        vector<const EntitiesDescriptor*> all(1, root);
+        all.insert(all.end(), groups.begin(), groups.end());
+        for (vector<const EntitiesDescriptor*>::const_iterator g = all.begin(); g != all.end(); ++g) {
+            const vector<EntityDescriptor*>& entities = (*g)->getEntityDescriptors();
+            for (vector<EntityDescriptor*>::const_iterator e = entities.begin(); e != entities.end(); ++e) {
+                if (XMLString::equals((*e)->getEntityID(), id.get()))
+                    return **e;
+            }
+        }
+        TS_FAIL(string("No entity found for ") + entityID);
+        throw std::runtime_error(entityID);
+    }
+
+public:
+    void setUp() {
+        SAMLObjectBaseTestCase::setUp();
+
+        static const char* uri = "urn:oasis:names:tc:SAML:2.0:attrname-format:uri";
+        static const char* basic = "urn:oasis:names:tc:SAML:2.0:attrname-format:basic";
+        string md = string("<EntitiesDescriptor xmlns='urn:oasis:names:tc:SAML:2.0:metadata'")
+            + " xmlns:saml='urn:oasis:names:tc:SAML:2.0:assertion'"
+            + " xmlns:mdattr='urn:oasis:names:tc:SAML:metadata:attribute'"
+            + " xmlns:mdrpi='urn:oasis:names:tc:SAML:metadata:rpi' Name='urn:example:root'>"
+            + "<EntitiesDescriptor Name='urn:example:federation'><Extensions>"
+            + "<mdattr:EntityAttributes><saml:Attribute Name='urn:example:group' NameFormat='" + uri + "'>"
+            + value("member") + "</saml:Attribute></mdattr:EntityAttributes>"
+            + "<mdrpi:RegistrationInfo registrationAuthority='https://fed.example.org'/></Extensions>"
+            + "<EntityDescriptor entityID='https://member.example.org'/>"
+            + "<EntityDescriptor entityID='https://registered.example.org'><Extensions>"
+            + "<mdrpi:RegistrationInfo registrationAuthority='https://other.example.org'/></Extensions></EntityDescriptor>"
+            + "</EntitiesDescriptor>"
+            + tagged("https://both.example.org", uri, value("a") + value("b"))
+            + tagged("https://one.example.org", uri, value("a"))
+            + tagged("https://padded.example.org", uri, value(" a ") + value(" b "))
+            + tagged("https://basic.example.org", basic, value("a") + value("b"))
+            + tagged("https://pattern.example.org", uri, value("prefix-12345") + value("extra"))
+            + "<EntityDescriptor entityID='https://none.example.org'/>"
+            + "</EntitiesDescriptor>";
+        istringstream in(md);
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        m_metadata.reset(XMLObjectBuilder::buildOneFromElement(doc->getDocumentElement(), true));
+    }
+
+    void tearDown() {
+        m_metadata.reset();
+        SAMLObjectBaseTestCase::tearDown();
+    }
+
+    void testLiteralTags() {
+        scoped_ptr<EntityMatcher> matcher(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER, "><saml:Attribute Name='urn:example:tag'>" + value("a") + value("b") + "</saml:Attribute></EntityMatcher>")
+            );
+        TSM_ASSERT("Entity with every tag value did not match", matcher->matches(entity("https://both.example.org")));
+        TSM_ASSERT("Entity missing a tag value matched", !matcher->matches(entity("https://one.example.org")));
+        TSM_ASSERT("Untrimmed tag values matched", !matcher->matches(entity("https://padded.example.org")));
+        TSM_ASSERT("Unspecified NameFormat did not match another format", matcher->matches(entity("https://basic.example.org")));
+        TSM_ASSERT("Entity without tags matched", !matcher->matches(entity("https://none.example.org")));
+
+        scoped_ptr<EntityMatcher> trimmed(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER, "trimTags='true'><saml:Attribute Name='urn:example:tag'>" + value("a") + value("b") + "</saml:Attribute></EntityMatcher>")
+            );
+        TSM_ASSERT("Trimmed tag values did not match", trimmed->matches(entity("https://padded.example.org")));
+        TSM_ASSERT("Exact tag values did not match with trimming", trimmed->matches(entity("https://both.example.org")));
+
+        scoped_ptr<EntityMatcher> formatted(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER,
+                "><saml:Attribute Name='urn:example:tag' NameFormat='urn:oasis:names:tc:SAML:2.0:attrname-format:uri'>"
+                + value("a") + "</saml:Attribute></EntityMatcher>")
+            );
+        TSM_ASSERT("Matching NameFormat did not match", formatted->matches(entity("https://one.example.org")));
+        TSM_ASSERT("Different NameFormat matched", !formatted->matches(entity("https://basic.example.org")));
+    }
+
+    void testShorthandAndRegexTags() {
+        scoped_ptr<EntityMatcher> shorthand(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER, "attributeName='urn:example:tag' attributeValue='a'/>")
+            );
+        TSM_ASSERT("Shorthand tag did not match", shorthand->matches(entity("https://one.example.org")));
+        TSM_ASSERT("Shorthand tag matched a different value", !shorthand->matches(entity("https://pattern.example.org")));
+
+        scoped_ptr<EntityMatcher> regex(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER, "attributeName='urn:example:tag' attributeValueRegex='^prefix-[0-9]+$'/>")
+            );
+        TSM_ASSERT("Regex tag did not match", regex->matches(entity("https://pattern.example.org")));
+        TSM_ASSERT("Regex tag matched a different value", !regex->matches(entity("https://both.example.org")));
+
+        // A regex value and a literal value of the same tag both have to be found.
+        scoped_ptr<EntityMatcher> mixed(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER,
+                "><saml:Attribute Name='urn:example:tag'><saml:AttributeValue regex='true'>^prefix-[0-9]+$</saml:AttributeValue>"
+                + value("extra") + "</saml:Attribute></EntityMatcher>")
+            );
+        TSM_ASSERT("Mixed regex and literal tag did not match", mixed->matches(entity("https://pattern.example.org")));
+
+        scoped_ptr<EntityMatcher> incomplete(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER,
+                "><saml:Attribute Name='urn:example:tag'><saml:AttributeValue regex='true'>^prefix-[0-9]+$</saml:AttributeValue>"
+                + value("a") + "</saml:Attribute></EntityMatcher>")
+            );
+        TSM_ASSERT("Tag missing its literal value matched", !incomplete->matches(entity("https://pattern.example.org")));
+    }
+
+    void testGroupTags() {
+        scoped_ptr<EntityMatcher> matcher(
+            buildMatcher(ENTITYATTR_ENTITY_MATCHER, "attributeName='urn:example:group' attributeValue='member'/>")
+            );
+        TSM_ASSERT("Tag on the enclosing group did not match", matcher->matches(entity("https://member.example.org")));
+        TSM_ASSERT("Tag on the enclosing group matched ignoring groups", !matcher->matchesIgnoringGroups(entity("https://member.example.org")));
+        TSM_ASSERT("Entity outside the group matched", !matcher->matches(entity("https://both.example.org")));
+    }
+
+    void testRegistrationAuthority() {
+        scoped_ptr<EntityMatcher> fed(buildMatcher(REGAUTH_ENTITY_MATCHER, "registrationAuthority='https://fed.example.org'/>"));
+        TSM_ASSERT("Authority of the enclosing group did not match", fed->matches(entity("https://member.example.org")));
+        TSM_ASSERT("Authority of the enclosing group did not match", fed->matches(entity("https://registered.example.org")));
+        TSM_ASSERT("Entity outside the group matched", !fed->matches(entity("https://none.example.org")));
+
+        scoped_ptr<EntityMatcher> other(
+            buildMatcher(REGAUTH_ENTITY_MATCHER, "><RegistrationAuthority>https://other.example.org</RegistrationAuthority></EntityMatcher>")
+            );
+        TSM_ASSERT("Entity's own authority did not match", other->matchesIgnoringGroups(entity("https://registered.example.org")));
+        TSM_ASSERT("Authority of another entity matched", !other->matches(entity("https://member.example.org")));
+    }
+
+    void testCompiledResults() {
+        boost::ptr_vector<EntityMatcher> owned;
+        owned.push_back(buildMatcher(ENTITYATTR_ENTITY_MATCHER, "attributeName='urn:example:tag' attributeValue='a'/>"));
+        owned.push_back(buildMatcher(ENTITYATTR_ENTITY_MATCHER, "attributeName='urn:example:group' attributeValue='member'/>"));
+        owned.push_back(buildMatcher(REGAUTH_ENTITY_MATCHER, "registrationAuthority='https://fed.example.org'/>"));
+        owned.push_back(buildMatcher(REGAUTH_ENTITY_MATCHER, "registrationAuthority='https://other.example.org'/>"));
+        vector<const EntityMatcher*> matchers;
+        for (boost::ptr_vector<EntityMatcher>::const_iterator m = owned.begin(); m != owned.end(); ++m)
+            matchers.push_back(&(*m));
+
+        EntityMatcherResults results;
+        results.compile(matchers, m_metadata.get());
+
+        // Every compiled bit has to agree with evaluating the matcher directly.
+        static const char* entityIDs[] = {
+            "https://member.example.org", "https://registered.example.org", "https://both.example.org",
+            "https://one.example.org", "https://pattern.example.org", "https://none.example.org"
+        };
+        for (size_t i = 0; i < sizeof(entityIDs) / sizeof(entityIDs[0]); ++i) {
+            const vector<bool>* bits = results.get(entity(entityIDs[i]));
+            TSM_ASSERT("Entity was not compiled", bits != nullptr);
+            TSM_ASSERT_EQUALS("Wrong number of results", matchers.size(), bits->size());
+            for (vector<const EntityMatcher*>::size_type m = 0; m < matchers.size(); ++m)
+                TSM_ASSERT_EQUALS(string("Compiled result differs for ") + entityIDs[i], matchers[m]->matches(entity(entityIDs[i])), (*bits)[m]);
+        }
+        TSM_ASSERT("Group membership was not inherited", (*results.get(entity("https://registered.example.org")))[1]);
+
+        results.clear();
+        TSM_ASSERT("Cleared results remained", results.get(entity("https://both.example.org")) == nullptr);
+    }
+};
@@ -0,0 +1,261 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#include "internal.h"
+#include <saml/SAMLConfig.h>
+#include <saml/saml2/metadata/Metadata.h>
+#include <saml/saml2/metadata/MetadataFilter.h>
+
+#include <sstream>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+using namespace opensaml::saml2md;
+using namespace opensaml;
+
+class EntityMetadataFilterTest : public CxxTest::TestSuite, public SAMLObjectBaseTestCase {
+
+    MetadataFilter* buildFilter(const char* type, const string& body) {
+        string config = "<MetadataFilter xmlns:md='urn:oasis:names:tc:SAML:2.0:metadata'"
+            " xmlns:saml='urn:oasis:names:tc:SAML:2.0:assertion'>" + body + "</MetadataFilter>";
+        istringstream in(config);
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        XercesJanitor<DOMDocument> janitor(doc);
+        return SAMLConfig::getConfig().MetadataFilterManager.newPlugin(type, doc->getDocumentElement(), false);
+    }
+
+    static string entityID(int group, int i) {
+        ostringstream id;
+        id << "https://group" << group << ".example.org/" << (i % 2 ? "sp" : "idp") << (i < 10 ? "0" : "") << i;
+        return id.str();
+    }
+
+    // Lists the entities of a group, either all of them or just the SPs.
+    static string listGroup(const char* element, int group, bool spOnly) {
+        string list;
+        for (int i = spOnly ? 1 : 0; i < 20; i += spOnly ? 2 : 1)
+            list += string("<") + element + ">" + entityID(group, i) + "</" + element + ">";
+        return list;
+    }
+
+    // Ten groups of twenty entities alternating between IdPs and SPs, enough to use several filter threads.
+    XMLObject* buildMetadata() {
+        ostringstream md;
+        md << "<EntitiesDescriptor xmlns='urn:oasis:names:tc:SAML:2.0:metadata' Name='urn:example:root'>";
+        for (int g = 0; g < 10; ++g) {
+            md << "<EntitiesDescriptor Name='urn:example:group" << g << "'>";
+            for (int i = 0; i < 20; ++i) {
+                md << "<EntityDescriptor entityID='" << entityID(g, i) << "'>";
+                if (i % 2) {
+                    md << "<SPSSODescriptor protocolSupportEnumeration='urn:oasis:names:tc:SAML:2.0:protocol'>"
+                        << "<AssertionConsumerService index='1' Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-POST'"
+                        << " Location='" << entityID(g, i) << "/acs'/></SPSSODescriptor>";
+                }
+                else {
+                    md << "<IDPSSODescriptor protocolSupportEnumeration='urn:oasis:names:tc:SAML:2.0:protocol'>"
+                        << "<SingleSignOnService Binding='urn:oasis:names:tc:SAML:2.0:bindings:HTTP-Redirect'"
+                        << " Location='" << entityID(g, i) << "/sso'/></IDPSSODescriptor>";
+                }
+                md << "</EntityDescriptor>";
+            }
+            md << "</EntitiesDescriptor>";
+        }
+        md << "</EntitiesDescriptor>";
+
+        istringstream in(md.str());
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        return XMLObjectBuilder::buildOneFromElement(doc->getDocumentElement(), true);
+    }
+
+    // Applies the chain one filter at a time and in fused passes, checks they agree, and returns the result.
+    string compareChain(const boost::ptr_vector<MetadataFilter>& chain, unsigned int threads) {
+        scoped_ptr<XMLObject> expected(buildMetadata()), actual(buildMetadata());
+        vector<const EntityMetadataFilter*> fused;
+        for (boost::ptr_vector<MetadataFilter>::const_iterator f = chain.begin(); f != chain.end(); ++f) {
+            f->doFilter(nullptr, *expected);
+            fused.push_back(dynamic_cast<const EntityMetadataFilter*>(&(*f)));
+            TSM_ASSERT("Filter was not a per-entity filter", fused.back() != nullptr);
+        }
+        EntityMetadataFilter::doFilters(nullptr, *actual, fused, threads);
+
+        ostringstream e, a;
+        XMLHelper::serialize(expected->marshall(), e);
+        XMLHelper::serialize(actual->marshall(), a);
+        TSM_ASSERT_EQUALS("Fused filters disagree with applying them one at a time", e.str(), a.str());
+        return e.str();
+    }
+
+    // Applies an EntityAttributes filter that tags entities matching an expression, and reports whether the entity was tagged.
+    bool tagsEntity(const string& exp, const char* entityID) {
+        scoped_ptr<MetadataFilter> filter(
+            buildFilter(ENTITYATTR_METADATA_FILTER,
+                "<saml:Attribute Name='urn:example:tag'><saml:AttributeValue>tagged</saml:AttributeValue></saml:Attribute>"
+                "<EntityRegex>" + exp + "</EntityRegex>")
+            );
+        string md = string("<EntityDescriptor xmlns='urn:oasis:names:tc:SAML:2.0:metadata' entityID='") + entityID + "'/>";
+        istringstream in(md);
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        scoped_ptr<XMLObject> entity(XMLObjectBuilder::buildOneFromElement(doc->getDocumentElement(), true));
+        filter->doFilter(nullptr, *entity);
+        const EntityAttributes* ea = findExtension<EntityAttributes>(dynamic_cast<EntityDescriptor*>(entity.get())->getExtensions());
+        return ea && !ea->getAttributes().empty();
+    }
+
+    // Rejects the children named for removal.
+    static bool dropped(const XMLCh* name) {
+        auto_ptr_char temp(name);
+        return temp.get() && strstr(temp.get(), "drop");
+    }
+    static bool droppedEntity(const EntityDescriptor* entity) {
+        return dropped(entity->getEntityID());
+    }
+    static bool droppedGroup(const EntitiesDescriptor* group) {
+        return dropped(group->getName());
+    }
+
+public:
+    void setUp() {
+        SAMLObjectBaseTestCase::setUp();
+    }
+
+    void tearDown() {
+        SAMLObjectBaseTestCase::tearDown();
+    }
+
+    void testRoleThenExclude() {
+        boost::ptr_vector<MetadataFilter> chain;
+        chain.push_back(buildFilter(ENTITYROLE_METADATA_FILTER, "<RetainedRole>md:SPSSODescriptor</RetainedRole>"));
+        chain.push_back(buildFilter(EXCLUDE_METADATA_FILTER, listGroup("Exclude", 3, true) + "<Exclude>urn:example:group7</Exclude>"));
+
+        // The group emptied by the exclusion was already checked, so it stays.
+        for (unsigned int threads = 1; threads <= 4; threads += 3) {
+            string result = compareChain(chain, threads);
+            TSM_ASSERT("Group emptied after the role filter was removed", result.find("urn:example:group3") != string::npos);
+            TSM_ASSERT("Excluded group was kept", result.find("urn:example:group7") == string::npos);
+            TSM_ASSERT("Role-less entity was kept", result.find(entityID(0, 0)) == string::npos);
+            TSM_ASSERT("Retained entity was removed", result.find(entityID(0, 1)) != string::npos);
+        }
+    }
+
+    void testExcludeThenRole() {
+        boost::ptr_vector<MetadataFilter> chain;
+        chain.push_back(buildFilter(EXCLUDE_METADATA_FILTER, listGroup("Exclude", 3, true)));
+        chain.push_back(buildFilter(ENTITYROLE_METADATA_FILTER, "<RetainedRole>md:SPSSODescriptor</RetainedRole>"));
+
+        for (unsigned int threads = 1; threads <= 4; threads += 3) {
+            string result = compareChain(chain, threads);
+            TSM_ASSERT("Empty group was kept", result.find("urn:example:group3") == string::npos);
+            TSM_ASSERT("Non-empty group was removed", result.find("urn:example:group4") != string::npos);
+        }
+    }
+
+    void testIncludeRoleExclude() {
+        string included;
+        for (int g = 0; g < 10; ++g) {
+            if (g != 5)
+                included += listGroup("Include", g, false);
+        }
+        boost::ptr_vector<MetadataFilter> chain;
+        chain.push_back(buildFilter(INCLUDE_METADATA_FILTER, included));
+        chain.push_back(buildFilter(ENTITYROLE_METADATA_FILTER, "<RetainedRole>md:SPSSODescriptor</RetainedRole>"));
+        chain.push_back(buildFilter(EXCLUDE_METADATA_FILTER, listGroup("Exclude", 3, true)));
+        chain.push_back(buildFilter(EXCLUDE_METADATA_FILTER, "<Exclude>" + entityID(8, 1) + "</Exclude>"));
+
+        for (unsigned int threads = 1; threads <= 4; threads += 3) {
+            string result = compareChain(chain, threads);
+            TSM_ASSERT("Group emptied before the role filter was kept", result.find("urn:example:group5") == string::npos);
+            TSM_ASSERT("Group emptied after the role filter was removed", result.find("urn:example:group3") != string::npos);
+            TSM_ASSERT("Excluded entity was kept", result.find(entityID(8, 1)) == string::npos);
+            TSM_ASSERT("Included entity was removed", result.find(entityID(8, 3)) != string::npos);
+        }
+    }
+
+    void testRemoveChildren() {
+        // Entities and groups interleaved, with runs of rejects at both ends and in the middle.
+        static const char* children[] = {
+            "E:drop0", "E:keep1", "G:keep2", "E:drop3", "G:drop4", "E:drop5", "E:keep6",
+            "G:drop7", "E:keep8", "G:keep9", "E:drop10", "E:drop11"
+        };
+        const size_t count = sizeof(children) / sizeof(children[0]);
+        ostringstream md;
+        md << "<EntitiesDescriptor xmlns='urn:oasis:names:tc:SAML:2.0:metadata' Name='urn:example:root'>";
+        for (size_t i = 0; i < count; ++i) {
+            if (children[i][0] == 'E')
+                md << "<EntityDescriptor entityID='https://" << children[i] + 2 << ".example.org'/>";
+            else
+                md << "<EntitiesDescriptor Name='urn:example:" << children[i] + 2 << "'/>";
+        }
+        md << "</EntitiesDescriptor>";
+        istringstream in(md.str());
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        scoped_ptr<XMLObject> root(XMLObjectBuilder::buildOneFromElement(doc->getDocumentElement(), true));
+        EntitiesDescriptor* group = dynamic_cast<EntitiesDescriptor*>(root.get());
+        const EntitiesDescriptor& view = *group;
+
+        TSM_ASSERT_EQUALS("Wrong number of entities removed", 5U, removeChildren(*group, view.getEntityDescriptors(), droppedEntity));
+        TSM_ASSERT_EQUALS("Wrong number of groups removed", 2U, removeChildren(*group, view.getEntitiesDescriptors(), droppedGroup));
+
+        const vector<EntityDescriptor*>& entities = view.getEntityDescriptors();
+        TSM_ASSERT_EQUALS("Wrong number of entities kept", 3U, entities.size());
+        const char* keptEntities[] = { "https://keep1.example.org", "https://keep6.example.org", "https://keep8.example.org" };
+        for (size_t i = 0; i < entities.size(); ++i) {
+            auto_ptr_char id(entities[i]->getEntityID());
+            TSM_ASSERT_EQUALS("Entities out of order", string(keptEntities[i]), string(id.get()));
+        }
+        const vector<EntitiesDescriptor*>& groups = view.getEntitiesDescriptors();
+        TSM_ASSERT_EQUALS("Wrong number of groups kept", 2U, groups.size());
+        const char* keptGroups[] = { "urn:example:keep2", "urn:example:keep9" };
+        for (size_t i = 0; i < groups.size(); ++i) {
+            auto_ptr_char name(groups[i]->getName());
+            TSM_ASSERT_EQUALS("Groups out of order", string(keptGroups[i]), string(name.get()));
+        }
+
+        // The parent's ordered children have to hold exactly the survivors, in document order.
+        vector<const XMLObject*> expected;
+        expected.push_back(entities[0]);
+        expected.push_back(groups[0]);
+        expected.push_back(entities[1]);
+        expected.push_back(entities[2]);
+        expected.push_back(groups[1]);
+        vector<const XMLObject*> ordered;
+        const list<XMLObject*>& all = root->getOrderedChildren();
+        for (list<XMLObject*>::const_iterator i = all.begin(); i != all.end(); ++i) {
+            if (*i) {
+                TSM_ASSERT("Child lost its parent", (*i)->getParent() == root.get());
+                ordered.push_back(*i);
+            }
+        }
+        TSM_ASSERT("Ordered children disagree with the typed lists", expected == ordered);
+
+        ostringstream out;
+        XMLHelper::serialize(root->marshall(), out);
+        TSM_ASSERT("Removed child was marshalled", out.str().find("drop") == string::npos);
+        TSM_ASSERT("Kept child was not marshalled", out.str().find("keep9") != string::npos);
+    }
+
+    void testEntityRegexPrefilter() {
+        TSM_ASSERT("Literal expression did not match", tagsEntity("abc\\.example", "https://xabc.example.org/idp"));
+        TSM_ASSERT("Literal expression matched other text", !tagsEntity("abc\\.example", "https://xyz.example.org/idp"));
+        TSM_ASSERT("Case-insensitive expression did not match", tagsEntity("(?i)abc\\.example", "https://ABC.example.org/idp"));
+        TSM_ASSERT("Non-capturing group expression did not match", tagsEntity("(?:https)://abc\\.example", "https://abc.example.org/idp"));
+        TSM_ASSERT("Hex escape expression did not match", tagsEntity("\\x41bc\\.example", "https://Abc.example.org/idp"));
+        TSM_ASSERT("Unicode escape expression did not match", tagsEntity("\\u0041bc\\.example", "https://Abc.example.org/idp"));
+        TSM_ASSERT("Class escape expression did not match", tagsEntity("sp\\d+\\.example", "https://sp42.example.org/sp"));
+    }
+};
@@ -0,0 +1,137 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#include "internal.h"
+#include <saml/saml2/metadata/MetadataScheduler.h>
+
+#include <xmltooling/util/Threads.h>
+
+using namespace opensaml::saml2md;
+
+class MetadataSchedulerTest : public CxxTest::TestSuite {
+
+    // Counts its runs, optionally throwing or holding the worker for a second.
+    class TestTask : public MetadataScheduler::Task {
+    public:
+        TestTask(int runs=1, bool throws=false, bool slow=false)
+            : m_runs(runs), m_throws(throws), m_slow(slow), m_count(0), m_active(0), m_maxActive(0),
+                m_lock(Mutex::create()), m_done(CondWait::create()) {}
+
+        time_t run() {
+            {
+                Lock lock(m_lock);
+                if (++m_active > m_maxActive)
+                    m_maxActive = m_active;
+            }
+            if (m_slow)
+                Thread::sleep(1);
+            Lock lock(m_lock);
+            --m_active;
+            ++m_count;
+            m_done->broadcast();
+            if (m_throws)
+                throw 42;
+            return m_count < m_runs ? 1 : 0;
+        }
+
+        // Waits up to a few seconds for the task to have run the given number of times.
+        int waitFor(int count) {
+            Lock lock(m_lock);
+            for (int i = 0; i < 10 && m_count < count; ++i)
+                m_done->timedwait(m_lock.get(), 1);
+            return m_count;
+        }
+
+        int m_runs;
+        bool m_throws, m_slow;
+        int m_count, m_active, m_maxActive;
+        scoped_ptr<Mutex> m_lock;
+        scoped_ptr<CondWait> m_done;
+    };
+
+    // Shared by the throttled tasks to record how many overlap.
+    class ThrottledTask : public TestTask {
+    public:
+        ThrottledTask(TestTask& tracker) : TestTask(1, false, true), m_tracker(tracker) {}
+
+        time_t run() {
+            {
+                Lock lock(m_tracker.m_lock);
+                if (++m_tracker.m_active > m_tracker.m_maxActive)
+                    m_tracker.m_maxActive = m_tracker.m_active;
+            }
+            time_t ret = TestTask::run();
+            Lock lock(m_tracker.m_lock);
+            --m_tracker.m_active;
+            return ret;
+        }
+
+        TestTask& m_tracker;
+    };
+
+public:
+    void testRescheduling() {
+        MetadataScheduler scheduler(1, 1);
+        TestTask once, twice(2);
+        scheduler.schedule(&once, 0);
+        scheduler.schedule(&twice, 0);
+        TSM_ASSERT_EQUALS("Task did not run", 1, once.waitFor(1));
+        TSM_ASSERT_EQUALS("Task was not rescheduled", 2, twice.waitFor(2));
+
+        // Neither should run again once retired.
+        Thread::sleep(2);
+        TSM_ASSERT_EQUALS("Retired task ran again", 1, once.m_count);
+        TSM_ASSERT_EQUALS("Retired task ran again", 2, twice.m_count);
+    }
+
+    void testCancel() {
+        MetadataScheduler scheduler(1, 1);
+        TestTask task;
+        scheduler.schedule(&task, 2);
+        scheduler.cancel(&task);
+        Thread::sleep(3);
+        TSM_ASSERT_EQUALS("Cancelled task ran", 0, task.m_count);
+    }
+
+    void testUnknownException() {
+        // With a single worker, the second task only runs if the worker survives the first.
+        MetadataScheduler scheduler(1, 1);
+        TestTask thrower(1, true), task;
+        scheduler.schedule(&thrower, 0);
+        TSM_ASSERT_EQUALS("Throwing task did not run", 1, thrower.waitFor(1));
+        scheduler.schedule(&task, 0);
+        TSM_ASSERT_EQUALS("Worker did not survive a non-standard exception", 1, task.waitFor(1));
+        scheduler.cancel(&thrower);
+    }
+
+    void testThrottling() {
+        MetadataScheduler scheduler(3, 1);
+        TestTask tracker;
+        ThrottledTask first(tracker), second(tracker);
+        TestTask unthrottled(1, false, true);
+        scheduler.schedule(&first, 0, true);
+        scheduler.schedule(&second, 0, true);
+        scheduler.schedule(&unthrottled, 0);
+        TSM_ASSERT_EQUALS("Throttled task did not run", 1, first.waitFor(1));
+        TSM_ASSERT_EQUALS("Throttled task did not run", 1, second.waitFor(1));
+        TSM_ASSERT_EQUALS("Unthrottled task did not run", 1, unthrottled.waitFor(1));
+        TSM_ASSERT_EQUALS("Throttled tasks overlapped", 1, tracker.m_maxActive);
+    }
+};
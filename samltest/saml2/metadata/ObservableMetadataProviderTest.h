@@ -0,0 +1,226 @@
+/**
+ * Licensed to the University Corporation for Advanced Internet
+ * Development, Inc. (UCAID) under one or more contributor license
+ * agreements. See the NOTICE file distributed with this work for
+ * additional information regarding copyright ownership.
+ *
+ * UCAID licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except
+ * in compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#include "internal.h"
+#include <saml/saml2/metadata/Metadata.h>
+#include <saml/saml2/metadata/ObservableMetadataProvider.h>
+
+#include <sstream>
+#include <xmltooling/util/Threads.h>
+
+using namespace opensaml::saml2md;
+
+class ObservableMetadataProviderTest : public CxxTest::TestSuite {
+
+    // Holds no metadata, and just raises events on demand.
+    class TestProvider : public ObservableMetadataProvider {
+    public:
+        TestProvider(const DOMElement* e) : MetadataProvider(e), ObservableMetadataProvider(e) {}
+        ~TestProvider() {
+            stopChangeEvents();
+        }
+
+        void init() {
+            startChangeEvents();
+        }
+        Lockable* lock() {
+            return this;
+        }
+        void unlock() {}
+        const XMLObject* getMetadata() const {
+            return nullptr;
+        }
+        const EntitiesDescriptor* getEntitiesDescriptor(const char*, bool) const {
+            return nullptr;
+        }
+        pair<const EntityDescriptor*,const RoleDescriptor*> getEntityDescriptor(const Criteria&) const {
+            return pair<const EntityDescriptor*,const RoleDescriptor*>(nullptr,nullptr);
+        }
+        const Credential* resolve(const CredentialCriteria*) const {
+            return nullptr;
+        }
+        vector<const Credential*>::size_type resolve(vector<const Credential*>&, const CredentialCriteria*) const {
+            return 0;
+        }
+
+        void emit() const {
+            emitChangeEvent();
+        }
+        void emit(const EntityDescriptor& entity) const {
+            emitChangeEvent(entity);
+        }
+    };
+
+    // Appends its name to a shared log for each event, optionally holding delivery for a second.
+    class TestObserver : public ObservableMetadataProvider::Observer {
+    public:
+        TestObserver(char name, string& log, Mutex& lock, CondWait& delivered, bool slow=false, bool sync=false)
+            : m_name(name), m_log(log), m_lock(lock), m_delivered(delivered), m_slow(slow), m_sync(sync), m_count(0), m_entityCount(0) {}
+
+        void onEvent(const ObservableMetadataProvider&) const {
+            record(false);
+        }
+
+        void onEvent(const ObservableMetadataProvider&, const EntityDescriptor&) const {
+            record(true);
+        }
+
+        bool synchronous() const {
+            return m_sync;
+        }
+
+        char m_name;
+        string& m_log;
+        Mutex& m_lock;
+        CondWait& m_delivered;
+        bool m_slow, m_sync;
+        mutable int m_count, m_entityCount;
+
+    private:
+        void record(bool entity) const {
+            {
+                Lock lock(&m_lock);
+                m_log += m_name;
+                ++m_count;
+                if (entity)
+                    ++m_entityCount;
+                m_delivered.broadcast();
+            }
+            if (m_slow)
+                Thread::sleep(1);
+        }
+    };
+
+    scoped_ptr<Mutex> m_lock;
+    scoped_ptr<CondWait> m_delivered;
+    string m_log;
+
+    TestProvider* buildProvider(bool async) {
+        string config = string("<MetadataProvider asyncEvents='") + (async ? "true" : "false") + "'/>";
+        istringstream in(config);
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        XercesJanitor<DOMDocument> janitor(doc);
+        TestProvider* provider = new TestProvider(doc->getDocumentElement());
+        provider->init();
+        return provider;
+    }
+
+    // Waits up to a few seconds for the observer to have seen the given number of events.
+    int waitFor(const TestObserver& observer, int count) {
+        Lock lock(m_lock.get());
+        for (int i = 0; i < 10 && observer.m_count < count; ++i)
+            m_delivered->timedwait(m_lock.get(), 1);
+        return observer.m_count;
+    }
+
+public:
+    void setUp() {
+        m_lock.reset(Mutex::create());
+        m_delivered.reset(CondWait::create());
+        m_log.erase();
+    }
+
+    void tearDown() {
+        m_delivered.reset();
+        m_lock.reset();
+    }
+
+    void testSynchronousDelivery() {
+        scoped_ptr<TestProvider> provider(buildProvider(false));
+        TestObserver observer('a', m_log, *m_lock, *m_delivered);
+        provider->addObserver(&observer);
+        scoped_ptr<EntityDescriptor> entity(EntityDescriptorBuilder::buildEntityDescriptor());
+        provider->emit();
+        provider->emit(*entity);
+        TSM_ASSERT_EQUALS("Events were not delivered immediately", 2, observer.m_count);
+        TSM_ASSERT_EQUALS("Entity event was not delivered as such", 1, observer.m_entityCount);
+        provider->removeObserver(&observer);
+    }
+
+    void testCoalescing() {
+        scoped_ptr<TestProvider> provider(buildProvider(true));
+        TestObserver observer('a', m_log, *m_lock, *m_delivered, true);
+        provider->addObserver(&observer);
+
+        // Everything raised while the first delivery is under way collapses into one more.
+        provider->emit();
+        TSM_ASSERT_EQUALS("First event was not delivered", 1, waitFor(observer, 1));
+        for (int i = 0; i < 5; ++i)
+            provider->emit();
+        TSM_ASSERT_EQUALS("Pending events were not delivered", 2, waitFor(observer, 2));
+        Thread::sleep(2);
+        TSM_ASSERT_EQUALS("Pending events were not coalesced", 2, observer.m_count);
+        provider->removeObserver(&observer);
+    }
+
+    void testDeliveryOrder() {
+        scoped_ptr<TestProvider> provider(buildProvider(true));
+        TestObserver first('a', m_log, *m_lock, *m_delivered), second('b', m_log, *m_lock, *m_delivered);
+        provider->addObserver(&first);
+        provider->addObserver(&second);
+        provider->emit();
+        TSM_ASSERT_EQUALS("Event was not delivered", 1, waitFor(second, 1));
+        provider->emit();
+        TSM_ASSERT_EQUALS("Event was not delivered", 2, waitFor(second, 2));
+        {
+            Lock lock(m_lock.get());
+            TSM_ASSERT_EQUALS("Observers were not called in order", string("abab"), m_log);
+        }
+        provider->removeObserver(&second);
+        provider->removeObserver(&first);
+    }
+
+    void testSynchronousObserver() {
+        scoped_ptr<TestProvider> provider(buildProvider(true));
+        TestObserver async('a', m_log, *m_lock, *m_delivered), sync('s', m_log, *m_lock, *m_delivered, false, true);
+        provider->addObserver(&async);
+        provider->addObserver(&sync);
+        scoped_ptr<EntityDescriptor> entity(EntityDescriptorBuilder::buildEntityDescriptor());
+        provider->emit(*entity);
+        provider->emit(*entity);
+        {
+            Lock lock(m_lock.get());
+            TSM_ASSERT_EQUALS("Synchronous observer missed an event", 2, sync.m_count);
+            TSM_ASSERT_EQUALS("Synchronous observer lost the entity", 2, sync.m_entityCount);
+        }
+        TSM_ASSERT("Asynchronous observer was not notified", waitFor(async, 1) >= 1);
+        TSM_ASSERT_EQUALS("Asynchronous observer got an entity event", 0, async.m_entityCount);
+        Thread::sleep(1);
+        TSM_ASSERT_EQUALS("Synchronous observer was notified again", 2, sync.m_count);
+        provider->removeObserver(&sync);
+        provider->removeObserver(&async);
+    }
+
+    void testShutdown() {
+        TestObserver observer('a', m_log, *m_lock, *m_delivered, true);
+        {
+            scoped_ptr<TestProvider> provider(buildProvider(true));
+            provider->addObserver(&observer);
+            provider->emit();
+            TSM_ASSERT_EQUALS("First event was not delivered", 1, waitFor(observer, 1));
+
+            // Still pending when the provider goes away.
+            provider->emit();
+        }
+        TSM_ASSERT_EQUALS("Pending event was delivered during destruction", 1, observer.m_count);
+        Thread::sleep(2);
+        TSM_ASSERT_EQUALS("Event was delivered after destruction", 1, observer.m_count);
+    }
+};
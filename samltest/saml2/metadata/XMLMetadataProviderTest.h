@@ -20,11 +20,17 @@
 
 #include "internal.h"
 #include <saml/SAMLConfig.h>
+#include <saml/saml1/binding/SAMLArtifactType0001.h>
 #include <saml/saml2/binding/SAML2ArtifactType0004.h>
+#include <saml/saml2/metadata/DiscoverableMetadataProvider.h>
 #include <saml/saml2/metadata/Metadata.h>
+#include <saml/saml2/metadata/MetadataCredentialCriteria.h>
 #include <saml/saml2/metadata/MetadataProvider.h>
 #include <saml/saml2/metadata/MetadataFilter.h>
 #include <xmltooling/security/SecurityHelper.h>
+#include <xmltooling/security/X509Credential.h>
+
+#include <sstream>
 
 using namespace opensaml::saml2md;
 using namespace opensaml::saml2p;
@@ -168,6 +174,87 @@ public:
         assertEquals("Entity's ID does not match requested ID", entityID, descriptor->getEntityID());
     }
 
+    void testSourceIDLookup() {
+        ostringstream config;
+        config << "<MetadataProvider type='XML' path='" << data_path << "saml2/metadata/SourceID.xml' validate='0'/>";
+        istringstream in(config.str());
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        XercesJanitor<DOMDocument> janitor(doc);
+
+        scoped_ptr<MetadataProvider> metadataProvider(
+            SAMLConfig::getConfig().MetadataProviderManager.newPlugin(XML_METADATA_PROVIDER, doc->getDocumentElement(), false)
+            );
+        metadataProvider->init();
+
+        // The role's first SourceID is empty, so the artifact is found through the second.
+        Locker locker(metadataProvider.get());
+        saml1p::SAMLArtifactType0001 artifact(string("abcdefghijklmnopqrst"));
+        const EntityDescriptor* descriptor = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(&artifact, nullptr, nullptr, false)).first;
+        TSM_ASSERT("Retrieved entity descriptor was null", descriptor!=nullptr);
+        auto_ptr_XMLCh expected("https://source.example.org/idp");
+        assertEquals("Entity's ID does not match requested ID", expected.get(), descriptor->getEntityID());
+    }
+
+    void testSharedCredentials() {
+        // The DOM is dropped after loading, so sharing can't depend on it.
+        ostringstream config;
+        config << "<MetadataProvider type='XML' path='" << data_path << "saml2/metadata/SharedKeyMetadata.xml' validate='0'/>";
+        istringstream in(config.str());
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        XercesJanitor<DOMDocument> janitor(doc);
+
+        scoped_ptr<MetadataProvider> metadataProvider(
+            SAMLConfig::getConfig().MetadataProviderManager.newPlugin(XML_METADATA_PROVIDER, doc->getDocumentElement(), false)
+            );
+        metadataProvider->init();
+
+        Locker locker(metadataProvider.get());
+        const X509Credential* creds[2];
+        const char* ids[2] = { "https://shared1.example.org/idp/shibboleth", "https://shared2.example.org/idp/shibboleth" };
+        for (int i = 0; i < 2; ++i) {
+            auto_ptr_XMLCh id(ids[i]);
+            const EntityDescriptor* descriptor = metadataProvider->getEntityDescriptor(MetadataProvider::Criteria(id.get(), nullptr, nullptr, false)).first;
+            TSM_ASSERT("Retrieved entity descriptor was null", descriptor!=nullptr);
+            TSM_ASSERT("Entity's DOM was not dropped", descriptor->getDOM()==nullptr);
+            MetadataCredentialCriteria mcc(*descriptor->getIDPSSODescriptors().front());
+            creds[i] = dynamic_cast<const X509Credential*>(metadataProvider->resolve(&mcc));
+            TSM_ASSERT("Role credential was not resolved", creds[i]!=nullptr);
+            TSM_ASSERT("Role credential had no certificate", creds[i]->getEntityCertificate()!=nullptr);
+        }
+        TSM_ASSERT("Roles with the same certificate did not share its parse",
+            creds[0]!=creds[1] && creds[0]->getEntityCertificate()==creds[1]->getEntityCertificate());
+    }
+
+    void testDuplicateEntitiesInFeed() {
+        ostringstream config;
+        config << "<MetadataProvider type='XML' path='" << data_path << "saml2/metadata/DuplicateEntities.xml'"
+            << " validate='0' legacyOrgNames='true'/>";
+        istringstream in(config.str());
+        DOMDocument* doc=XMLToolingConfig::getConfig().getParser().parse(in);
+        XercesJanitor<DOMDocument> janitor(doc);
+
+        scoped_ptr<MetadataProvider> metadataProvider(
+            SAMLConfig::getConfig().MetadataProviderManager.newPlugin(XML_METADATA_PROVIDER, doc->getDocumentElement(), false)
+            );
+        metadataProvider->init();
+        DiscoverableMetadataProvider* disco = dynamic_cast<DiscoverableMetadataProvider*>(metadataProvider.get());
+        TSM_ASSERT("XML provider was not discoverable", disco!=nullptr);
+
+        // Copies sharing an entityID each keep their own feed entry, in document order.
+        Locker locker(metadataProvider.get());
+        ostringstream out;
+        bool first = true;
+        disco->outputFeed(out, first);
+        const string feed = out.str();
+        string::size_type firstCopy = feed.find("First Copy"), secondCopy = feed.find("Second Copy");
+        TSM_ASSERT("First copy missing from feed", firstCopy != string::npos);
+        TSM_ASSERT("Second copy missing from feed", secondCopy != string::npos);
+        TSM_ASSERT("Copies out of document order", firstCopy < secondCopy);
+
+        ostringstream matches;
+        TSM_ASSERT_EQUALS("Both copies should be searchable", 2, disco->outputSearch(matches, "copy"));
+    }
+
     void testXMLWithExcludes() {
         skipNetworked();
         string config = data_path + "saml2/metadata/XMLWithExcludes.xml";